@@ -50,6 +50,12 @@ void dcfilter_reset(Filter* pFilter) {
 	pDCFilter->w = 0.0f;
 }
 
+void dcfilter_prime(Filter* pFilter, float value) {
+	DCFilter* pDCFilter = (DCFilter*)pFilter;
+	// steady state of w = value + alpha * w
+	pDCFilter->w = value / (1.0f - pDCFilter->alpha);
+}
+
 float dcfilter_filterValue(Filter* pFilter, float value) {
 	DCFilter* pDCFilter = (DCFilter*)pFilter;
 	float w = value + pDCFilter->alpha * pDCFilter->w;
@@ -17,5 +17,7 @@
 #include "filter.h"
 
 Filter* dcfilter_create(float alpha);
+// continues at the DC level value without transient, e.g. after a gain step of the input
+void dcfilter_prime(Filter* pFilter, float value);
 
 #endif /* FILTER_DCFILTER_H_ */
@@ -16,6 +16,10 @@
 #include <stdint.h>
 #include "sdkconfig.h"
 
+#define FONTS_MAX_CHARACTERWIDTH	32
+#define FONTS_MAX_CHARACTERHEIGHT	16
+#define FONTS_GLYPHBUFFERSIZE		(FONTS_MAX_CHARACTERWIDTH * FONTS_MAX_CHARACTERHEIGHT / 8)
+
 enum Graphics_Font {
 	#if (CONFIG_GRAPHICS_USE_FONT_SKETCHFLOW_PRINT == 1)
 	Graphics_Font_SketchFlow_Print_16 = 0,
@@ -33,11 +37,18 @@ struct FontInfo {
 	const uint8_t* characters;
 	const uint16_t* offsets;
 	uint8_t height;
+	uint8_t firstCharacter; // code of characters[offsets[0]]
 };
 
 void fonts_setActiveFont(enum Graphics_Font font);
+enum Graphics_Font fonts_getActiveFont(void);
 uint16_t fonts_getCharacterWidth(char c);
+// width table of the active font indexed by the (unsigned) character code, built on first use
+const uint8_t* fonts_getCharacterWidths(void);
+// glyph in the format of graphics_setImage(), packed fonts share one decode buffer
 const uint8_t* fonts_getCharacter(char c);
+// like fonts_getCharacter(), packed fonts are decoded into glyphBuffer (FONTS_GLYPHBUFFERSIZE bytes)
+const uint8_t* fonts_decodeCharacter(char c, uint8_t* glyphBuffer);
 uint8_t fonts_getCharacterHeight(void);
 
 #endif /* COMPONENTS_GRAPHICS_FONTS_H_ */
@@ -14,22 +14,42 @@
 #define MAIN_GRAPHICS_H_
 
 #include <stdint.h>
-#include "driver/i2c.h"
+#include "graphicspanel.h"
+#include "graphicsctx.h"
+
+// functions of the default context, see graphicsctx.h for further displays
 
 void graphics_startUpdate(void);
 void graphics_finishUpdate(void);
-esp_err_t graphics_init(i2c_port_t i2c, uint8_t displayWidth, uint8_t displayHeight, uint8_t xOffs, bool flipVertical, bool synchronousUpdate);
-uint8_t graphics_getDisplayWidth();
-uint8_t graphics_getDisplayHeight();
+void graphics_flush(void);
+void graphics_getUpdateStats(struct GraphicsUpdateStats_t* pStats);
+#if (CONFIG_GRAPHICS_STATS == 1)
+void graphics_getStats(struct GraphicsStats_t* pStats);
+void graphics_resetStats(void);
+void graphics_logStats(void);
+#endif
+#if !CONFIG_IDF_TARGET_LINUX
+esp_err_t graphics_init(i2c_port_t i2c, uint16_t displayWidth, uint16_t displayHeight, uint16_t xOffs, bool flipVertical, bool synchronousUpdate);
+#endif
+// uses the given panel backend (e.g. graphicspanel_createVirtual()), the panel is owned by the graphics module afterwards
+esp_err_t graphics_initPanel(GraphicsPanel* pPanel, uint16_t displayWidth, uint16_t displayHeight, uint16_t xOffs, bool synchronousUpdate);
+// NULL before graphics_init()
+GraphicsContext* graphics_getDefaultContext(void);
+uint16_t graphics_getDisplayWidth();
+uint16_t graphics_getDisplayHeight();
 void graphics_clearScreen(void);
-void graphics_clearRegion(uint8_t x1, uint8_t y1, uint8_t x2, uint8_t y2);
+void graphics_clearRegion(int x1, int y1, int x2, int y2);
 void graphics_scrollLine(void);
 void graphics_setImage(int x1, int y1, uint8_t width, uint8_t height, const uint8_t* image);
+void graphics_xorImage(int x1, int y1, uint8_t width, uint8_t height, const uint8_t* image);
 void graphics_setCursor(int x, int y);
 void graphics_setPixel(int x, int y);
 void graphics_clearPixel(int x, int y);
 void graphics_invertPixel(int x, int y);
 void graphics_setPixelValue(int x, int y, uint8_t pixel);
+void graphics_setPixels(const struct GraphicsPoint_t* points, size_t count, enum Graphics_RasterOp op);
+void graphics_setColumnPixels(int x1, const int16_t* ys, size_t count, enum Graphics_RasterOp op);
+void graphics_setGreyLevel(uint8_t level);
 void graphics_writeChars(char* text, uint8_t textlen);
 void graphics_writeString(char* text);
 void graphics_println(char* text);
@@ -0,0 +1,134 @@
+/*
+ * Part of the book "Embedded Systems mit RISC-V", dpunkt.verlag
+ * Author: Patrick Ritschel
+ *
+ * see https://ritschel.at/buch-embedded-systems-auf-den-punkt-gebracht/
+ *
+ * The code of this project is in the Public Domain (or CC0 licensed, at your option).
+ * Unless required by applicable law or agreed to in writing, this
+ * software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#ifndef COMPONENTS_GRAPHICS_GRAPHICSCTX_H_
+#define COMPONENTS_GRAPHICS_GRAPHICSCTX_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "sdkconfig.h"
+#include "graphicspanel.h"
+
+/*
+ * One display: framebuffer, dirty region, cursor, lock, text cache and (if not synchronous) transfer task.
+ * Contexts are independent, i.e. several displays can be drawn and transferred in parallel.
+ * The active font (fonts_setActiveFont()) is shared by all contexts.
+ * With GRAPHICS_BITSPERPIXEL 4 the framebuffer holds packed grey levels; images and fonts stay monochrome
+ * and are drawn in the current grey level.
+ */
+typedef struct _GraphicsContext_ GraphicsContext;
+
+enum Graphics_RasterOp {
+	GRAPHICS_RASTEROP_SET,
+	GRAPHICS_RASTEROP_CLEAR,
+	GRAPHICS_RASTEROP_INVERT
+};
+
+struct GraphicsPoint_t {
+	int16_t x;
+	int16_t y;
+};
+
+struct GraphicsUpdateStats_t {
+	uint32_t updates;		// finished updates
+	uint32_t transfers;		// transfers to the panel
+	uint32_t coalesced;		// updates sent together with a later one
+	uint32_t missedFrames;	// frame periods lost because a transfer took longer (GRAPHICS_MAX_FPS only)
+};
+
+#if (CONFIG_GRAPHICS_STATS == 1)
+/*
+ * Transfer and lock metrics since the last graphicsctx_resetStats() (GRAPHICS_STATS only).
+ * Times are measured with esp_timer_get_time(), lock times cover the outermost acquisition of the
+ * context mutex (drawing updates and the copy of the framebuffer for the transfer).
+ */
+struct GraphicsStats_t {
+	struct GraphicsUpdateStats_t update;	// coalesced: updates without a transfer of their own
+	uint32_t frames;				// transfers that sent pixel data
+	uint32_t bytes;					// pixel data handed to the panel
+	uint32_t pages;					// drawBitmap calls (one per display RAM page, 4bpp: one per frame)
+	uint32_t maxFrameBytes;
+	uint64_t transferTime_us;		// time spent in drawBitmap (on the SSD1306 incl. waiting for the I2C arbiter, not finishPage)
+	uint32_t maxTransferTime_us;	// per frame
+	uint32_t locks;
+	uint64_t lockWaitTime_us;
+	uint32_t maxLockWaitTime_us;
+	uint64_t lockHoldTime_us;
+	uint32_t maxLockHoldTime_us;
+};
+#endif
+
+/**
+ * Creates a context drawing to the given panel backend, the panel is owned by the context afterwards
+ * (on failure it stays with the caller).
+ * displayWidth and displayHeight are the panel size, with GRAPHICS_ROTATION_90/270 drawing happens in
+ * rotated coordinates, i.e. graphicsctx_getDisplayWidth() returns displayHeight (both have to be multiples of 8).
+ * @param synchronousUpdate transfer in graphicsctx_finishUpdate() instead of a separate task
+ * @return the context or NULL if out of memory (or, with GRAPHICS_FIXED_GEOMETRY, if the geometry differs
+ * from GRAPHICS_PIXELWIDTH x GRAPHICS_PIXELHEIGHT or all GRAPHICS_FIXED_CONTEXTS are in use; with
+ * GRAPHICS_BITSPERPIXEL 4 displayWidth and xOffs have to be multiples of 4)
+ */
+GraphicsContext* graphicsctx_create(GraphicsPanel* pPanel, uint16_t displayWidth, uint16_t displayHeight, uint16_t xOffs, bool synchronousUpdate);
+// no update must be in progress
+void graphicsctx_destroy(GraphicsContext* pContext);
+
+void graphicsctx_startUpdate(GraphicsContext* pContext);
+/**
+ * Ends the update. In synchronous mode the changes are transferred right away, otherwise the display task
+ * transfers them at most GRAPHICS_MAX_FPS times per second, i.e. quick successive updates are coalesced.
+ */
+void graphicsctx_finishUpdate(GraphicsContext* pContext);
+// transfers the changes without waiting for the end of the frame period (call after graphicsctx_finishUpdate())
+void graphicsctx_flush(GraphicsContext* pContext);
+void graphicsctx_getUpdateStats(GraphicsContext* pContext, struct GraphicsUpdateStats_t* pStats);
+#if (CONFIG_GRAPHICS_STATS == 1)
+void graphicsctx_getStats(GraphicsContext* pContext, struct GraphicsStats_t* pStats);
+void graphicsctx_resetStats(GraphicsContext* pContext);
+// logs the stats as one summary line and resets them, i.e. call periodically for per-interval figures
+void graphicsctx_logStats(GraphicsContext* pContext, const char* name);
+#endif
+uint16_t graphicsctx_getDisplayWidth(GraphicsContext* pContext);
+uint16_t graphicsctx_getDisplayHeight(GraphicsContext* pContext);
+void graphicsctx_clearScreen(GraphicsContext* pContext);
+void graphicsctx_clearRegion(GraphicsContext* pContext, int x1, int y1, int x2, int y2);
+void graphicsctx_scrollLine(GraphicsContext* pContext);
+void graphicsctx_setImage(GraphicsContext* pContext, int x1, int y1, uint8_t width, uint8_t height, const uint8_t* image);
+void graphicsctx_setCursor(GraphicsContext* pContext, int x, int y);
+void graphicsctx_setPixel(GraphicsContext* pContext, int x, int y);
+void graphicsctx_clearPixel(GraphicsContext* pContext, int x, int y);
+void graphicsctx_invertPixel(GraphicsContext* pContext, int x, int y);
+void graphicsctx_setPixelValue(GraphicsContext* pContext, int x, int y, uint8_t pixel);
+/*
+ * Batches of pixels: points outside the display are skipped, the dirty region is updated once per batch.
+ * Cheaper than graphicsctx_setPixel() in a loop for charts and scatter plots.
+ */
+void graphicsctx_setPixels(GraphicsContext* pContext, const struct GraphicsPoint_t* points, size_t count, enum Graphics_RasterOp op);
+// one sample per column: pixel (x1 + i, ys[i]) for i < count
+void graphicsctx_setColumnPixels(GraphicsContext* pContext, int x1, const int16_t* ys, size_t count, enum Graphics_RasterOp op);
+// inverts the pixels set in the image (format of graphicsctx_setImage()), drawing it twice restores the framebuffer
+void graphicsctx_xorImage(GraphicsContext* pContext, int x1, int y1, uint8_t width, uint8_t height, const uint8_t* image);
+/*
+ * Save-under buffers, e.g. for sprites: the framebuffer bytes of the region x1, y1, width, height (clipped to the display).
+ * graphicsctx_getRegionBufferSize() is enough for any position. Restoring writes back exactly the pixels of the region.
+ */
+size_t graphicsctx_getRegionBufferSize(GraphicsContext* pContext, uint8_t width, uint8_t height);
+void graphicsctx_saveRegion(GraphicsContext* pContext, int x1, int y1, uint8_t width, uint8_t height, uint8_t* buffer);
+void graphicsctx_restoreRegion(GraphicsContext* pContext, int x1, int y1, uint8_t width, uint8_t height, const uint8_t* buffer);
+// grey level 0..15 of set pixels, images and text (default 15), without effect on monochrome displays
+void graphicsctx_setGreyLevel(GraphicsContext* pContext, uint8_t level);
+void graphicsctx_writeChars(GraphicsContext* pContext, char* text, uint8_t textlen);
+void graphicsctx_writeString(GraphicsContext* pContext, char* text);
+void graphicsctx_println(GraphicsContext* pContext, char* text);
+void graphicsctx_drawLine(GraphicsContext* pContext, int x1, int y1, int x2, int y2, int pattern);
+
+#endif /* COMPONENTS_GRAPHICS_GRAPHICSCTX_H_ */
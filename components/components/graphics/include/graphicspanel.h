@@ -0,0 +1,76 @@
+/*
+ * Part of the book "Embedded Systems mit RISC-V", dpunkt.verlag
+ * Author: Patrick Ritschel
+ *
+ * see https://ritschel.at/buch-embedded-systems-auf-den-punkt-gebracht/
+ *
+ * The code of this project is in the Public Domain (or CC0 licensed, at your option).
+ * Unless required by applicable law or agreed to in writing, this
+ * software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#ifndef COMPONENTS_GRAPHICS_GRAPHICSPANEL_H_
+#define COMPONENTS_GRAPHICS_GRAPHICSPANEL_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "sdkconfig.h"
+#include "esp_err.h"
+#if !CONFIG_IDF_TARGET_LINUX
+#include "driver/i2c.h"
+#endif
+
+// lines of the SSD1306 display RAM, the start line wraps around them
+#define GRAPHICSPANEL_RAMHEIGHT		64
+
+/*
+ * Panel backend the graphics module transfers its framebuffer to.
+ * Bitmaps are in SSD1306 page format (one byte = 8 vertical pixels), y1 and y2 are multiples of 8.
+ * With GRAPHICS_BITSPERPIXEL 4 they are rows of packed grey levels (left pixel in the high nibble,
+ * SSD1322 order), x1 and x2 are multiples of 4 and setStartLine is not used.
+ */
+typedef struct _GraphicsPanel_ {
+	esp_err_t (*drawBitmap)(struct _GraphicsPanel_* pPanel, int x1, int y1, int x2, int y2, const uint8_t* data);
+	// RAM line shown at the top of the display (hardware scrolling)
+	esp_err_t (*setStartLine)(struct _GraphicsPanel_* pPanel, uint8_t line);
+	// called after each drawBitmap, e.g. to leave the bus to other devices, may be NULL
+	void (*finishPage)(struct _GraphicsPanel_* pPanel);
+	// called after each transfer of the dirty region, may be NULL
+	void (*finishFrame)(struct _GraphicsPanel_* pPanel);
+	void (*destroy)(struct _GraphicsPanel_* pPanel);
+} GraphicsPanel;
+
+#if !CONFIG_IDF_TARGET_LINUX
+// SSD1306 connected via I2C, driven by esp_lcd
+GraphicsPanel* graphicspanel_createSsd1306(i2c_port_t i2c, uint32_t i2cAddr, bool flipVertical, esp_err_t* pRes);
+#endif
+
+struct GraphicsPanelStats_t {
+	uint32_t frames;				// frames with at least one transaction
+	uint32_t transactions;
+	uint32_t bytes;					// pixel data
+	uint32_t wireBytes;				// estimated I2C bytes incl. addressing and commands
+	uint32_t lastFrameTransactions;
+	uint32_t lastFrameBytes;
+	uint32_t lastFrameWireBytes;
+	uint32_t maxFrameWireBytes;
+};
+
+/**
+ * Creates an in-memory panel (display RAM of ramWidth x ramHeight pixels) for tests and benchmarks.
+ * Counts transactions and bytes as they would go over the wire to a SSD1306 (or, with
+ * GRAPHICS_BITSPERPIXEL 4, to a greyscale controller addressed the same way).
+ * @return the panel or NULL if out of memory
+ */
+GraphicsPanel* graphicspanel_createVirtual(uint16_t ramWidth, uint16_t ramHeight);
+void graphicspanel_getVirtualStats(GraphicsPanel* pPanel, struct GraphicsPanelStats_t* pStats);
+void graphicspanel_resetVirtualStats(GraphicsPanel* pPanel);
+// pixel of the display RAM as shown on the panel (start line applied): 0/1 or grey level 0..15
+uint8_t graphicspanel_getVirtualPixel(GraphicsPanel* pPanel, int x, int y);
+// writes the shown content as binary PBM (P4), with GRAPHICS_BITSPERPIXEL 4 as binary PGM (P5)
+esp_err_t graphicspanel_writeVirtualPBM(GraphicsPanel* pPanel, FILE* pFile);
+
+#endif /* COMPONENTS_GRAPHICS_GRAPHICSPANEL_H_ */
@@ -0,0 +1,59 @@
+/*
+ * Part of the book "Embedded Systems mit RISC-V", dpunkt.verlag
+ * Author: Patrick Ritschel
+ *
+ * see https://ritschel.at/buch-embedded-systems-auf-den-punkt-gebracht/
+ *
+ * The code of this project is in the Public Domain (or CC0 licensed, at your option).
+ * Unless required by applicable law or agreed to in writing, this
+ * software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#ifndef COMPONENTS_GRAPHICS_SPRITES_H_
+#define COMPONENTS_GRAPHICS_SPRITES_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "graphicsctx.h"
+
+typedef struct _SpriteLayer_ SpriteLayer;
+typedef struct _Sprite_ Sprite;
+
+enum Sprites_Mode {
+	SPRITES_SAVEUNDER,	// the background is saved before drawing and restored when the sprite moves or hides
+	SPRITES_XOR			// drawn inverting (visible on any background), removed by drawing it again, no buffer
+};
+
+/*
+ * Sprites are drawn on top of the framebuffer content without destroying it. A layer keeps its sprites in
+ * z-order; a changed sprite is removed and redrawn together with the sprites overlapping it, all others stay
+ * untouched. Only the regions of these sprites become dirty, i.e. an animated icon costs its own bytes per frame.
+ * Drawing beneath a sprite invalidates its saved background: call sprites_lift() before and sprites_render()
+ * after it, within one graphicsctx_startUpdate()/graphicsctx_finishUpdate() to avoid flicker.
+ * Sprite setters may be called from any task.
+ */
+SpriteLayer* sprites_createLayer(void);
+// layer on another display, NULL: default context
+SpriteLayer* sprites_createLayerOnContext(GraphicsContext* pContext);
+// the sprites are destroyed, too (and not removed from the framebuffer)
+void sprites_destroyLayer(SpriteLayer* pLayer);
+/**
+ * Creates an invisible sprite without image, z: higher values are drawn on top (equal: later created on top).
+ * @return the sprite or NULL if out of memory
+ */
+Sprite* sprites_createSprite(SpriteLayer* pLayer, uint8_t width, uint8_t height, enum Sprites_Mode mode, int z);
+// image in the format of graphics_setImage(), width x height of the sprite, e.g. the next animation frame
+void sprites_setImage(Sprite* pSprite, const uint8_t* image);
+void sprites_moveTo(Sprite* pSprite, int x, int y);
+void sprites_setVisible(Sprite* pSprite, bool visible);
+// removes all sprites from the framebuffer, the next sprites_render() draws them again
+void sprites_lift(SpriteLayer* pLayer);
+/**
+ * Removes and redraws the changed sprites within one graphics update.
+ * @return true if anything was drawn
+ */
+bool sprites_render(SpriteLayer* pLayer);
+
+#endif /* COMPONENTS_GRAPHICS_SPRITES_H_ */
@@ -13,5 +13,10 @@
 
 #define SSD1306_COMMAND_SETCONTRAST			0x81
 #define SSD1306_COMMAND_SETPRECHARGE		0xD9
+#define SSD1306_COMMAND_SETSTARTLINE		0x40	// | line (0..63)
+
+#define SSD1306_RAMHEIGHT					64
 
 esp_err_t ssd1306patch_sendCommand(esp_lcd_panel_t *panel, uint8_t command, uint8_t data);
+// RAM line shown at the top of the display (hardware scrolling)
+esp_err_t ssd1306patch_setStartLine(esp_lcd_panel_t *panel, uint8_t line);
@@ -0,0 +1,49 @@
+/*
+ * Part of the book "Embedded Systems mit RISC-V", dpunkt.verlag
+ * Author: Patrick Ritschel
+ *
+ * see https://ritschel.at/buch-embedded-systems-auf-den-punkt-gebracht/
+ *
+ * The code of this project is in the Public Domain (or CC0 licensed, at your option).
+ * Unless required by applicable law or agreed to in writing, this
+ * software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#ifndef COMPONENTS_GRAPHICS_STRIPCHART_H_
+#define COMPONENTS_GRAPHICS_STRIPCHART_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "graphicsctx.h"
+
+#define STRIPCHART_MAXHEIGHT	64
+
+enum StripChart_Mode {
+	STRIPCHART_SWEEP,		// new values overwrite the oldest column, a blank gap runs ahead of the write position
+	STRIPCHART_SCROLL		// newest value is always the rightmost column, the chart moves to the left
+};
+
+typedef struct _StripChart_ StripChart;
+
+/**
+ * Creates a strip chart keeping the last width values in a ring buffer.
+ * Consecutive values are connected by vertical spans, every column is rendered as a whole
+ * (no clearing necessary). y1 and height should be multiples of 8 for fast column transfer.
+ * Not thread-safe: adding and rendering have to be serialized by the caller.
+ * @param gridY dotted horizontal grid line relative to y1, -1: none
+ * @return the chart or NULL if out of memory
+ */
+StripChart* stripchart_create(int x1, int y1, uint8_t width, uint8_t height, enum StripChart_Mode mode, int gridY);
+void stripchart_destroy(StripChart* pChart);
+void stripchart_clear(StripChart* pChart);
+// stores the value (relative to y1, clipped to the chart), drawn with the next stripchart_render()
+void stripchart_addValue(StripChart* pChart, int y);
+/**
+ * Renders the columns changed since the last call to the framebuffer, or all columns if fullRedraw is set.
+ * Call between graphicsctx_startUpdate() and graphicsctx_finishUpdate() to transfer once.
+ */
+void stripchart_render(StripChart* pChart, GraphicsContext* pContext, bool fullRedraw);
+
+#endif /* COMPONENTS_GRAPHICS_STRIPCHART_H_ */
@@ -0,0 +1,47 @@
+/*
+ * Part of the book "Embedded Systems mit RISC-V", dpunkt.verlag
+ * Author: Patrick Ritschel
+ *
+ * see https://ritschel.at/buch-embedded-systems-auf-den-punkt-gebracht/
+ *
+ * The code of this project is in the Public Domain (or CC0 licensed, at your option).
+ * Unless required by applicable law or agreed to in writing, this
+ * software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#ifndef COMPONENTS_GRAPHICS_TEXTCACHE_H_
+#define COMPONENTS_GRAPHICS_TEXTCACHE_H_
+
+#include <stdint.h>
+#include "fonts.h"
+
+// a pre-rendered text run, same layout as an image for graphics_setImage()
+struct TextRun_t {
+	uint16_t width;
+	uint8_t height;
+	const uint8_t* bitmap;
+};
+
+typedef struct _TextCache_ TextCache;
+
+/**
+ * Creates a LRU cache for pre-rendered text runs.
+ * @param entries number of cached runs
+ * @param maxChars maximum length of a cached string, longer strings are not cached
+ * @param maxWidth maximum width of a run in pixels, characters beyond are dropped
+ * @param maxHeight maximum font height in pixels
+ * @return the cache or NULL if out of memory
+ */
+TextCache* textcache_create(uint8_t entries, uint8_t maxChars, uint16_t maxWidth, uint8_t maxHeight);
+void textcache_destroy(TextCache* pCache);
+void textcache_clear(TextCache* pCache);
+
+/**
+ * Returns the rendered run of the given text in the given font (must be the active font).
+ * Renders the text on a cache miss and evicts the least recently used entry.
+ * @return the run or NULL if the text cannot be cached
+ */
+const struct TextRun_t* textcache_getRun(TextCache* pCache, enum Graphics_Font font, const char* text, uint8_t textlen);
+
+#endif /* COMPONENTS_GRAPHICS_TEXTCACHE_H_ */
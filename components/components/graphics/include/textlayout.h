@@ -0,0 +1,49 @@
+/*
+ * Part of the book "Embedded Systems mit RISC-V", dpunkt.verlag
+ * Author: Patrick Ritschel
+ *
+ * see https://ritschel.at/buch-embedded-systems-auf-den-punkt-gebracht/
+ *
+ * The code of this project is in the Public Domain (or CC0 licensed, at your option).
+ * Unless required by applicable law or agreed to in writing, this
+ * software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#ifndef COMPONENTS_GRAPHICS_TEXTLAYOUT_H_
+#define COMPONENTS_GRAPHICS_TEXTLAYOUT_H_
+
+#include <stdint.h>
+
+#include "graphicsctx.h"
+
+enum TextLayout_Align {
+	TEXTLAYOUT_LEFT,
+	TEXTLAYOUT_CENTER,
+	TEXTLAYOUT_RIGHT
+};
+
+/*
+ * Measuring, word wrapping and aligning text with the active font.
+ * Widths come from the cached width table of the font (fonts_getCharacterWidths()),
+ * i.e. one table lookup per character.
+ */
+
+// width of the first textlen characters in pixels
+uint16_t textlayout_measure(const char* text, uint8_t textlen);
+/**
+ * Determines the first line of text within maxWidth pixels. Breaks after the last blank that fits,
+ * words longer than maxWidth are broken between characters, '\n' ends the line.
+ * @param pLineWidth width of the line without trailing blanks, may be NULL
+ * @return number of characters of the line (at least 1 if textlen > 0, trailing blanks excluded)
+ */
+uint8_t textlayout_fitLine(const char* text, uint8_t textlen, uint16_t maxWidth, uint16_t* pLineWidth);
+/**
+ * Draws the text word wrapped into the box x1, y1 incl., x2, y2 excl., every line aligned within x1..x2.
+ * Lines not completely within the box are dropped. Unchanged cached lines are neither drawn nor transferred
+ * (see GRAPHICS_TEXTCACHE_ENTRIES). Call between graphicsctx_startUpdate() and graphicsctx_finishUpdate().
+ * @return the number of lines drawn
+ */
+int textlayout_drawText(GraphicsContext* pContext, int x1, int y1, int x2, int y2, const char* text, enum TextLayout_Align align);
+
+#endif /* COMPONENTS_GRAPHICS_TEXTLAYOUT_H_ */
@@ -0,0 +1,82 @@
+/*
+ * Part of the book "Embedded Systems mit RISC-V", dpunkt.verlag
+ * Author: Patrick Ritschel
+ *
+ * see https://ritschel.at/buch-embedded-systems-auf-den-punkt-gebracht/
+ *
+ * The code of this project is in the Public Domain (or CC0 licensed, at your option).
+ * Unless required by applicable law or agreed to in writing, this
+ * software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#ifndef COMPONENTS_GRAPHICS_WIDGETS_H_
+#define COMPONENTS_GRAPHICS_WIDGETS_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "graphicsctx.h"
+#include "stripchart.h"
+#include "textlayout.h"
+
+#define WIDGETS_MAX_TEXTLENGTH		24
+
+typedef struct _WidgetScreen_ WidgetScreen;
+
+// base "class" of all widgets, bounds: x1, y1 incl., x2, y2 excl.
+typedef struct _Widget_ {
+	void (*destroy)(struct _Widget_* pWidget);
+	void (*draw)(struct _Widget_* pWidget, GraphicsContext* pContext, bool fullRedraw);
+	WidgetScreen* pScreen;
+	struct _Widget_* pNext;
+	int x1;
+	int y1;
+	int x2;
+	int y2;
+	bool invalid;
+	bool fullRedraw;
+	bool clearBeforeDraw;
+} Widget;
+
+/*
+ * A screen holds its widgets in z-order (first added = bottom) and redraws
+ * only invalidated ones. Widgets overlapping a cleared widget are redrawn, too.
+ * Widget setters may be called from any task.
+ */
+WidgetScreen* widgets_createScreen(void);
+// screen on another display, NULL: default context
+WidgetScreen* widgets_createScreenOnContext(GraphicsContext* pContext);
+void widgets_destroyScreen(WidgetScreen* pScreen);
+void widgets_addWidget(WidgetScreen* pScreen, Widget* pWidget);
+void widgets_invalidate(Widget* pWidget);
+void widgets_invalidateAll(WidgetScreen* pScreen);
+/**
+ * Redraws all invalidated widgets within one graphics update, i.e. triggers at most one transfer.
+ * @return true if anything was drawn
+ */
+bool widgets_render(WidgetScreen* pScreen);
+
+// text label, drawn with the active font, word wrapped within the bounds
+Widget* widgets_createLabel(int x1, int y1, int x2, int y2, const char* text);
+void widgets_setLabelText(Widget* pWidget, const char* text);
+// labels and values, default TEXTLAYOUT_LEFT
+void widgets_setLabelAlign(Widget* pWidget, enum TextLayout_Align align);
+
+// numeric value, printed with format (e.g. "%d bpm") or noValueText if the value equals noValue
+Widget* widgets_createValue(int x1, int y1, int x2, int y2, const char* format, int32_t noValue, const char* noValueText);
+void widgets_setValue(Widget* pWidget, int32_t value);
+
+// image in the format of graphics_setImage()
+Widget* widgets_createIcon(int x, int y, uint8_t width, uint8_t height, const uint8_t* image, bool visible);
+void widgets_setIconVisible(Widget* pWidget, bool visible);
+
+// horizontal bar with outline, filled proportionally to value / maxValue
+Widget* widgets_createBar(int x1, int y1, int x2, int y2, int32_t maxValue);
+void widgets_setBarValue(Widget* pWidget, int32_t value);
+
+// strip chart, one column per value (y relative to y1), see stripchart.h, dotted grid line at gridY (-1: none)
+Widget* widgets_createChart(int x1, int y1, int x2, int y2, enum StripChart_Mode mode, int gridY);
+void widgets_addChartValue(Widget* pWidget, int y);
+
+#endif /* COMPONENTS_GRAPHICS_WIDGETS_H_ */
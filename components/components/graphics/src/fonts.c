@@ -9,20 +9,41 @@
  * software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
  * CONDITIONS OF ANY KIND, either express or implied.
  */
+#include <stdbool.h>
+#include <string.h>
+#include <assert.h>
+
 #include "fonts.h"
 
-#if (CONFIG_GRAPHICS_USE_FONT_SKETCHFLOW_PRINT == 1)
-#include "../fonts/Sketchflow_Print.ttf.inc"
-#endif
+#if (CONFIG_GRAPHICS_FONT_PACKED == 1)
+	#if (CONFIG_GRAPHICS_USE_FONT_SKETCHFLOW_PRINT == 1)
+	#include "../fonts/Sketchflow_Print.ttf.packed.inc"
+	#endif
 
-#if (CONFIG_GRAPHICS_USE_FONT_STENCIL == 1)
-#include "../fonts/STENCIL.TTF.inc"
-#endif
+	#if (CONFIG_GRAPHICS_USE_FONT_STENCIL == 1)
+	#include "../fonts/STENCIL.TTF.packed.inc"
+	#endif
 
-#if (CONFIG_GRAPHICS_USE_FONT_TREBUCHET_MS == 1)
-#include "../fonts/trebuc.ttf.inc"
+	#if (CONFIG_GRAPHICS_USE_FONT_TREBUCHET_MS == 1)
+	#include "../fonts/trebuc.ttf.packed.inc"
+	#endif
+#else
+	#if (CONFIG_GRAPHICS_USE_FONT_SKETCHFLOW_PRINT == 1)
+	#include "../fonts/Sketchflow_Print.ttf.inc"
+	#endif
+
+	#if (CONFIG_GRAPHICS_USE_FONT_STENCIL == 1)
+	#include "../fonts/STENCIL.TTF.inc"
+	#endif
+
+	#if (CONFIG_GRAPHICS_USE_FONT_TREBUCHET_MS == 1)
+	#include "../fonts/trebuc.ttf.inc"
+	#endif
 #endif
 
+#define MIN(a,b) ((a) < (b) ? (a) : (b))
+
+
 static enum Graphics_Font gActiveFont =
 #if (CONFIG_GRAPHICS_DEFAULT_FONT_SKETCHFLOW_PRINT == 1)
 		Graphics_Font_SketchFlow_Print_16;
@@ -32,6 +53,41 @@ static enum Graphics_Font gActiveFont =
 		Graphics_Font_Trebuchet_MS_16;
 #endif
 
+#if (CONFIG_GRAPHICS_FONT_PACKED == 1)
+static const struct FontInfo gFontInfos[] = {
+	#if (CONFIG_GRAPHICS_USE_FONT_SKETCHFLOW_PRINT == 1)
+		{ .characterCount = SSD1306_FONT_SketchFlow_Print_16_PACKEDCHARACTERCOUNT,
+		  .characters = gFont_SketchFlow_Print_16_PackedCharacters,
+		  .offsets = gFont_SketchFlow_Print_16_PackedOffsets,
+		  .height = 16,
+		  .firstCharacter = SSD1306_FONT_SketchFlow_Print_16_FIRSTCHARACTER
+		},
+	#else
+		{ 0 },
+	#endif
+	#if (CONFIG_GRAPHICS_USE_FONT_STENCIL == 1)
+		{ .characterCount = SSD1306_FONT_Stencil_16_PACKEDCHARACTERCOUNT,
+		  .characters = gFont_Stencil_16_PackedCharacters,
+		  .offsets = gFont_Stencil_16_PackedOffsets,
+		  .height = 16,
+		  .firstCharacter = SSD1306_FONT_Stencil_16_FIRSTCHARACTER
+		},
+	#else
+		{ 0 },
+	#endif
+	#if (CONFIG_GRAPHICS_USE_FONT_TREBUCHET_MS == 1)
+		{ .characterCount = SSD1306_FONT_Trebuchet_MS_16_PACKEDCHARACTERCOUNT,
+		  .characters = gFont_Trebuchet_MS_16_PackedCharacters,
+		  .offsets = gFont_Trebuchet_MS_16_PackedOffsets,
+		  .height = 16,
+		  .firstCharacter = SSD1306_FONT_Trebuchet_MS_16_FIRSTCHARACTER
+		},
+	#endif
+};
+
+// decoded glyph of the last fonts_getCharacter() call
+static uint8_t gGlyphBuffer[FONTS_GLYPHBUFFERSIZE];
+#else
 static const struct FontInfo gFontInfos[] = {
 	#if (CONFIG_GRAPHICS_USE_FONT_SKETCHFLOW_PRINT == 1)
 		{ .characterCount = SSD1306_FONT_SketchFlow_Print_16_CHARACTERCOUNT,
@@ -59,21 +115,134 @@ static const struct FontInfo gFontInfos[] = {
 		},
 	#endif
 };
+#endif
+
+#define FONT_COUNT (sizeof(gFontInfos) / sizeof(gFontInfos[0]))
+
+// widths of all 256 character codes per font, filled on first use (concurrent fills write the same values)
+static uint8_t gCharacterWidths[FONT_COUNT][256];
+static bool gCharacterWidthsValid[FONT_COUNT];
 
+// internal prototypes
+static int getCharacterIndex(const struct FontInfo* pInfo, char c);
+static uint16_t computeCharacterWidth(const struct FontInfo* pInfo, char c);
+#if (CONFIG_GRAPHICS_FONT_PACKED == 1)
+static void unpackCharacter(const struct FontInfo* pInfo, int index, uint8_t* glyph);
+#endif
+
+// ***** implementation *****
 void fonts_setActiveFont(enum Graphics_Font font) {
 	gActiveFont = font;
 }
 
+enum Graphics_Font fonts_getActiveFont() {
+	return gActiveFont;
+}
+
 uint16_t fonts_getCharacterWidth(char c) {
-	return (gFontInfos[gActiveFont].offsets[(int)(c+1)] - gFontInfos[gActiveFont].offsets[(int)c]) / 2;
+	return fonts_getCharacterWidths()[(uint8_t)c];
+}
+
+const uint8_t* fonts_getCharacterWidths() {
+	if (!gCharacterWidthsValid[gActiveFont]) {
+		const struct FontInfo* pInfo = &(gFontInfos[gActiveFont]);
+		for (int c = 0; c < 256; c += 1) {
+			gCharacterWidths[gActiveFont][c] = computeCharacterWidth(pInfo, (char)c);
+		}
+		gCharacterWidthsValid[gActiveFont] = true;
+	}
+	return gCharacterWidths[gActiveFont];
+}
+
+// index into offsets, -1 if the character is not part of the font
+int getCharacterIndex(const struct FontInfo* pInfo, char c) {
+	int index = (uint8_t)c - pInfo->firstCharacter;
+	if ((index < 0) || (index >= pInfo->characterCount)) {
+		return -1;
+	}
+	return index;
+}
+
+#if (CONFIG_GRAPHICS_FONT_PACKED == 1)
+uint16_t computeCharacterWidth(const struct FontInfo* pInfo, char c) {
+	int index = getCharacterIndex(pInfo, c);
+	if ((index < 0) || (pInfo->offsets[index] == pInfo->offsets[index + 1])) {
+		return 0;
+	}
+	return pInfo->characters[pInfo->offsets[index]];
+}
+
+const uint8_t* fonts_getCharacter(char c) {
+	return fonts_decodeCharacter(c, gGlyphBuffer);
+}
+
+const uint8_t* fonts_decodeCharacter(char c, uint8_t* glyphBuffer) {
+	const struct FontInfo* pInfo = &(gFontInfos[gActiveFont]);
+	int index = getCharacterIndex(pInfo, c);
+	if ((index >= 0) && (pInfo->offsets[index] != pInfo->offsets[index + 1])) {
+		unpackCharacter(pInfo, index, glyphBuffer);
+	}
+	return glyphBuffer;
+}
+
+// see tools/fontpacker.py for the format
+void unpackCharacter(const struct FontInfo* pInfo, int index, uint8_t* glyph) {
+	const uint8_t* pRecord = &(pInfo->characters[pInfo->offsets[index]]);
+	const uint8_t* pEnd = &(pInfo->characters[pInfo->offsets[index + 1]]);
+	uint8_t width = pRecord[0];
+	uint8_t top = pRecord[1] >> 4;
+	uint8_t bottom = top + (pRecord[1] & 0x0F) + 1;
+	assert(width <= FONTS_MAX_CHARACTERWIDTH);
+	memset(glyph, 0x00, width * (pInfo->height / 8));
+
+	uint8_t* pColumn = glyph;
+	uint8_t y = top;
+	bool value = false;
+	for (pRecord += 2; pRecord < pEnd; pRecord += 1) {
+		uint8_t nibbles[2] = { *pRecord >> 4, *pRecord & 0x0F };
+		for (int i = 0; i < 2; i += 1) {
+			uint8_t run = nibbles[i];
+			while (run > 0) {
+				// set up to one byte of the run at once
+				uint8_t bits = MIN(run, MIN(bottom - y, 8 - (y % 8)));
+				if (value) {
+					pColumn[(y / 8) * width] |= ((1 << bits) - 1) << (y % 8);
+				}
+				run -= bits;
+				y += bits;
+				if (y == bottom) {
+					y = top;
+					pColumn += 1;
+				}
+			}
+			if (nibbles[i] != 15) {
+				value = !value;
+			}
+		}
+	}
+}
+#else
+uint16_t computeCharacterWidth(const struct FontInfo* pInfo, char c) {
+	int index = getCharacterIndex(pInfo, c);
+	if (index < 0) {
+		return 0;
+	}
+	return (pInfo->offsets[index + 1] - pInfo->offsets[index]) / 2;
 }
 
 const uint8_t* fonts_getCharacter(char c) {
+	const struct FontInfo* pInfo = &(gFontInfos[gActiveFont]);
 	if (fonts_getCharacterWidth(c) == 0) {
-		return &(gFontInfos[gActiveFont].characters[0]);
+		return &(pInfo->characters[0]);
 	}
-	return &(gFontInfos[gActiveFont].characters[gFontInfos[gActiveFont].offsets[(int)c]]);
+	return &(pInfo->characters[pInfo->offsets[getCharacterIndex(pInfo, c)]]);
+}
+
+const uint8_t* fonts_decodeCharacter(char c, uint8_t* glyphBuffer) {
+	// raw glyphs are used in place
+	return fonts_getCharacter(c);
 }
+#endif
 
 uint8_t fonts_getCharacterHeight() {
 	return gFontInfos[gActiveFont].height;
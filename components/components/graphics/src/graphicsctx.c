@@ -0,0 +1,1169 @@
+/*
+ * Part of the book "Embedded Systems mit RISC-V", dpunkt.verlag
+ * Author: Patrick Ritschel
+ *
+ * see https://ritschel.at/buch-embedded-systems-auf-den-punkt-gebracht/
+ *
+ * The code of this project is in the Public Domain (or CC0 licensed, at your option).
+ * Unless required by applicable law or agreed to in writing, this
+ * software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "sdkconfig.h"
+#include "esp_heap_caps.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#if (CONFIG_GRAPHICS_STATS == 1)
+#include <inttypes.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#endif
+
+#include "fonts.h"
+#include "textcache.h"
+#include "graphicspanel.h"
+#include "graphicsctx.h"
+
+#if (CONFIG_GRAPHICS_BITSPERPIXEL == 4)
+	// packed nibbles, rows of width / 2 bytes, the left pixel in the high nibble
+	#define GREY_XALIGN		4	// transfers start and end on multiples of 4 pixels (SSD1322 column address unit)
+#elif (CONFIG_GRAPHICS_BITSPERPIXEL != 1)
+	#error "The graphics module supports monochrome (1) and 4 bit greyscale (4) displays only!"
+#endif
+
+#define MAX(a,b) ((a) > (b) ? (a) : (b))
+#define MIN(a,b) ((a) < (b) ? (a) : (b))
+
+#define DISPLAY_TASK_STACKSIZE		2048
+#if (CONFIG_GRAPHICS_MAX_FPS > 0)
+	#define FRAME_PERIOD_TICKS		MAX(1, pdMS_TO_TICKS(1000 / CONFIG_GRAPHICS_MAX_FPS))
+#endif
+#define TEXTCACHE_MAXFONTHEIGHT		16
+
+// rotated: the framebuffer is in drawing coordinates, 8x8 blocks are transposed into panel pages at transfer time
+#if (CONFIG_GRAPHICS_ROTATION_90 == 1) || (CONFIG_GRAPHICS_ROTATION_270 == 1)
+	#define GRAPHICS_ROTATED				1
+	#define LOGICAL_PIXELWIDTH				CONFIG_GRAPHICS_PIXELHEIGHT
+	#define LOGICAL_PIXELHEIGHT				CONFIG_GRAPHICS_PIXELWIDTH
+	#if (CONFIG_GRAPHICS_BITSPERPIXEL != 1)
+		#error "Rotation is supported for monochrome displays only!"
+	#endif
+#else
+	#define GRAPHICS_ROTATED				0
+	#define LOGICAL_PIXELWIDTH				CONFIG_GRAPHICS_PIXELWIDTH
+	#define LOGICAL_PIXELHEIGHT				CONFIG_GRAPHICS_PIXELHEIGHT
+#endif
+
+// monochrome, not rotated: every dirty page is transferred with its own column range
+#if (CONFIG_GRAPHICS_BITSPERPIXEL == 1) && (GRAPHICS_ROTATED == 0)
+	#define GRAPHICS_LINEDIRTY				1
+	#define MAX_LINECOUNT					(GRAPHICSPANEL_RAMHEIGHT / 8)
+#else
+	#define GRAPHICS_LINEDIRTY				0
+#endif
+
+// with a fixed geometry the sizes are constants and the index math folds to shifts
+#if (CONFIG_GRAPHICS_FIXED_GEOMETRY == 1)
+	#define FIXED_BUFFERLENGTH				(CONFIG_GRAPHICS_PIXELWIDTH * CONFIG_GRAPHICS_PIXELHEIGHT / (8 / CONFIG_GRAPHICS_BITSPERPIXEL))
+	#define CONTEXT_WIDTH(pContext)			LOGICAL_PIXELWIDTH
+	#define CONTEXT_HEIGHT(pContext)		LOGICAL_PIXELHEIGHT
+	#define CONTEXT_BUFFERLENGTH(pContext)	FIXED_BUFFERLENGTH
+	#define CONTEXT_LINECOUNT(pContext)		(LOGICAL_PIXELHEIGHT / 8)
+	#define CONTEXT_ROWBYTES(pContext)		(LOGICAL_PIXELWIDTH / 2)
+	#if (LOGICAL_PIXELHEIGHT % 8 != 0)
+		#error "The display height must be a multiple of 8!"
+	#endif
+#else
+	#define CONTEXT_WIDTH(pContext)			((pContext)->displayWidth)
+	#define CONTEXT_HEIGHT(pContext)		((pContext)->displayHeight)
+	#define CONTEXT_BUFFERLENGTH(pContext)	((pContext)->bufferLength)
+	#define CONTEXT_LINECOUNT(pContext)		((pContext)->lineCount)
+	#define CONTEXT_ROWBYTES(pContext)		((pContext)->displayWidth / 2)
+#endif
+
+struct _GraphicsContext_ {
+	GraphicsPanel* pPanel;
+
+	uint16_t displayWidth;		// in drawing coordinates, i.e. rotated
+	uint16_t displayHeight;
+	bool synchronousUpdate;
+	uint16_t xOffs;
+
+#if (CONFIG_GRAPHICS_FIXED_GEOMETRY == 1)
+	uint8_t displayBuffer[FIXED_BUFFERLENGTH];
+	uint8_t transferBuffer[FIXED_BUFFERLENGTH];
+#else
+	uint8_t* displayBuffer;
+	uint8_t* transferBuffer;
+	uint32_t bufferLength;
+	uint8_t lineCount;			// lines of 8 pixels
+#endif
+	uint8_t lineOrigin;			// buffer line shown at the top (display start line / 8)
+	bool hardwareScroll;
+	uint8_t panelLineOrigin;	// line origin as programmed into the panel
+#if (CONFIG_GRAPHICS_BITSPERPIXEL == 4)
+	uint8_t greyLevel;
+	uint8_t greyPairs[4];		// byte of two pixels, index: left pixel set << 1 | right pixel set
+#endif
+	int dirtyX1;
+	int dirtyY1;
+	int dirtyX2;
+	int dirtyY2;
+#if (GRAPHICS_LINEDIRTY == 1)
+	int16_t lineDirtyX1[MAX_LINECOUNT];	// per logical line, valid for dirtyY1..dirtyY2
+	int16_t lineDirtyX2[MAX_LINECOUNT];
+#endif
+
+	int cursorX;
+	int cursorY;
+
+	SemaphoreHandle_t mutex;
+	TaskHandle_t displayTaskHandle;
+	volatile bool flushRequested;	// transfer without waiting for the frame period
+	struct GraphicsUpdateStats_t updateStats;
+	uint32_t transferredUpdates;	// updateStats.updates at the last transfer
+#if (CONFIG_GRAPHICS_STATS == 1)
+	struct GraphicsStats_t stats;
+	struct GraphicsUpdateStats_t statsBase;	// updateStats at the last reset
+	uint32_t lockDepth;				// recursive acquisitions by the owner
+	int64_t lockStart_us;
+	uint32_t frameBytes;			// of the running transfer
+	uint32_t framePages;
+	uint32_t frameTime_us;			// in drawBitmap, without finishPage
+#endif
+
+	TextCache* pTextCache;
+	uint8_t glyphBuffer[FONTS_GLYPHBUFFERSIZE];
+};
+
+#if (CONFIG_GRAPHICS_FIXED_GEOMETRY == 1)
+// module internal globals
+// static contexts (internal RAM, i.e. DMA capable) instead of allocated buffers
+static GraphicsContext gContexts[CONFIG_GRAPHICS_FIXED_CONTEXTS];
+static bool gContextUsed[CONFIG_GRAPHICS_FIXED_CONTEXTS];
+#endif
+
+// internal prototypes
+static bool lockContext(GraphicsContext* pContext);
+static void unlockContext(GraphicsContext* pContext);
+static void drawPanelBitmap(GraphicsContext* pContext, int x1, int y1, int x2, int y2, const void* data);
+static void displayTaskMainFunc(void * pvParameters);
+static void createDisplayTask(GraphicsContext* pContext);
+static void adaptDirty(GraphicsContext* pContext, int x1, int y1, int x2, int y2);
+static void sendDirtyDisplayBuffer(GraphicsContext* pContext);
+#if (CONFIG_GRAPHICS_BITSPERPIXEL == 4)
+static uint8_t* getBufferRow(GraphicsContext* pContext, int y);
+static void setGreyPixel(GraphicsContext* pContext, int x, int y, uint8_t level);
+static void fillGreySpan(uint8_t* row, int x1, int x2, uint8_t level);
+#else
+static uint8_t* getBufferLine(GraphicsContext* pContext, int line);
+#endif
+#if (GRAPHICS_ROTATED == 1)
+static void transposeBlock(const uint8_t* source, int sourceStep, uint8_t* destination, int destinationStep);
+#endif
+static void rasterPixel(GraphicsContext* pContext, int x, int y, enum Graphics_RasterOp op);
+static bool clipRegion(GraphicsContext* pContext, int* pX1, int* pY1, int* pX2, int* pY2);
+static uint8_t getImagePixel(int x, int y, uint8_t width, uint8_t height, const uint8_t* image);
+static bool imageEquals(GraphicsContext* pContext, int x1, int y1, uint8_t width, uint8_t height, const uint8_t* image);
+static bool writeCachedRun(GraphicsContext* pContext, char* text, uint8_t textlen);
+
+// ***** implementation *****
+void graphicsctx_startUpdate(GraphicsContext* pContext) {
+	lockContext(pContext);
+}
+
+void graphicsctx_finishUpdate(GraphicsContext* pContext) {
+	pContext->updateStats.updates += 1;
+	if (pContext->synchronousUpdate) {
+		sendDirtyDisplayBuffer(pContext);
+	}
+	unlockContext(pContext);
+	if (!pContext->synchronousUpdate) {
+		// there is no display task in synchronous mode
+		xTaskNotifyGive(pContext->displayTaskHandle);
+	}
+}
+
+void graphicsctx_flush(GraphicsContext* pContext) {
+	if (pContext->synchronousUpdate) {
+		sendDirtyDisplayBuffer(pContext);
+		return;
+	}
+	pContext->flushRequested = true;
+	xTaskNotifyGive(pContext->displayTaskHandle);
+}
+
+void graphicsctx_getUpdateStats(GraphicsContext* pContext, struct GraphicsUpdateStats_t* pStats) {
+	xSemaphoreTakeRecursive(pContext->mutex, portMAX_DELAY);
+	*pStats = pContext->updateStats;
+	xSemaphoreGiveRecursive(pContext->mutex);
+}
+
+#if (CONFIG_GRAPHICS_STATS == 1)
+// reading the stats is not counted as a lock
+void graphicsctx_getStats(GraphicsContext* pContext, struct GraphicsStats_t* pStats) {
+	xSemaphoreTakeRecursive(pContext->mutex, portMAX_DELAY);
+	*pStats = pContext->stats;
+	pStats->update.updates = pContext->updateStats.updates - pContext->statsBase.updates;
+	pStats->update.transfers = pContext->updateStats.transfers - pContext->statsBase.transfers;
+	pStats->update.coalesced = pContext->updateStats.coalesced - pContext->statsBase.coalesced;
+	pStats->update.missedFrames = pContext->updateStats.missedFrames - pContext->statsBase.missedFrames;
+	xSemaphoreGiveRecursive(pContext->mutex);
+}
+
+void graphicsctx_resetStats(GraphicsContext* pContext) {
+	xSemaphoreTakeRecursive(pContext->mutex, portMAX_DELAY);
+	memset(&pContext->stats, 0, sizeof(pContext->stats));
+	pContext->statsBase = pContext->updateStats;
+	xSemaphoreGiveRecursive(pContext->mutex);
+}
+
+void graphicsctx_logStats(GraphicsContext* pContext, const char* name) {
+	struct GraphicsStats_t stats;
+	graphicsctx_getStats(pContext, &stats);
+	graphicsctx_resetStats(pContext);
+	uint32_t frames = (stats.frames > 0) ? stats.frames : 1;
+	uint32_t locks = (stats.locks > 0) ? stats.locks : 1;
+	ESP_LOGI("graphics", "%s: %" PRIu32 " updates %" PRIu32 " frames (%" PRIu32 " coalesced %" PRIu32 " missed), %" PRIu32 " B/frame (max %" PRIu32 ") %" PRIu32 " pages/frame, "
+			"drawBitmap %" PRIu32 " us/frame (max %" PRIu32 "), lock wait %" PRIu32 " us (max %" PRIu32 ") hold %" PRIu32 " us (max %" PRIu32 ")",
+			name, stats.update.updates, stats.frames, stats.update.coalesced, stats.update.missedFrames,
+			stats.bytes / frames, stats.maxFrameBytes, stats.pages / frames,
+			(uint32_t)(stats.transferTime_us / frames), stats.maxTransferTime_us,
+			(uint32_t)(stats.lockWaitTime_us / locks), stats.maxLockWaitTime_us,
+			(uint32_t)(stats.lockHoldTime_us / locks), stats.maxLockHoldTime_us);
+}
+#endif
+
+// the context mutex, with GRAPHICS_STATS the outermost acquisition is timed
+bool lockContext(GraphicsContext* pContext) {
+#if (CONFIG_GRAPHICS_STATS == 1)
+	int64_t start = esp_timer_get_time();
+	if (xSemaphoreTakeRecursive(pContext->mutex, portMAX_DELAY) != pdTRUE) {
+		return false;
+	}
+	pContext->lockDepth += 1;
+	if (pContext->lockDepth == 1) {
+		pContext->lockStart_us = esp_timer_get_time();
+		uint32_t wait = pContext->lockStart_us - start;
+		pContext->stats.locks += 1;
+		pContext->stats.lockWaitTime_us += wait;
+		pContext->stats.maxLockWaitTime_us = MAX(pContext->stats.maxLockWaitTime_us, wait);
+	}
+	return true;
+#else
+	return xSemaphoreTakeRecursive(pContext->mutex, portMAX_DELAY) == pdTRUE;
+#endif
+}
+
+void unlockContext(GraphicsContext* pContext) {
+#if (CONFIG_GRAPHICS_STATS == 1)
+	pContext->lockDepth -= 1;
+	if (pContext->lockDepth == 0) {
+		uint32_t hold = esp_timer_get_time() - pContext->lockStart_us;
+		pContext->stats.lockHoldTime_us += hold;
+		pContext->stats.maxLockHoldTime_us = MAX(pContext->stats.maxLockHoldTime_us, hold);
+	}
+#endif
+	xSemaphoreGiveRecursive(pContext->mutex);
+}
+
+// panel x coordinates without xOffs, with GRAPHICS_STATS bytes, pages and time are counted per frame
+void drawPanelBitmap(GraphicsContext* pContext, int x1, int y1, int x2, int y2, const void* data) {
+#if (CONFIG_GRAPHICS_STATS == 1)
+	#if (CONFIG_GRAPHICS_BITSPERPIXEL == 4)
+	pContext->frameBytes += (x2 - x1) / 2 * (y2 - y1);
+	#else
+	pContext->frameBytes += (x2 - x1) * (y2 - y1) / 8;
+	#endif
+	pContext->framePages += 1;
+	int64_t start = esp_timer_get_time();
+#endif
+	pContext->pPanel->drawBitmap(pContext->pPanel, x1 + pContext->xOffs, y1, x2 + pContext->xOffs, y2, data);
+#if (CONFIG_GRAPHICS_STATS == 1)
+	pContext->frameTime_us += esp_timer_get_time() - start;
+#endif
+	if (pContext->pPanel->finishPage != NULL) {
+		pContext->pPanel->finishPage(pContext->pPanel);
+	}
+}
+
+GraphicsContext* graphicsctx_create(GraphicsPanel* pPanel, uint16_t displayWidth, uint16_t displayHeight, uint16_t xOffs, bool synchronousUpdate) {
+#if (CONFIG_GRAPHICS_BITSPERPIXEL == 4)
+	if ((displayWidth % GREY_XALIGN != 0) || (xOffs % GREY_XALIGN != 0)) {
+		return NULL;
+	}
+#endif
+#if (GRAPHICS_ROTATED == 1)
+	// whole 8x8 blocks are transposed
+	if ((displayWidth % 8 != 0) || (displayHeight % 8 != 0)) {
+		return NULL;
+	}
+#endif
+#if (GRAPHICS_LINEDIRTY == 1)
+	if (displayHeight > GRAPHICSPANEL_RAMHEIGHT) {
+		return NULL;
+	}
+#endif
+#if (CONFIG_GRAPHICS_FIXED_GEOMETRY == 1)
+	if ((displayWidth != CONFIG_GRAPHICS_PIXELWIDTH) || (displayHeight != CONFIG_GRAPHICS_PIXELHEIGHT)) {
+		return NULL;
+	}
+	GraphicsContext* pContext = NULL;
+	for (int i = 0; i < CONFIG_GRAPHICS_FIXED_CONTEXTS; i += 1) {
+		if (!gContextUsed[i]) {
+			gContextUsed[i] = true;
+			pContext = &(gContexts[i]);
+			memset(pContext, 0, sizeof(GraphicsContext));
+			break;
+		}
+	}
+#else
+	GraphicsContext* pContext = calloc(1, sizeof(GraphicsContext));
+#endif
+	if (pContext == NULL) {
+		return NULL;
+	}
+	pContext->pPanel = pPanel;
+#if (GRAPHICS_ROTATED == 1)
+	pContext->displayWidth = displayHeight;
+	pContext->displayHeight = displayWidth;
+#else
+	pContext->displayWidth = displayWidth;
+	pContext->displayHeight = displayHeight;
+#endif
+	pContext->synchronousUpdate = synchronousUpdate;
+	pContext->xOffs = xOffs;
+
+	pContext->lineOrigin = 0;
+	pContext->panelLineOrigin = 0;
+	#if (CONFIG_GRAPHICS_BITSPERPIXEL == 4)
+	graphicsctx_setGreyLevel(pContext, 0x0F);
+	#endif
+	#if (CONFIG_GRAPHICS_HARDWARE_SCROLL == 1) && (CONFIG_GRAPHICS_BITSPERPIXEL == 1) && (GRAPHICS_ROTATED == 0)
+	// the start line wraps around the whole display RAM -> the buffer has to cover it
+	pContext->hardwareScroll = (pContext->displayHeight == GRAPHICSPANEL_RAMHEIGHT);
+	#else
+	pContext->hardwareScroll = false;
+	#endif
+#if (CONFIG_GRAPHICS_FIXED_GEOMETRY != 1)
+	// Allocate memory for the display buffers
+	pContext->bufferLength = (uint32_t)pContext->displayWidth * pContext->displayHeight / (8 / CONFIG_GRAPHICS_BITSPERPIXEL);
+	pContext->lineCount = pContext->displayHeight / 8;
+	pContext->displayBuffer = malloc(pContext->bufferLength);
+	pContext->transferBuffer = heap_caps_malloc(pContext->bufferLength, MALLOC_CAP_DMA);
+	if ((pContext->displayBuffer == NULL) || (pContext->transferBuffer == NULL)) {
+		pContext->pPanel = NULL; // stays with the caller
+		graphicsctx_destroy(pContext);
+		return NULL;
+	}
+#endif
+	// Create semaphor for critical section
+	pContext->mutex = xSemaphoreCreateRecursiveMutex();
+	if (pContext->mutex == NULL) {
+		pContext->pPanel = NULL; // stays with the caller
+		graphicsctx_destroy(pContext);
+		return NULL;
+	}
+	#if (CONFIG_GRAPHICS_TEXTCACHE_ENTRIES > 0)
+	// no check: without cache the text is rendered glyph by glyph
+	pContext->pTextCache = textcache_create(CONFIG_GRAPHICS_TEXTCACHE_ENTRIES, CONFIG_GRAPHICS_TEXTCACHE_MAXCHARS, pContext->displayWidth, TEXTCACHE_MAXFONTHEIGHT);
+	#endif
+	pContext->dirtyX1 = pContext->displayWidth;
+	pContext->dirtyY1 = pContext->displayHeight;
+	#if (GRAPHICS_LINEDIRTY == 1)
+	for (int line = 0; line < MAX_LINECOUNT; line += 1) {
+		pContext->lineDirtyX1[line] = pContext->displayWidth;
+	}
+	#endif
+	if (!pContext->synchronousUpdate) {
+		createDisplayTask(pContext);
+		if (pContext->displayTaskHandle == NULL) {
+			pContext->pPanel = NULL;
+			graphicsctx_destroy(pContext);
+			return NULL;
+		}
+	}
+	graphicsctx_clearScreen(pContext);
+	return pContext;
+}
+
+void graphicsctx_destroy(GraphicsContext* pContext) {
+	if (pContext->displayTaskHandle != NULL) {
+		vTaskDelete(pContext->displayTaskHandle);
+	}
+	if (pContext->mutex != NULL) {
+		vSemaphoreDelete(pContext->mutex);
+	}
+	if (pContext->pTextCache != NULL) {
+		textcache_destroy(pContext->pTextCache);
+	}
+	if (pContext->pPanel != NULL) {
+		pContext->pPanel->destroy(pContext->pPanel);
+	}
+#if (CONFIG_GRAPHICS_FIXED_GEOMETRY == 1)
+	gContextUsed[pContext - gContexts] = false;
+#else
+	free(pContext->displayBuffer);
+	heap_caps_free(pContext->transferBuffer);
+	free(pContext);
+#endif
+}
+
+uint16_t graphicsctx_getDisplayWidth(GraphicsContext* pContext) {
+	return CONTEXT_WIDTH(pContext);
+}
+
+uint16_t graphicsctx_getDisplayHeight(GraphicsContext* pContext) {
+	return CONTEXT_HEIGHT(pContext);
+}
+
+void displayTaskMainFunc(void * pvParameters) {
+	GraphicsContext* pContext = pvParameters;
+	#if (CONFIG_GRAPHICS_MAX_FPS > 0)
+	TickType_t lastTransfer = xTaskGetTickCount();
+	#endif
+	for( ;; ) {
+		if (ulTaskNotifyTake(pdTRUE, portMAX_DELAY) == 0) {
+			continue;
+		}
+		#if (CONFIG_GRAPHICS_MAX_FPS > 0)
+		// at most one transfer per frame period, updates finished meanwhile are sent with it
+		TickType_t elapsed = xTaskGetTickCount() - lastTransfer;
+		while (!pContext->flushRequested && (elapsed < FRAME_PERIOD_TICKS)) {
+			ulTaskNotifyTake(pdTRUE, FRAME_PERIOD_TICKS - elapsed);
+			elapsed = xTaskGetTickCount() - lastTransfer;
+		}
+		lastTransfer = xTaskGetTickCount();
+		#endif
+		pContext->flushRequested = false;
+		// send out the dirty display buffer
+		sendDirtyDisplayBuffer(pContext);
+		#if (CONFIG_GRAPHICS_MAX_FPS > 0)
+		// the transfer took longer than a frame period -> the following frames could not be shown in time
+		TickType_t duration = xTaskGetTickCount() - lastTransfer;
+		if (duration > FRAME_PERIOD_TICKS) {
+			pContext->updateStats.missedFrames += duration / FRAME_PERIOD_TICKS;
+		}
+		#endif
+	}
+}
+
+void createDisplayTask(GraphicsContext* pContext) {
+	// the context must persist through the task's lifetime!
+	xTaskCreate(displayTaskMainFunc, "DISPLAY", DISPLAY_TASK_STACKSIZE, pContext, 3, &(pContext->displayTaskHandle));
+}
+
+void graphicsctx_clearScreen(GraphicsContext* pContext) {
+	graphicsctx_clearRegion(pContext, 0, 0, CONTEXT_WIDTH(pContext), CONTEXT_HEIGHT(pContext));
+	pContext->cursorY = 0;
+	pContext->cursorX = 0;
+}
+
+// x1 incl, x2 excl., clears whole lines of 8 pixels (monochrome) or exactly the rows y1 to y2 excl. (greyscale)
+void graphicsctx_clearRegion(GraphicsContext* pContext, int x1, int y1, int x2, int y2) {
+	if (!clipRegion(pContext, &x1, &y1, &x2, &y2)) {
+		return;
+	}
+#if (CONFIG_GRAPHICS_BITSPERPIXEL == 4)
+	for (int y = y1; y < y2; y += 1) {
+		fillGreySpan(getBufferRow(pContext, y), x1, x2, 0);
+	}
+#else
+	int lineStart = y1 / 8;
+	int lineEnd = (y2 % 8 == 0) ? y2 / 8 : y2 / 8 + 1;
+
+	while (lineStart < lineEnd) {
+		memset(getBufferLine(pContext, lineStart) + x1, 0x00, x2 - x1);
+		lineStart += 1;
+	}
+#endif
+
+	adaptDirty(pContext, x1, y1, x2, y2);
+}
+
+// x1 incl, x2 excl
+void adaptDirty(GraphicsContext* pContext, int x1, int y1, int x2, int y2) {
+	// images and text may extend beyond the display
+	if (!clipRegion(pContext, &x1, &y1, &x2, &y2)) {
+		return;
+	}
+#if (CONFIG_GRAPHICS_BITSPERPIXEL == 4)
+	// round to the column address unit
+	x1 -= x1 % GREY_XALIGN;
+	x2 += (GREY_XALIGN - x2 % GREY_XALIGN) % GREY_XALIGN;
+#else
+	// round lines
+	y1 /= 8;
+	y1 *= 8;
+	y2 = (y2 % 8 == 0) ? y2 / 8 : y2 / 8 + 1;
+	y2 *= 8;
+#endif
+	pContext->dirtyX1 = MIN(pContext->dirtyX1, x1);
+	pContext->dirtyY1 = MIN(pContext->dirtyY1, y1);
+	pContext->dirtyX2 = MAX(pContext->dirtyX2, x2);
+	pContext->dirtyY2 = MAX(pContext->dirtyY2, y2);
+#if (GRAPHICS_LINEDIRTY == 1)
+	for (int line = MAX(0, y1 / 8); line < MIN(CONTEXT_LINECOUNT(pContext), y2 / 8); line += 1) {
+		pContext->lineDirtyX1[line] = MIN(pContext->lineDirtyX1[line], x1);
+		pContext->lineDirtyX2[line] = MAX(pContext->lineDirtyX2[line], x2);
+	}
+#endif
+}
+
+void sendDirtyDisplayBuffer(GraphicsContext* pContext) {
+	if (lockContext(pContext)) {
+#if (CONFIG_GRAPHICS_BITSPERPIXEL == 4)
+		// copy only the dirty rectangle, packed row after row
+		int transferX1 = MAX(0, pContext->dirtyX1);
+		int transferX2 = MIN(CONTEXT_WIDTH(pContext), pContext->dirtyX2);
+		int transferY1 = MAX(0, pContext->dirtyY1);
+		int transferY2 = MIN(CONTEXT_HEIGHT(pContext), pContext->dirtyY2);
+		int transferRowBytes = (transferX2 - transferX1) / 2;
+		for (int y = transferY1; (y < transferY2) && (transferRowBytes > 0); y += 1) {
+			memcpy(pContext->transferBuffer + (y - transferY1) * transferRowBytes, getBufferRow(pContext, y) + transferX1 / 2, transferRowBytes);
+		}
+#elif (GRAPHICS_ROTATED == 1)
+		// transpose the dirty 8x8 blocks: columns of 8 drawing pixels become panel pages, drawing lines become 8 panel columns
+		int panelWidth = CONTEXT_HEIGHT(pContext);
+		#if (CONFIG_GRAPHICS_ROTATION_270 == 1)
+		int panelPages = CONTEXT_WIDTH(pContext) / 8;
+		#endif
+		int blockX1 = MAX(0, pContext->dirtyX1) / 8;
+		int blockX2 = (MIN(CONTEXT_WIDTH(pContext), pContext->dirtyX2) + 7) / 8;
+		int lineY1 = pContext->dirtyY1 / 8;
+		int lineY2 = (pContext->dirtyY2 + 7) / 8;
+		for (int line = lineY1; line < lineY2; line += 1) {
+			for (int block = blockX1; block < blockX2; block += 1) {
+				#if (CONFIG_GRAPHICS_ROTATION_90 == 1)
+				// drawing x -> panel y, drawing y -> panel x from the right
+				transposeBlock(getBufferLine(pContext, line) + block * 8, 1, pContext->transferBuffer + block * panelWidth + panelWidth - 1 - line * 8, -1);
+				#else
+				// drawing x -> panel y from the bottom, drawing y -> panel x
+				transposeBlock(getBufferLine(pContext, line) + block * 8 + 7, -1, pContext->transferBuffer + (panelPages - 1 - block) * panelWidth + line * 8, 1);
+				#endif
+			}
+		}
+		#if (CONFIG_GRAPHICS_ROTATION_90 == 1)
+		int transferX1 = panelWidth - lineY2 * 8;
+		int transferX2 = panelWidth - lineY1 * 8;
+		int transferY1 = blockX1;
+		int transferY2 = blockX2;
+		#else
+		int transferX1 = lineY1 * 8;
+		int transferX2 = lineY2 * 8;
+		int transferY1 = panelPages - blockX2;
+		int transferY2 = panelPages - blockX1;
+		#endif
+#else
+		// copy buffer and ranges to output
+		memcpy(pContext->transferBuffer, pContext->displayBuffer, CONTEXT_BUFFERLENGTH(pContext));
+		uint8_t lineOrigin = pContext->lineOrigin;
+		int transferY1 = pContext->dirtyY1 / 8;
+		int transferY2 = (pContext->dirtyY2 % 8 == 0) ? (pContext->dirtyY2 / 8) : (pContext->dirtyY2 / 8 + 1);
+		int16_t transferX1[MAX_LINECOUNT];
+		int16_t transferX2[MAX_LINECOUNT];
+		for (int y = transferY1; y < transferY2; y += 1) {
+			transferX1[y] = MAX(0, pContext->lineDirtyX1[y]);
+			transferX2[y] = MIN(CONTEXT_WIDTH(pContext), pContext->lineDirtyX2[y]);
+			pContext->lineDirtyX1[y] = CONTEXT_WIDTH(pContext);
+			pContext->lineDirtyX2[y] = 0;
+		}
+#endif
+		pContext->dirtyX1 = CONTEXT_WIDTH(pContext);
+		pContext->dirtyX2 = 0;
+		pContext->dirtyY1 = CONTEXT_HEIGHT(pContext);
+		pContext->dirtyY2 = 0;
+		pContext->updateStats.transfers += 1;
+		if (pContext->updateStats.updates - pContext->transferredUpdates > 1) {
+			pContext->updateStats.coalesced += pContext->updateStats.updates - pContext->transferredUpdates - 1;
+		}
+		pContext->transferredUpdates = pContext->updateStats.updates;
+		unlockContext(pContext);
+#if (CONFIG_GRAPHICS_STATS == 1)
+		// only the transferring task writes these, they are folded into the stats under the lock afterwards
+		pContext->frameBytes = 0;
+		pContext->framePages = 0;
+		pContext->frameTime_us = 0;
+#endif
+#if (CONFIG_GRAPHICS_BITSPERPIXEL == 4)
+		// a single transaction for the whole rectangle
+		if ((transferX1 < transferX2) && (transferY1 < transferY2)) {
+			drawPanelBitmap(pContext, transferX1, transferY1, transferX2, transferY2, pContext->transferBuffer);
+		}
+#elif (GRAPHICS_ROTATED == 1)
+		for (int page = transferY1; (page < transferY2) && (transferX1 < transferX2); page += 1) {
+			drawPanelBitmap(pContext, transferX1, page * 8, transferX2, (page+1) * 8, pContext->transferBuffer + page * panelWidth + transferX1);
+		}
+#else
+		// scroll first, the lines already on the panel keep their pages
+		if (lineOrigin != pContext->panelLineOrigin) {
+			if (pContext->pPanel->setStartLine(pContext->pPanel, lineOrigin * 8) == ESP_OK) {
+				pContext->panelLineOrigin = lineOrigin;
+			}
+		}
+		// dirty lines are logical, buffer lines map 1:1 to the display RAM pages
+		for (int y = transferY1; y < transferY2; y += 1) {
+			if (transferX1[y] >= transferX2[y]) {
+				continue;
+			}
+			int bufferLine = (y + lineOrigin) % CONTEXT_LINECOUNT(pContext);
+			drawPanelBitmap(pContext, transferX1[y], bufferLine * 8, transferX2[y], (bufferLine+1) * 8, pContext->transferBuffer + bufferLine * CONTEXT_WIDTH(pContext) + transferX1[y]);
+		}
+#endif
+		if (pContext->pPanel->finishFrame != NULL) {
+			pContext->pPanel->finishFrame(pContext->pPanel);
+		}
+#if (CONFIG_GRAPHICS_STATS == 1)
+		if (pContext->framePages > 0) {
+			uint32_t transferTime = pContext->frameTime_us;
+			xSemaphoreTakeRecursive(pContext->mutex, portMAX_DELAY);
+			pContext->stats.frames += 1;
+			pContext->stats.bytes += pContext->frameBytes;
+			pContext->stats.pages += pContext->framePages;
+			pContext->stats.maxFrameBytes = MAX(pContext->stats.maxFrameBytes, pContext->frameBytes);
+			pContext->stats.transferTime_us += transferTime;
+			pContext->stats.maxTransferTime_us = MAX(pContext->stats.maxTransferTime_us, transferTime);
+			xSemaphoreGiveRecursive(pContext->mutex);
+		}
+#endif
+	}
+}
+
+#if (CONFIG_GRAPHICS_BITSPERPIXEL == 4)
+uint8_t* getBufferRow(GraphicsContext* pContext, int y) {
+	return pContext->displayBuffer + y * CONTEXT_ROWBYTES(pContext);
+}
+
+// x and y must be within the display
+void setGreyPixel(GraphicsContext* pContext, int x, int y, uint8_t level) {
+	uint8_t* pByte = getBufferRow(pContext, y) + x / 2;
+	if (x % 2 == 0) {
+		*pByte = (*pByte & 0x0F) | (level << 4);
+	} else {
+		*pByte = (*pByte & 0xF0) | level;
+	}
+}
+
+// x1 incl, x2 excl, whole bytes are set by memset
+void fillGreySpan(uint8_t* row, int x1, int x2, uint8_t level) {
+	if (x1 >= x2) {
+		return;
+	}
+	if (x1 % 2 != 0) {
+		row[x1 / 2] = (row[x1 / 2] & 0xF0) | level;
+		x1 += 1;
+	}
+	if (x2 % 2 != 0) {
+		x2 -= 1;
+		row[x2 / 2] = (row[x2 / 2] & 0x0F) | (level << 4);
+	}
+	if (x1 < x2) {
+		memset(row + x1 / 2, level * 0x11, (x2 - x1) / 2);
+	}
+}
+#else
+uint8_t* getBufferLine(GraphicsContext* pContext, int line) {
+	line += pContext->lineOrigin;
+	if (line >= CONTEXT_LINECOUNT(pContext)) {
+		line -= CONTEXT_LINECOUNT(pContext);
+	}
+	return pContext->displayBuffer + line * CONTEXT_WIDTH(pContext);
+}
+#endif
+
+#if (GRAPHICS_ROTATED == 1)
+/*
+ * Transposes 8 bytes (byte i = column i, bit j = row j) so that byte j holds row j with column i in bit i.
+ * Three rounds of swapping bit groups along the diagonal of the 8x8 matrix held in one 64 bit word.
+ */
+void transposeBlock(const uint8_t* source, int sourceStep, uint8_t* destination, int destinationStep) {
+	uint64_t x = 0;
+	for (int i = 0; i < 8; i += 1) {
+		x |= (uint64_t)source[i * sourceStep] << (8 * i);
+	}
+	uint64_t t = (x ^ (x >> 7)) & 0x00AA00AA00AA00AAULL;
+	x ^= t ^ (t << 7);
+	t = (x ^ (x >> 14)) & 0x0000CCCC0000CCCCULL;
+	x ^= t ^ (t << 14);
+	t = (x ^ (x >> 28)) & 0x00000000F0F0F0F0ULL;
+	x ^= t ^ (t << 28);
+	for (int j = 0; j < 8; j += 1) {
+		destination[j * destinationStep] = (uint8_t)(x >> (8 * j));
+	}
+}
+#endif
+
+void graphicsctx_setGreyLevel(GraphicsContext* pContext, uint8_t level) {
+#if (CONFIG_GRAPHICS_BITSPERPIXEL == 4)
+	level &= 0x0F;
+	pContext->greyLevel = level;
+	pContext->greyPairs[0] = 0x00;
+	pContext->greyPairs[1] = level;
+	pContext->greyPairs[2] = level << 4;
+	pContext->greyPairs[3] = level * 0x11;
+#endif
+}
+
+void graphicsctx_scrollLine(GraphicsContext* pContext) {
+	int height = fonts_getCharacterHeight();
+	if (pContext->hardwareScroll) {
+		// advance the origin: the former top line becomes the (cleared) bottom line, only this one is transferred
+		pContext->lineOrigin = (pContext->lineOrigin + height / 8) % CONTEXT_LINECOUNT(pContext);
+#if (GRAPHICS_LINEDIRTY == 1)
+		// lines not transferred yet move up with their content
+		int lines = height / 8;
+		for (int line = 0; line < CONTEXT_LINECOUNT(pContext); line += 1) {
+			bool moved = (line + lines < CONTEXT_LINECOUNT(pContext));
+			pContext->lineDirtyX1[line] = moved ? pContext->lineDirtyX1[line + lines] : CONTEXT_WIDTH(pContext);
+			pContext->lineDirtyX2[line] = moved ? pContext->lineDirtyX2[line + lines] : 0;
+		}
+		pContext->dirtyY1 = MAX(0, pContext->dirtyY1 - lines * 8);
+		pContext->dirtyY2 = MAX(0, pContext->dirtyY2 - lines * 8);
+#endif
+		graphicsctx_clearRegion(pContext, 0, CONTEXT_HEIGHT(pContext) - height, CONTEXT_WIDTH(pContext), CONTEXT_HEIGHT(pContext));
+		return;
+	}
+#if (CONFIG_GRAPHICS_BITSPERPIXEL == 4)
+	int lineBytes = CONTEXT_ROWBYTES(pContext) * height;
+#else
+	int lineBytes = CONTEXT_WIDTH(pContext) * height / 8;
+#endif
+	// move one line upwards
+	memmove(pContext->displayBuffer, pContext->displayBuffer + lineBytes, CONTEXT_BUFFERLENGTH(pContext) - lineBytes);
+	// clear last line
+	memset(pContext->displayBuffer + CONTEXT_BUFFERLENGTH(pContext) - lineBytes, 0x00, lineBytes);
+	adaptDirty(pContext, 0, 0, CONTEXT_WIDTH(pContext), CONTEXT_HEIGHT(pContext));
+}
+
+void graphicsctx_setImage(GraphicsContext* pContext, int x1, int y1, uint8_t width, uint8_t height, const uint8_t* image) {
+#if (CONFIG_GRAPHICS_BITSPERPIXEL == 4)
+	// expand the monochrome page format to nibbles, two pixels per byte written
+	int xStart = MAX(0, x1);
+	int yStart = MAX(0, y1);
+	int x2 = MIN(CONTEXT_WIDTH(pContext), x1 + width);
+	int y2 = MIN(CONTEXT_HEIGHT(pContext), y1 + height);
+	for (int y = yStart; y < y2; y += 1) {
+		const uint8_t* source = image + ((y - y1) / 8) * width - x1;
+		uint8_t mask = 1 << ((y - y1) % 8);
+		uint8_t* row = getBufferRow(pContext, y);
+		int x = xStart;
+		if ((x % 2 != 0) && (x < x2)) {
+			setGreyPixel(pContext, x, y, (source[x] & mask) ? pContext->greyLevel : 0);
+			x += 1;
+		}
+		for (; x + 1 < x2; x += 2) {
+			row[x / 2] = pContext->greyPairs[((source[x] & mask) ? 2 : 0) | ((source[x + 1] & mask) ? 1 : 0)];
+		}
+		if (x < x2) {
+			setGreyPixel(pContext, x, y, (source[x] & mask) ? pContext->greyLevel : 0);
+		}
+	}
+	if ((xStart < x2) && (yStart < y2)) {
+		adaptDirty(pContext, xStart, yStart, x2, y2);
+	}
+#else
+	int y2 = y1 + height;
+	int x2 = MIN(CONTEXT_WIDTH(pContext), x1 + width);
+	if (x1 >= x2) {
+		return;
+	}
+	if ((x1 >= 0) && (y1 >= 0) && (y2 <= CONTEXT_HEIGHT(pContext)) && (y1 % 8 == 0) && (y2 % 8 == 0)) {
+		uint8_t lineStart = y1 / 8;
+		uint8_t lineEnd = (y2 % 8 == 0) ? y2 / 8 : y2 / 8 + 1;
+
+		int i = 0;
+		while (lineStart < lineEnd) {
+			memcpy(getBufferLine(pContext, lineStart) + x1, image + i * width, x2 - x1);
+			lineStart += 1;
+			i += 1;
+		}
+	} else {
+		for (uint8_t x = 0; x < width; x += 1) {
+			for (uint8_t y = 0; y < height; y += 1) {
+				graphicsctx_setPixelValue(pContext, x1 + x, y1 + y, getImagePixel(x, y, width, height, image));
+			}
+		}
+	}
+
+	adaptDirty(pContext, x1, y1, x2, y2);
+#endif
+}
+
+void graphicsctx_setCursor(GraphicsContext* pContext, int x, int y) {
+	pContext->cursorX = x;
+	pContext->cursorY = y;
+}
+
+void graphicsctx_setPixel(GraphicsContext* pContext, int x, int y) {
+	if (((unsigned)x < CONTEXT_WIDTH(pContext)) && ((unsigned)y < CONTEXT_HEIGHT(pContext))) {
+#if (CONFIG_GRAPHICS_BITSPERPIXEL == 4)
+		setGreyPixel(pContext, x, y, pContext->greyLevel);
+#else
+		getBufferLine(pContext, y / 8)[x] |= 1 << (y % 8);
+#endif
+		adaptDirty(pContext, x, y, x+1, y+1);
+	}
+}
+
+void graphicsctx_clearPixel(GraphicsContext* pContext, int x, int y) {
+	if (((unsigned)x < CONTEXT_WIDTH(pContext)) && ((unsigned)y < CONTEXT_HEIGHT(pContext))) {
+#if (CONFIG_GRAPHICS_BITSPERPIXEL == 4)
+		setGreyPixel(pContext, x, y, 0);
+#else
+		getBufferLine(pContext, y / 8)[x] &= ~(1 << (y % 8));
+#endif
+		adaptDirty(pContext, x, y, x+1, y+1);
+	}
+}
+
+void graphicsctx_invertPixel(GraphicsContext* pContext, int x, int y) {
+	if (((unsigned)x < CONTEXT_WIDTH(pContext)) && ((unsigned)y < CONTEXT_HEIGHT(pContext))) {
+#if (CONFIG_GRAPHICS_BITSPERPIXEL == 4)
+		getBufferRow(pContext, y)[x / 2] ^= (x % 2 == 0) ? 0xF0 : 0x0F;
+#else
+		getBufferLine(pContext, y / 8)[x] ^= 1 << (y % 8);
+#endif
+		adaptDirty(pContext, x, y, x+1, y+1);
+	}
+}
+
+void graphicsctx_setPixelValue(GraphicsContext* pContext, int x, int y, uint8_t pixel) {
+	if (((unsigned)x < CONTEXT_WIDTH(pContext)) && ((unsigned)y < CONTEXT_HEIGHT(pContext))) {
+#if (CONFIG_GRAPHICS_BITSPERPIXEL == 4)
+		setGreyPixel(pContext, x, y, pixel ? pContext->greyLevel : 0);
+#else
+		if (pixel) {
+			getBufferLine(pContext, y / 8)[x] |= 1 << (y % 8);
+		} else {
+			getBufferLine(pContext, y / 8)[x] &= ~(1 << (y % 8));
+		}
+#endif
+		adaptDirty(pContext, x, y, x+1, y+1);
+	}
+}
+
+void graphicsctx_setPixels(GraphicsContext* pContext, const struct GraphicsPoint_t* points, size_t count, enum Graphics_RasterOp op) {
+	int minX = CONTEXT_WIDTH(pContext);
+	int minY = CONTEXT_HEIGHT(pContext);
+	int maxX = -1;
+	int maxY = -1;
+	for (size_t i = 0; i < count; i += 1) {
+		int x = points[i].x;
+		int y = points[i].y;
+		if (((unsigned)x < CONTEXT_WIDTH(pContext)) && ((unsigned)y < CONTEXT_HEIGHT(pContext))) {
+			rasterPixel(pContext, x, y, op);
+			minX = MIN(minX, x);
+			maxX = MAX(maxX, x);
+			minY = MIN(minY, y);
+			maxY = MAX(maxY, y);
+		}
+	}
+	if (maxX >= 0) {
+		adaptDirty(pContext, minX, minY, maxX + 1, maxY + 1);
+	}
+}
+
+void graphicsctx_setColumnPixels(GraphicsContext* pContext, int x1, const int16_t* ys, size_t count, enum Graphics_RasterOp op) {
+	// clip the columns once
+	int first = MAX(0, -x1);
+	int last = MIN((int)count, CONTEXT_WIDTH(pContext) - x1);
+	int minY = CONTEXT_HEIGHT(pContext);
+	int maxY = -1;
+	for (int i = first; i < last; i += 1) {
+		int y = ys[i];
+		if ((unsigned)y < CONTEXT_HEIGHT(pContext)) {
+			rasterPixel(pContext, x1 + i, y, op);
+			minY = MIN(minY, y);
+			maxY = MAX(maxY, y);
+		}
+	}
+	if (maxY >= 0) {
+		adaptDirty(pContext, x1 + first, minY, x1 + last, maxY + 1);
+	}
+}
+
+size_t graphicsctx_getRegionBufferSize(GraphicsContext* pContext, uint8_t width, uint8_t height) {
+#if (CONFIG_GRAPHICS_BITSPERPIXEL == 4)
+	// an odd x touches one byte more per row
+	return (size_t)(width + 2) / 2 * height;
+#else
+	// a y not on a page boundary touches one page more
+	return (size_t)width * ((height + 14) / 8);
+#endif
+}
+
+void graphicsctx_saveRegion(GraphicsContext* pContext, int x1, int y1, uint8_t width, uint8_t height, uint8_t* buffer) {
+	int x2 = x1 + width;
+	int y2 = y1 + height;
+	if (!clipRegion(pContext, &x1, &y1, &x2, &y2)) {
+		return;
+	}
+#if (CONFIG_GRAPHICS_BITSPERPIXEL == 4)
+	int rowBytes = (x2 + 1) / 2 - x1 / 2;
+	for (int y = y1; y < y2; y += 1) {
+		memcpy(buffer, getBufferRow(pContext, y) + x1 / 2, rowBytes);
+		buffer += rowBytes;
+	}
+#else
+	for (int line = y1 / 8; line < (y2 + 7) / 8; line += 1) {
+		memcpy(buffer, getBufferLine(pContext, line) + x1, x2 - x1);
+		buffer += x2 - x1;
+	}
+#endif
+}
+
+void graphicsctx_restoreRegion(GraphicsContext* pContext, int x1, int y1, uint8_t width, uint8_t height, const uint8_t* buffer) {
+	int x2 = x1 + width;
+	int y2 = y1 + height;
+	if (!clipRegion(pContext, &x1, &y1, &x2, &y2)) {
+		return;
+	}
+#if (CONFIG_GRAPHICS_BITSPERPIXEL == 4)
+	// the neighbour pixels sharing the first and the last byte are kept
+	int rowBytes = (x2 + 1) / 2 - x1 / 2;
+	uint8_t firstMask = (x1 % 2 == 0) ? 0xFF : 0x0F;
+	uint8_t lastMask = (x2 % 2 == 0) ? 0xFF : 0xF0;
+	for (int y = y1; y < y2; y += 1) {
+		uint8_t* row = getBufferRow(pContext, y) + x1 / 2;
+		uint8_t first = row[0];
+		uint8_t last = row[rowBytes - 1];
+		memcpy(row, buffer, rowBytes);
+		row[0] = (first & ~firstMask) | (row[0] & firstMask);
+		row[rowBytes - 1] = (last & ~lastMask) | (row[rowBytes - 1] & lastMask);
+		buffer += rowBytes;
+	}
+#else
+	// the rows above and below the region sharing its first and last page are kept
+	for (int line = y1 / 8; line < (y2 + 7) / 8; line += 1) {
+		uint8_t mask = 0xFF;
+		if (line == y1 / 8) {
+			mask &= 0xFF << (y1 % 8);
+		}
+		if (line == (y2 - 1) / 8) {
+			mask &= 0xFF >> (7 - (y2 - 1) % 8);
+		}
+		uint8_t* destination = getBufferLine(pContext, line) + x1;
+		for (int x = 0; x < x2 - x1; x += 1) {
+			destination[x] = (destination[x] & ~mask) | (buffer[x] & mask);
+		}
+		buffer += x2 - x1;
+	}
+#endif
+	adaptDirty(pContext, x1, y1, x2, y2);
+}
+
+void graphicsctx_xorImage(GraphicsContext* pContext, int x1, int y1, uint8_t width, uint8_t height, const uint8_t* image) {
+	int xStart = x1;
+	int yStart = y1;
+	int x2 = x1 + width;
+	int y2 = y1 + height;
+	if (!clipRegion(pContext, &xStart, &yStart, &x2, &y2)) {
+		return;
+	}
+#if (CONFIG_GRAPHICS_BITSPERPIXEL == 4)
+	for (int y = yStart; y < y2; y += 1) {
+		for (int x = xStart; x < x2; x += 1) {
+			if (getImagePixel(x - x1, y - y1, width, height, image)) {
+				rasterPixel(pContext, x, y, GRAPHICS_RASTEROP_INVERT);
+			}
+		}
+	}
+#else
+	// every image byte covers up to two framebuffer lines
+	for (int page = 0; page < (height + 7) / 8; page += 1) {
+		uint8_t rowMask = (page * 8 + 8 <= height) ? 0xFF : (0xFF >> (8 - height % 8));
+		int y = y1 + page * 8;
+		int line = (y >= 0) ? y / 8 : (y - 7) / 8;
+		int shift = y - line * 8;
+		uint8_t* upper = ((line >= 0) && (line < CONTEXT_LINECOUNT(pContext))) ? getBufferLine(pContext, line) : NULL;
+		uint8_t* lower = ((shift > 0) && (line + 1 >= 0) && (line + 1 < CONTEXT_LINECOUNT(pContext))) ? getBufferLine(pContext, line + 1) : NULL;
+		const uint8_t* source = image + page * width - x1;
+		for (int x = xStart; x < x2; x += 1) {
+			uint8_t bits = source[x] & rowMask;
+			if (upper != NULL) {
+				upper[x] ^= bits << shift;
+			}
+			if (lower != NULL) {
+				lower[x] ^= bits >> (8 - shift);
+			}
+		}
+	}
+#endif
+	adaptDirty(pContext, xStart, yStart, x2, y2);
+}
+
+// clips x1, y1 incl., x2, y2 excl. to the display, false if nothing remains
+bool clipRegion(GraphicsContext* pContext, int* pX1, int* pY1, int* pX2, int* pY2) {
+	*pX1 = MAX(0, *pX1);
+	*pY1 = MAX(0, *pY1);
+	*pX2 = MIN(CONTEXT_WIDTH(pContext), *pX2);
+	*pY2 = MIN(CONTEXT_HEIGHT(pContext), *pY2);
+	return (*pX1 < *pX2) && (*pY1 < *pY2);
+}
+
+// x and y must be within the display, the dirty region is not updated
+void rasterPixel(GraphicsContext* pContext, int x, int y, enum Graphics_RasterOp op) {
+#if (CONFIG_GRAPHICS_BITSPERPIXEL == 4)
+	uint8_t* pByte = getBufferRow(pContext, y) + x / 2;
+	uint8_t mask = (x % 2 == 0) ? 0xF0 : 0x0F;
+	uint8_t level = pContext->greyPairs[3] & mask;
+#else
+	uint8_t* pByte = getBufferLine(pContext, y / 8) + x;
+	uint8_t mask = 1 << (y % 8);
+	uint8_t level = mask;
+#endif
+	switch (op) {
+		case GRAPHICS_RASTEROP_SET:
+			*pByte = (*pByte & ~mask) | level;
+			break;
+		case GRAPHICS_RASTEROP_CLEAR:
+			*pByte &= ~mask;
+			break;
+		case GRAPHICS_RASTEROP_INVERT:
+			*pByte ^= mask;
+			break;
+	}
+}
+
+uint8_t getImagePixel(int x, int y, uint8_t width, uint8_t height, const uint8_t* image) {
+	return image[x + (y / 8) * width] & (1 << (y % 8));
+}
+
+#if (CONFIG_GRAPHICS_BITSPERPIXEL == 4)
+// images not completely within the display are reported as different
+bool imageEquals(GraphicsContext* pContext, int x1, int y1, uint8_t width, uint8_t height, const uint8_t* image) {
+	if ((x1 < 0) || (y1 < 0) || (x1 + width > CONTEXT_WIDTH(pContext)) || (y1 + height > CONTEXT_HEIGHT(pContext))) {
+		return false;
+	}
+	for (int y = 0; y < height; y += 1) {
+		const uint8_t* row = getBufferRow(pContext, y1 + y);
+		for (int x = 0; x < width; x += 1) {
+			uint8_t level = (x1 + x) % 2 == 0 ? row[(x1 + x) / 2] >> 4 : row[(x1 + x) / 2] & 0x0F;
+			if (level != (getImagePixel(x, y, width, height, image) ? pContext->greyLevel : 0)) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+#else
+// only page aligned images are compared, all others are reported as different
+bool imageEquals(GraphicsContext* pContext, int x1, int y1, uint8_t width, uint8_t height, const uint8_t* image) {
+	if ((x1 < 0) || (y1 % 8 != 0) || (height % 8 != 0) || (y1 + height > CONTEXT_HEIGHT(pContext))) {
+		return false;
+	}
+	int x2 = MIN(CONTEXT_WIDTH(pContext), x1 + width);
+	for (int line = 0; line < height / 8; line += 1) {
+		if (memcmp(getBufferLine(pContext, y1 / 8 + line) + x1, image + line * width, x2 - x1) != 0) {
+			return false;
+		}
+	}
+	return true;
+}
+#endif
+
+// draws the text as one pre-rendered run, returns false if it cannot be cached
+bool writeCachedRun(GraphicsContext* pContext, char* text, uint8_t textlen) {
+	if ((pContext->pTextCache == NULL) || (pContext->cursorX < 0) || (pContext->cursorX >= CONTEXT_WIDTH(pContext)) || (pContext->cursorY >= CONTEXT_HEIGHT(pContext))) {
+		return false;
+	}
+	const struct TextRun_t* pRun = textcache_getRun(pContext->pTextCache, fonts_getActiveFont(), text, textlen);
+	if (pRun == NULL) {
+		return false;
+	}
+	// skip if unchanged: neither copy nor mark dirty
+	if (!imageEquals(pContext, pContext->cursorX, pContext->cursorY, pRun->width, pRun->height, pRun->bitmap)) {
+		graphicsctx_setImage(pContext, pContext->cursorX, pContext->cursorY, pRun->width, pRun->height, pRun->bitmap);
+	}
+	pContext->cursorY += pRun->height;
+	pContext->cursorX = 0;
+	return true;
+}
+
+void graphicsctx_writeChars(GraphicsContext* pContext, char* text, uint8_t textlen) {
+	if (writeCachedRun(pContext, text, textlen)) {
+		return;
+	}
+	int x1 = pContext->cursorX;
+	int y1 = pContext->cursorY;
+	int height = fonts_getCharacterHeight();
+	while (textlen--) {
+		if ((pContext->cursorX >= CONTEXT_WIDTH(pContext)) || (pContext->cursorY >= CONTEXT_HEIGHT(pContext))) {
+			break;
+		}
+		int width = fonts_getCharacterWidth(*text);
+		graphicsctx_setImage(pContext, pContext->cursorX, pContext->cursorY, width, height, fonts_decodeCharacter(*text, pContext->glyphBuffer));
+		text += 1;
+		pContext->cursorX += width;
+	}
+	pContext->cursorY += height;
+	adaptDirty(pContext, x1, y1, pContext->cursorX+1, pContext->cursorY);
+	pContext->cursorX = 0;
+}
+
+void graphicsctx_writeString(GraphicsContext* pContext, char* text) {
+	graphicsctx_writeChars(pContext, text, strlen(text));
+}
+
+void graphicsctx_println(GraphicsContext* pContext, char* text) {
+	if (pContext->cursorY >= CONTEXT_HEIGHT(pContext)) {
+		graphicsctx_scrollLine(pContext);
+		pContext->cursorY -= fonts_getCharacterHeight();
+	}
+	graphicsctx_writeString(pContext, text);
+}
+
+void graphicsctx_drawLine(GraphicsContext* pContext, int x1, int y1, int x2, int y2, int pattern) {
+	if (abs(x2-x1) > abs(y2-y1)) {
+		// draw "horizontal"
+		// x1 must be <= x2 => change on demand
+		if (x1 > x2) {
+			int temp = y1;
+			y1 = y2;
+			y2 = temp;
+			temp = x1;
+			x1 = x2;
+			x2 = temp;
+		}
+		float deltaY = (y2 - y1) / (float)(x2 - x1);
+		float y = y1;
+		int count = 0;
+		while (x1 <= x2) {
+			if (count == 0) {
+				graphicsctx_setPixel(pContext, x1, y);
+			}
+			count += 1;
+			count %= pattern;
+			y += deltaY;
+			x1 += 1;
+		}
+	} else {
+		// draw "vertical"
+		// x1 must be <= x2 => change on demand
+		if (y1 > y2) {
+			int temp = y1;
+			y1 = y2;
+			y2 = temp;
+			temp = x1;
+			x1 = x2;
+			x2 = temp;
+		}
+		float deltaX = (x2 - x1) / (float)(y2 - y1);
+		float x = x1;
+		int count = 0;
+		while (y1 <= y2) {
+			if (count == 0) {
+				graphicsctx_setPixel(pContext, x, y1);
+			}
+			count += 1;
+			count %= pattern;
+			x += deltaX;
+			y1 += 1;
+		}
+	}
+}
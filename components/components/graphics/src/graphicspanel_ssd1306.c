@@ -0,0 +1,162 @@
+/*
+ * Part of the book "Embedded Systems mit RISC-V", dpunkt.verlag
+ * Author: Patrick Ritschel
+ *
+ * see https://ritschel.at/buch-embedded-systems-auf-den-punkt-gebracht/
+ *
+ * The code of this project is in the Public Domain (or CC0 licensed, at your option).
+ * Unless required by applicable law or agreed to in writing, this
+ * software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied.
+ */
+#include <stdlib.h>
+#include <sys/param.h>
+
+#include "esp_lcd_panel_ops.h"
+#include "esp_lcd_panel_io.h"
+#include "esp_lcd_panel_vendor.h"
+#include "ssd1306patch.h"
+#include "i2carbiter.h"
+
+#include "graphicspanel.h"
+
+typedef struct _Ssd1306Panel_ {
+	GraphicsPanel panel;
+	esp_lcd_panel_io_handle_t ioHandle;
+	esp_lcd_panel_handle_t displayHandle;
+	I2CArbiterClient* pBusClient;
+} Ssd1306Panel;
+
+// internal prototypes
+static esp_lcd_panel_handle_t initDisplay(esp_lcd_i2c_bus_handle_t displayInterface, uint32_t i2cAddr, bool flipVertical, esp_lcd_panel_io_handle_t* pIoHandle, esp_err_t* pRes);
+static esp_err_t drawBitmap(GraphicsPanel* pPanel, int x1, int y1, int x2, int y2, const uint8_t* data);
+static esp_err_t setStartLine(GraphicsPanel* pPanel, uint8_t line);
+static void destroy(GraphicsPanel* pPanel);
+
+// ***** implementation *****
+GraphicsPanel* graphicspanel_createSsd1306(i2c_port_t i2c, uint32_t i2cAddr, bool flipVertical, esp_err_t* pRes) {
+	Ssd1306Panel* pSsd1306 = malloc(sizeof(Ssd1306Panel));
+	if (pSsd1306 == NULL) {
+		*pRes = ESP_ERR_NO_MEM;
+		return NULL;
+	}
+	// the display yields the bus to the sensors
+	pSsd1306->pBusClient = i2carbiter_createClient(i2c, "display", I2CARBITER_PRIORITY_LOW);
+	if (pSsd1306->pBusClient == NULL) {
+		*pRes = ESP_ERR_NO_MEM;
+		free(pSsd1306);
+		return NULL;
+	}
+	pSsd1306->ioHandle = NULL;
+	i2carbiter_acquire(pSsd1306->pBusClient);
+	pSsd1306->displayHandle = initDisplay((esp_lcd_i2c_bus_handle_t)i2c, i2cAddr, flipVertical, &(pSsd1306->ioHandle), pRes);
+	i2carbiter_release(pSsd1306->pBusClient);
+	if (*pRes != ESP_OK) {
+		if (pSsd1306->ioHandle != NULL) {
+			esp_lcd_panel_io_del(pSsd1306->ioHandle);
+		}
+		i2carbiter_destroyClient(pSsd1306->pBusClient);
+		free(pSsd1306);
+		return NULL;
+	}
+	pSsd1306->panel.drawBitmap = drawBitmap;
+	pSsd1306->panel.setStartLine = setStartLine;
+	pSsd1306->panel.finishPage = NULL;
+	pSsd1306->panel.finishFrame = NULL;
+	pSsd1306->panel.destroy = destroy;
+	return &(pSsd1306->panel);
+}
+
+esp_lcd_panel_handle_t initDisplay(esp_lcd_i2c_bus_handle_t displayInterface, uint32_t i2cAddr, bool flipVertical, esp_lcd_panel_io_handle_t* pIoHandle, esp_err_t* pRes) {
+	esp_lcd_panel_io_handle_t io_handle = NULL;
+	esp_lcd_panel_io_i2c_config_t io_config = {
+			.dev_addr = i2cAddr,
+			.lcd_cmd_bits = 8,
+			.lcd_param_bits = 8,
+			.control_phase_bytes = 1,
+			.dc_bit_offset = 6,
+			.flags.dc_low_on_data = 0
+	};
+	// Attach the LCD to the I2C bus
+	*pRes = esp_lcd_new_panel_io_i2c(displayInterface, &io_config, &io_handle);
+	if (*pRes != ESP_OK) {
+		return NULL;
+	}
+	*pIoHandle = io_handle;
+
+	esp_lcd_panel_handle_t displayHandle = NULL;
+    esp_lcd_panel_dev_config_t panel_config = {
+        .reset_gpio_num = -1,
+        .bits_per_pixel = 1
+    };
+    // Initialize the LCD configuration
+    *pRes = esp_lcd_new_panel_ssd1306(io_handle, &panel_config, &displayHandle);
+	if (*pRes != ESP_OK) {
+		return NULL;
+	}
+
+    // Reset the display
+    *pRes = esp_lcd_panel_reset(displayHandle);
+	if (*pRes != ESP_OK) {
+		return NULL;
+	}
+
+    // Initialize LCD panel
+    *pRes = esp_lcd_panel_init(displayHandle);
+	if (*pRes != ESP_OK) {
+		return NULL;
+	}
+
+    // set precharge and contrast to max -> brighter
+    *pRes = ssd1306patch_sendCommand(displayHandle, SSD1306_COMMAND_SETPRECHARGE, 0xF2);
+	if (*pRes != ESP_OK) {
+		return NULL;
+	}
+
+    *pRes = esp_lcd_panel_disp_on_off(displayHandle, true);
+	if (*pRes != ESP_OK) {
+		return NULL;
+	}
+
+	if (flipVertical) {
+    	*pRes = esp_lcd_panel_mirror(displayHandle, true, true);
+    	if (*pRes != ESP_OK) {
+    		return NULL;
+    	}
+	}
+
+    return displayHandle;
+}
+
+// one transaction per chunk of a page, between them a waiting sensor gets the bus
+esp_err_t drawBitmap(GraphicsPanel* pPanel, int x1, int y1, int x2, int y2, const uint8_t* data) {
+	Ssd1306Panel* pSsd1306 = (Ssd1306Panel*)pPanel;
+	int width = x2 - x1;
+	esp_err_t res = ESP_OK;
+	for (int y = y1; (y < y2) && (res == ESP_OK); y += 8) {
+		for (int x = x1; (x < x2) && (res == ESP_OK); x += CONFIG_GRAPHICS_I2C_CHUNKBYTES) {
+			i2carbiter_acquire(pSsd1306->pBusClient);
+			res = esp_lcd_panel_draw_bitmap(pSsd1306->displayHandle, x, y, MIN(x + CONFIG_GRAPHICS_I2C_CHUNKBYTES, x2), y + 8, data + (y - y1) / 8 * width + (x - x1));
+			i2carbiter_release(pSsd1306->pBusClient);
+		}
+	}
+	return res;
+}
+
+esp_err_t setStartLine(GraphicsPanel* pPanel, uint8_t line) {
+	Ssd1306Panel* pSsd1306 = (Ssd1306Panel*)pPanel;
+	i2carbiter_acquire(pSsd1306->pBusClient);
+	esp_err_t res = ssd1306patch_setStartLine(pSsd1306->displayHandle, line);
+	i2carbiter_release(pSsd1306->pBusClient);
+	return res;
+}
+
+void destroy(GraphicsPanel* pPanel) {
+	Ssd1306Panel* pSsd1306 = (Ssd1306Panel*)pPanel;
+	i2carbiter_acquire(pSsd1306->pBusClient);
+	esp_lcd_panel_del(pSsd1306->displayHandle);
+	esp_lcd_panel_io_del(pSsd1306->ioHandle);
+	i2carbiter_release(pSsd1306->pBusClient);
+	i2carbiter_destroyClient(pSsd1306->pBusClient);
+	free(pSsd1306);
+}
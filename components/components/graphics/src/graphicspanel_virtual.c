@@ -0,0 +1,184 @@
+/*
+ * Part of the book "Embedded Systems mit RISC-V", dpunkt.verlag
+ * Author: Patrick Ritschel
+ *
+ * see https://ritschel.at/buch-embedded-systems-auf-den-punkt-gebracht/
+ *
+ * The code of this project is in the Public Domain (or CC0 licensed, at your option).
+ * Unless required by applicable law or agreed to in writing, this
+ * software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "graphicspanel.h"
+
+#define MAX(a,b) ((a) > (b) ? (a) : (b))
+
+// I2C transactions of esp_lcd's SSD1306 driver: address byte, control byte, command (+ parameters)
+#define WIRE_BYTES_COMMAND				3
+#define WIRE_BYTES_RANGECOMMAND			(WIRE_BYTES_COMMAND + 2)
+#define WIRE_BYTES_DATAHEADER			2
+// column range, page range, data
+#define TRANSACTIONS_BITMAP				3
+
+typedef struct _VirtualPanel_ {
+	GraphicsPanel panel;
+	uint16_t ramWidth;
+	uint16_t ramHeight;
+	uint8_t startLine;
+	uint8_t* ram;	// page format or packed grey levels
+	struct GraphicsPanelStats_t stats;
+	struct GraphicsPanelStats_t frame;	// only the counters of the running frame are used
+} VirtualPanel;
+
+// internal prototypes
+static esp_err_t drawBitmap(GraphicsPanel* pPanel, int x1, int y1, int x2, int y2, const uint8_t* data);
+static esp_err_t setStartLine(GraphicsPanel* pPanel, uint8_t line);
+static void finishFrame(GraphicsPanel* pPanel);
+static void destroy(GraphicsPanel* pPanel);
+
+// ***** implementation *****
+GraphicsPanel* graphicspanel_createVirtual(uint16_t ramWidth, uint16_t ramHeight) {
+	VirtualPanel* pVirtual = malloc(sizeof(VirtualPanel));
+	if (pVirtual == NULL) {
+		return NULL;
+	}
+	pVirtual->ram = calloc((size_t)ramWidth * ramHeight / (8 / CONFIG_GRAPHICS_BITSPERPIXEL), 1);
+	if (pVirtual->ram == NULL) {
+		free(pVirtual);
+		return NULL;
+	}
+	pVirtual->ramWidth = ramWidth;
+	pVirtual->ramHeight = ramHeight;
+	pVirtual->startLine = 0;
+	pVirtual->panel.drawBitmap = drawBitmap;
+	pVirtual->panel.setStartLine = setStartLine;
+	pVirtual->panel.finishPage = NULL;
+	pVirtual->panel.finishFrame = finishFrame;
+	pVirtual->panel.destroy = destroy;
+	graphicspanel_resetVirtualStats(&(pVirtual->panel));
+	return &(pVirtual->panel);
+}
+
+void graphicspanel_getVirtualStats(GraphicsPanel* pPanel, struct GraphicsPanelStats_t* pStats) {
+	*pStats = ((VirtualPanel*)pPanel)->stats;
+}
+
+void graphicspanel_resetVirtualStats(GraphicsPanel* pPanel) {
+	VirtualPanel* pVirtual = (VirtualPanel*)pPanel;
+	memset(&(pVirtual->stats), 0, sizeof(struct GraphicsPanelStats_t));
+	memset(&(pVirtual->frame), 0, sizeof(struct GraphicsPanelStats_t));
+}
+
+uint8_t graphicspanel_getVirtualPixel(GraphicsPanel* pPanel, int x, int y) {
+	VirtualPanel* pVirtual = (VirtualPanel*)pPanel;
+	if ((x < 0) || (x >= pVirtual->ramWidth) || (y < 0) || (y >= pVirtual->ramHeight)) {
+		return 0;
+	}
+	int ramY = (y + pVirtual->startLine) % pVirtual->ramHeight;
+#if (CONFIG_GRAPHICS_BITSPERPIXEL == 4)
+	uint8_t pair = pVirtual->ram[x / 2 + ramY * (pVirtual->ramWidth / 2)];
+	return (x % 2 == 0) ? pair >> 4 : pair & 0x0F;
+#else
+	return (pVirtual->ram[x + (ramY / 8) * pVirtual->ramWidth] & (1 << (ramY % 8))) != 0;
+#endif
+}
+
+esp_err_t graphicspanel_writeVirtualPBM(GraphicsPanel* pPanel, FILE* pFile) {
+	VirtualPanel* pVirtual = (VirtualPanel*)pPanel;
+#if (CONFIG_GRAPHICS_BITSPERPIXEL == 4)
+	if (fprintf(pFile, "P5\n%d %d\n15\n", pVirtual->ramWidth, pVirtual->ramHeight) < 0) {
+		return ESP_FAIL;
+	}
+	for (int y = 0; y < pVirtual->ramHeight; y += 1) {
+		for (int x = 0; x < pVirtual->ramWidth; x += 1) {
+			if (fputc(graphicspanel_getVirtualPixel(pPanel, x, y), pFile) == EOF) {
+				return ESP_FAIL;
+			}
+		}
+	}
+#else
+	if (fprintf(pFile, "P4\n%d %d\n", pVirtual->ramWidth, pVirtual->ramHeight) < 0) {
+		return ESP_FAIL;
+	}
+	// rows are packed MSB first, padded to whole bytes
+	for (int y = 0; y < pVirtual->ramHeight; y += 1) {
+		uint8_t bits = 0;
+		for (int x = 0; x < pVirtual->ramWidth; x += 1) {
+			bits = (bits << 1) | (graphicspanel_getVirtualPixel(pPanel, x, y) ? 1 : 0);
+			if ((x % 8 == 7) || (x == pVirtual->ramWidth - 1)) {
+				bits <<= 7 - (x % 8);
+				if (fputc(bits, pFile) == EOF) {
+					return ESP_FAIL;
+				}
+				bits = 0;
+			}
+		}
+	}
+#endif
+	return ESP_OK;
+}
+
+esp_err_t drawBitmap(GraphicsPanel* pPanel, int x1, int y1, int x2, int y2, const uint8_t* data) {
+	VirtualPanel* pVirtual = (VirtualPanel*)pPanel;
+#if (CONFIG_GRAPHICS_BITSPERPIXEL == 4)
+	if ((x1 < 0) || (x2 > pVirtual->ramWidth) || (x1 >= x2) || (y1 < 0) || (y2 > pVirtual->ramHeight) || (y1 >= y2)
+			|| (x1 % 2 != 0) || (x2 % 2 != 0)) {
+		return ESP_ERR_INVALID_ARG;
+	}
+	int rowBytes = (x2 - x1) / 2;
+	for (int y = y1; y < y2; y += 1) {
+		memcpy(pVirtual->ram + x1 / 2 + y * (pVirtual->ramWidth / 2), data, rowBytes);
+		data += rowBytes;
+	}
+	uint32_t bytes = rowBytes * (y2 - y1);
+#else
+	if ((x1 < 0) || (x2 > pVirtual->ramWidth) || (x1 >= x2) || (y1 < 0) || (y2 > pVirtual->ramHeight) || (y1 >= y2)
+			|| (y1 % 8 != 0) || (y2 % 8 != 0)) {
+		return ESP_ERR_INVALID_ARG;
+	}
+	int width = x2 - x1;
+	for (int line = y1 / 8; line < y2 / 8; line += 1) {
+		memcpy(pVirtual->ram + x1 + line * pVirtual->ramWidth, data, width);
+		data += width;
+	}
+	uint32_t bytes = width * (y2 - y1) / 8;
+#endif
+	pVirtual->frame.transactions += TRANSACTIONS_BITMAP;
+	pVirtual->frame.bytes += bytes;
+	pVirtual->frame.wireBytes += 2 * WIRE_BYTES_RANGECOMMAND + WIRE_BYTES_DATAHEADER + bytes;
+	return ESP_OK;
+}
+
+esp_err_t setStartLine(GraphicsPanel* pPanel, uint8_t line) {
+	VirtualPanel* pVirtual = (VirtualPanel*)pPanel;
+	pVirtual->startLine = line % pVirtual->ramHeight;
+	pVirtual->frame.transactions += 1;
+	pVirtual->frame.wireBytes += WIRE_BYTES_COMMAND;
+	return ESP_OK;
+}
+
+void finishFrame(GraphicsPanel* pPanel) {
+	VirtualPanel* pVirtual = (VirtualPanel*)pPanel;
+	struct GraphicsPanelStats_t* pStats = &(pVirtual->stats);
+	if (pVirtual->frame.transactions == 0) {
+		return;
+	}
+	pStats->frames += 1;
+	pStats->transactions += pVirtual->frame.transactions;
+	pStats->bytes += pVirtual->frame.bytes;
+	pStats->wireBytes += pVirtual->frame.wireBytes;
+	pStats->lastFrameTransactions = pVirtual->frame.transactions;
+	pStats->lastFrameBytes = pVirtual->frame.bytes;
+	pStats->lastFrameWireBytes = pVirtual->frame.wireBytes;
+	pStats->maxFrameWireBytes = MAX(pStats->maxFrameWireBytes, pVirtual->frame.wireBytes);
+	memset(&(pVirtual->frame), 0, sizeof(struct GraphicsPanelStats_t));
+}
+
+void destroy(GraphicsPanel* pPanel) {
+	VirtualPanel* pVirtual = (VirtualPanel*)pPanel;
+	free(pVirtual->ram);
+	free(pVirtual);
+}
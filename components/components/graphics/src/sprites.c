@@ -0,0 +1,258 @@
+/*
+ * Part of the book "Embedded Systems mit RISC-V", dpunkt.verlag
+ * Author: Patrick Ritschel
+ *
+ * see https://ritschel.at/buch-embedded-systems-auf-den-punkt-gebracht/
+ *
+ * The code of this project is in the Public Domain (or CC0 licensed, at your option).
+ * Unless required by applicable law or agreed to in writing, this
+ * software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied.
+ */
+#include <stdlib.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "graphics.h"
+#include "sprites.h"
+
+struct _SpriteLayer_ {
+	GraphicsContext* pContext;	// NULL: default context
+	Sprite* pFirst;				// bottom
+	SemaphoreHandle_t mutex;
+};
+
+struct _Sprite_ {
+	SpriteLayer* pLayer;
+	Sprite* pNext;
+	enum Sprites_Mode mode;
+	int z;
+	uint8_t width;
+	uint8_t height;
+	// requested state
+	int x;
+	int y;
+	const uint8_t* image;
+	bool visible;
+	// state in the framebuffer
+	bool drawn;
+	int drawnX;
+	int drawnY;
+	const uint8_t* drawnImage;
+	bool affected;				// removed and redrawn by the running render
+	uint8_t* saveBuffer;		// SPRITES_SAVEUNDER only
+};
+
+// internal prototypes
+static bool isChanged(const Sprite* pSprite);
+static bool overlaps(int x1, int y1, const Sprite* pSprite, int otherX1, int otherY1, const Sprite* pOther);
+static bool overlapsSprite(const Sprite* pSprite, const Sprite* pOther);
+static void removeSprite(Sprite* pSprite, GraphicsContext* pContext);
+static void drawSprite(Sprite* pSprite, GraphicsContext* pContext);
+static void removeTopDown(SpriteLayer* pLayer, GraphicsContext* pContext, bool affectedOnly);
+static GraphicsContext* getContext(SpriteLayer* pLayer);
+
+// ***** implementation *****
+SpriteLayer* sprites_createLayer() {
+	return sprites_createLayerOnContext(NULL);
+}
+
+SpriteLayer* sprites_createLayerOnContext(GraphicsContext* pContext) {
+	SpriteLayer* pLayer = malloc(sizeof(SpriteLayer));
+	if (pLayer == NULL) {
+		return NULL;
+	}
+	pLayer->pContext = pContext;
+	pLayer->pFirst = NULL;
+	pLayer->mutex = xSemaphoreCreateMutex();
+	if (pLayer->mutex == NULL) {
+		free(pLayer);
+		return NULL;
+	}
+	return pLayer;
+}
+
+void sprites_destroyLayer(SpriteLayer* pLayer) {
+	Sprite* pSprite = pLayer->pFirst;
+	while (pSprite != NULL) {
+		Sprite* pNext = pSprite->pNext;
+		free(pSprite->saveBuffer);
+		free(pSprite);
+		pSprite = pNext;
+	}
+	vSemaphoreDelete(pLayer->mutex);
+	free(pLayer);
+}
+
+Sprite* sprites_createSprite(SpriteLayer* pLayer, uint8_t width, uint8_t height, enum Sprites_Mode mode, int z) {
+	Sprite* pSprite = calloc(1, sizeof(Sprite));
+	if (pSprite == NULL) {
+		return NULL;
+	}
+	if (mode == SPRITES_SAVEUNDER) {
+		pSprite->saveBuffer = malloc(graphicsctx_getRegionBufferSize(getContext(pLayer), width, height));
+		if (pSprite->saveBuffer == NULL) {
+			free(pSprite);
+			return NULL;
+		}
+	}
+	pSprite->pLayer = pLayer;
+	pSprite->mode = mode;
+	pSprite->z = z;
+	pSprite->width = width;
+	pSprite->height = height;
+
+	// insert after all sprites with z less or equal
+	xSemaphoreTake(pLayer->mutex, portMAX_DELAY);
+	Sprite** ppNext = &(pLayer->pFirst);
+	while ((*ppNext != NULL) && ((*ppNext)->z <= z)) {
+		ppNext = &((*ppNext)->pNext);
+	}
+	pSprite->pNext = *ppNext;
+	*ppNext = pSprite;
+	xSemaphoreGive(pLayer->mutex);
+	return pSprite;
+}
+
+void sprites_setImage(Sprite* pSprite, const uint8_t* image) {
+	xSemaphoreTake(pSprite->pLayer->mutex, portMAX_DELAY);
+	pSprite->image = image;
+	xSemaphoreGive(pSprite->pLayer->mutex);
+}
+
+void sprites_moveTo(Sprite* pSprite, int x, int y) {
+	xSemaphoreTake(pSprite->pLayer->mutex, portMAX_DELAY);
+	pSprite->x = x;
+	pSprite->y = y;
+	xSemaphoreGive(pSprite->pLayer->mutex);
+}
+
+void sprites_setVisible(Sprite* pSprite, bool visible) {
+	xSemaphoreTake(pSprite->pLayer->mutex, portMAX_DELAY);
+	pSprite->visible = visible;
+	xSemaphoreGive(pSprite->pLayer->mutex);
+}
+
+void sprites_lift(SpriteLayer* pLayer) {
+	xSemaphoreTake(pLayer->mutex, portMAX_DELAY);
+	GraphicsContext* pContext = getContext(pLayer);
+	graphicsctx_startUpdate(pContext);
+	removeTopDown(pLayer, pContext, false);
+	graphicsctx_finishUpdate(pContext);
+	xSemaphoreGive(pLayer->mutex);
+}
+
+bool sprites_render(SpriteLayer* pLayer) {
+	xSemaphoreTake(pLayer->mutex, portMAX_DELAY);
+	// a sprite is removed and redrawn if it changed or overlaps an affected sprite
+	// (sprites have to be removed in the reverse order of drawing)
+	bool anyAffected = false;
+	bool changed;
+	for (Sprite* pSprite = pLayer->pFirst; pSprite != NULL; pSprite = pSprite->pNext) {
+		pSprite->affected = isChanged(pSprite);
+		anyAffected |= pSprite->affected;
+	}
+	do {
+		changed = false;
+		for (Sprite* pSprite = pLayer->pFirst; pSprite != NULL; pSprite = pSprite->pNext) {
+			if (!pSprite->affected) {
+				continue;
+			}
+			for (Sprite* pOther = pLayer->pFirst; pOther != NULL; pOther = pOther->pNext) {
+				if (!pOther->affected && overlapsSprite(pSprite, pOther)) {
+					pOther->affected = true;
+					changed = true;
+				}
+			}
+		}
+	} while (changed);
+
+	if (anyAffected) {
+		GraphicsContext* pContext = getContext(pLayer);
+		graphicsctx_startUpdate(pContext);
+		// first remove top down, then draw bottom up
+		removeTopDown(pLayer, pContext, true);
+		for (Sprite* pSprite = pLayer->pFirst; pSprite != NULL; pSprite = pSprite->pNext) {
+			if (pSprite->affected) {
+				drawSprite(pSprite, pContext);
+				pSprite->affected = false;
+			}
+		}
+		graphicsctx_finishUpdate(pContext);
+	}
+	xSemaphoreGive(pLayer->mutex);
+	return anyAffected;
+}
+
+bool isChanged(const Sprite* pSprite) {
+	bool show = pSprite->visible && (pSprite->image != NULL);
+	if (show != pSprite->drawn) {
+		return true;
+	}
+	return show && ((pSprite->x != pSprite->drawnX) || (pSprite->y != pSprite->drawnY) || (pSprite->image != pSprite->drawnImage));
+}
+
+bool overlaps(int x1, int y1, const Sprite* pSprite, int otherX1, int otherY1, const Sprite* pOther) {
+	return (x1 < otherX1 + pOther->width) && (otherX1 < x1 + pSprite->width) && (y1 < otherY1 + pOther->height) && (otherY1 < y1 + pSprite->height);
+}
+
+// the framebuffer regions (drawn) or the requested ones of both sprites intersect
+bool overlapsSprite(const Sprite* pSprite, const Sprite* pOther) {
+	bool overlap = overlaps(pSprite->x, pSprite->y, pSprite, pOther->x, pOther->y, pOther);
+	if (pSprite->drawn) {
+		overlap |= overlaps(pSprite->drawnX, pSprite->drawnY, pSprite, pOther->x, pOther->y, pOther);
+	}
+	if (pOther->drawn) {
+		overlap |= overlaps(pSprite->x, pSprite->y, pSprite, pOther->drawnX, pOther->drawnY, pOther);
+	}
+	if (pSprite->drawn && pOther->drawn) {
+		overlap |= overlaps(pSprite->drawnX, pSprite->drawnY, pSprite, pOther->drawnX, pOther->drawnY, pOther);
+	}
+	return overlap;
+}
+
+void removeSprite(Sprite* pSprite, GraphicsContext* pContext) {
+	if (pSprite->mode == SPRITES_SAVEUNDER) {
+		graphicsctx_restoreRegion(pContext, pSprite->drawnX, pSprite->drawnY, pSprite->width, pSprite->height, pSprite->saveBuffer);
+	} else {
+		graphicsctx_xorImage(pContext, pSprite->drawnX, pSprite->drawnY, pSprite->width, pSprite->height, pSprite->drawnImage);
+	}
+	pSprite->drawn = false;
+}
+
+void drawSprite(Sprite* pSprite, GraphicsContext* pContext) {
+	if (!pSprite->visible || (pSprite->image == NULL)) {
+		return;
+	}
+	if (pSprite->mode == SPRITES_SAVEUNDER) {
+		graphicsctx_saveRegion(pContext, pSprite->x, pSprite->y, pSprite->width, pSprite->height, pSprite->saveBuffer);
+		graphicsctx_setImage(pContext, pSprite->x, pSprite->y, pSprite->width, pSprite->height, pSprite->image);
+	} else {
+		graphicsctx_xorImage(pContext, pSprite->x, pSprite->y, pSprite->width, pSprite->height, pSprite->image);
+	}
+	pSprite->drawn = true;
+	pSprite->drawnX = pSprite->x;
+	pSprite->drawnY = pSprite->y;
+	pSprite->drawnImage = pSprite->image;
+}
+
+// each sprite restores what was there before it was drawn
+void removeTopDown(SpriteLayer* pLayer, GraphicsContext* pContext, bool affectedOnly) {
+	Sprite* pTop;
+	do {
+		pTop = NULL;
+		for (Sprite* pSprite = pLayer->pFirst; pSprite != NULL; pSprite = pSprite->pNext) {
+			if (pSprite->drawn && (pSprite->affected || !affectedOnly)) {
+				pTop = pSprite;
+			}
+		}
+		if (pTop != NULL) {
+			removeSprite(pTop, pContext);
+		}
+	} while (pTop != NULL);
+}
+
+GraphicsContext* getContext(SpriteLayer* pLayer) {
+	return (pLayer->pContext != NULL) ? pLayer->pContext : graphics_getDefaultContext();
+}
@@ -35,3 +35,10 @@ esp_err_t ssd1306patch_sendCommand(esp_lcd_panel_t *panel, uint8_t command, uint
         data
     }, 1);
 }
+
+esp_err_t ssd1306patch_setStartLine(esp_lcd_panel_t *panel, uint8_t line) {
+    // the start line is encoded in the command itself, no parameter
+    ssd1306_panel_t *ssd1306 = __containerof(panel, ssd1306_panel_t, base);
+    esp_lcd_panel_io_handle_t io = ssd1306->io;
+    return esp_lcd_panel_io_tx_param(io, SSD1306_COMMAND_SETSTARTLINE | (line % SSD1306_RAMHEIGHT), NULL, 0);
+}
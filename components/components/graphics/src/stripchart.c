@@ -0,0 +1,151 @@
+/*
+ * Part of the book "Embedded Systems mit RISC-V", dpunkt.verlag
+ * Author: Patrick Ritschel
+ *
+ * see https://ritschel.at/buch-embedded-systems-auf-den-punkt-gebracht/
+ *
+ * The code of this project is in the Public Domain (or CC0 licensed, at your option).
+ * Unless required by applicable law or agreed to in writing, this
+ * software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "graphicsctx.h"
+#include "stripchart.h"
+
+#define MAX(a,b) ((a) > (b) ? (a) : (b))
+#define MIN(a,b) ((a) < (b) ? (a) : (b))
+
+#define STRIPCHART_SWEEPGAP		4
+#define STRIPCHART_GRIDSPACING	4
+
+struct _StripChart_ {
+	int x1;
+	int y1;
+	uint8_t width;
+	uint8_t height;
+	enum StripChart_Mode mode;
+	int gridY;
+	uint8_t head;		// ring index of the next value
+	uint8_t count;		// number of valid values, saturates at width
+	uint8_t pending;	// values added since the last render, saturates at width
+	int16_t* values;	// ring of width values
+};
+
+// internal prototypes
+static void renderColumn(StripChart* pChart, GraphicsContext* pContext, uint8_t column, bool hasValue, int y, bool hasPrevious, int previousY);
+static void renderSweepColumn(StripChart* pChart, GraphicsContext* pContext, uint8_t column);
+static void renderScrollColumn(StripChart* pChart, GraphicsContext* pContext, uint8_t column);
+
+// ***** implementation *****
+StripChart* stripchart_create(int x1, int y1, uint8_t width, uint8_t height, enum StripChart_Mode mode, int gridY) {
+	if ((width == 0) || (height == 0) || (height > STRIPCHART_MAXHEIGHT)) {
+		return NULL;
+	}
+	StripChart* pChart = malloc(sizeof(StripChart));
+	if (pChart == NULL) {
+		return NULL;
+	}
+	pChart->values = malloc(width * sizeof(int16_t));
+	if (pChart->values == NULL) {
+		free(pChart);
+		return NULL;
+	}
+	pChart->x1 = x1;
+	pChart->y1 = y1;
+	pChart->width = width;
+	pChart->height = height;
+	pChart->mode = mode;
+	pChart->gridY = gridY;
+	stripchart_clear(pChart);
+	return pChart;
+}
+
+void stripchart_destroy(StripChart* pChart) {
+	free(pChart->values);
+	free(pChart);
+}
+
+void stripchart_clear(StripChart* pChart) {
+	pChart->head = 0;
+	pChart->count = 0;
+	pChart->pending = pChart->width; // forces all columns to be rendered blank
+}
+
+void stripchart_addValue(StripChart* pChart, int y) {
+	pChart->values[pChart->head] = MAX(0, MIN(y, pChart->height - 1));
+	pChart->head = (pChart->head + 1) % pChart->width;
+	pChart->count = MIN(pChart->count + 1, pChart->width);
+	pChart->pending = MIN(pChart->pending + 1, pChart->width);
+}
+
+void stripchart_render(StripChart* pChart, GraphicsContext* pContext, bool fullRedraw) {
+	uint8_t width = pChart->width;
+	if (fullRedraw) {
+		pChart->pending = width;
+	}
+	if (pChart->pending == 0) {
+		return;
+	}
+	if (pChart->mode == STRIPCHART_SCROLL) {
+		// the column origin moved -> every column shows a different value now
+		for (uint8_t column = 0; column < width; column += 1) {
+			renderScrollColumn(pChart, pContext, column);
+		}
+	} else if (pChart->pending + STRIPCHART_SWEEPGAP >= width) {
+		for (uint8_t column = 0; column < width; column += 1) {
+			renderSweepColumn(pChart, pContext, column);
+		}
+	} else {
+		// the new columns and the gap in front of them
+		uint8_t column = (pChart->head + width - pChart->pending) % width;
+		for (uint8_t i = 0; i < pChart->pending + STRIPCHART_SWEEPGAP; i += 1) {
+			renderSweepColumn(pChart, pContext, column);
+			column = (column + 1) % width;
+		}
+	}
+	pChart->pending = 0;
+}
+
+// in sweep mode the ring index is the column
+void renderSweepColumn(StripChart* pChart, GraphicsContext* pContext, uint8_t column) {
+	uint8_t width = pChart->width;
+	uint8_t previous = (column == 0) ? width - 1 : column - 1;
+	bool inGap = (pChart->count == width) && ((column + width - pChart->head) % width < STRIPCHART_SWEEPGAP);
+	bool hasValue = (column < pChart->count) && !inGap;
+	bool hasPrevious = previous < pChart->count;
+	renderColumn(pChart, pContext, column, hasValue, pChart->values[column], hasPrevious, pChart->values[previous]);
+}
+
+// in scroll mode the rightmost column shows the value at head - 1
+void renderScrollColumn(StripChart* pChart, GraphicsContext* pContext, uint8_t column) {
+	uint8_t width = pChart->width;
+	uint8_t index = (pChart->head + column) % width;
+	uint8_t previous = (index == 0) ? width - 1 : index - 1;
+	bool hasValue = column >= width - pChart->count;
+	bool hasPrevious = column > width - pChart->count;
+	renderColumn(pChart, pContext, column, hasValue, pChart->values[index], hasPrevious, pChart->values[previous]);
+}
+
+void renderColumn(StripChart* pChart, GraphicsContext* pContext, uint8_t column, bool hasValue, int y, bool hasPrevious, int previousY) {
+	uint8_t image[STRIPCHART_MAXHEIGHT / 8];
+	uint8_t pages = (pChart->height + 7) / 8;
+	memset(image, 0, pages);
+	if (hasValue) {
+		// vertical span from the previous value to this one
+		int yFrom = hasPrevious ? MIN(y, previousY) : y;
+		int yTo = hasPrevious ? MAX(y, previousY) + 1 : y + 1;
+		for (uint8_t page = yFrom / 8; page <= (yTo - 1) / 8; page += 1) {
+			int pageTop = page * 8;
+			uint8_t mask = 0xFF << (MAX(yFrom, pageTop) - pageTop);
+			mask &= 0xFF >> (pageTop + 8 - MIN(yTo, pageTop + 8));
+			image[page] |= mask;
+		}
+	}
+	if ((pChart->gridY >= 0) && (pChart->gridY < pChart->height) && (column % STRIPCHART_GRIDSPACING == 0)) {
+		image[pChart->gridY / 8] |= 1 << (pChart->gridY % 8);
+	}
+	graphicsctx_setImage(pContext, pChart->x1 + column, pChart->y1, 1, pChart->height, image);
+}
@@ -0,0 +1,133 @@
+/*
+ * Part of the book "Embedded Systems mit RISC-V", dpunkt.verlag
+ * Author: Patrick Ritschel
+ *
+ * see https://ritschel.at/buch-embedded-systems-auf-den-punkt-gebracht/
+ *
+ * The code of this project is in the Public Domain (or CC0 licensed, at your option).
+ * Unless required by applicable law or agreed to in writing, this
+ * software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "textcache.h"
+
+#define MIN(a,b) ((a) < (b) ? (a) : (b))
+
+typedef struct _TextCacheEntry_ {
+	struct TextRun_t run;
+	enum Graphics_Font font;
+	uint8_t textlen;
+	uint32_t lastUse; // 0: entry unused
+	char* text;
+	uint8_t* bitmap;
+} TextCacheEntry;
+
+struct _TextCache_ {
+	uint8_t entryCount;
+	uint8_t maxChars;
+	uint16_t maxWidth;
+	uint8_t maxHeight;
+	uint32_t useCounter;
+	TextCacheEntry* entries;
+	uint8_t* memory; // texts and bitmaps of all entries
+	uint8_t glyphBuffer[FONTS_GLYPHBUFFERSIZE]; // own decode buffer, caches may be used by several tasks
+};
+
+// internal prototypes
+static void renderRun(TextCache* pCache, TextCacheEntry* pEntry, const char* text, uint8_t textlen);
+
+// ***** implementation *****
+TextCache* textcache_create(uint8_t entries, uint8_t maxChars, uint16_t maxWidth, uint8_t maxHeight) {
+	TextCache* pCache = malloc(sizeof(TextCache));
+	if (pCache == NULL) {
+		return NULL;
+	}
+	size_t bitmapLength = (size_t)maxWidth * ((maxHeight + 7) / 8);
+	pCache->entries = malloc(entries * sizeof(TextCacheEntry));
+	pCache->memory = malloc(entries * (maxChars + bitmapLength));
+	if ((pCache->entries == NULL) || (pCache->memory == NULL)) {
+		free(pCache->entries);
+		free(pCache->memory);
+		free(pCache);
+		return NULL;
+	}
+	pCache->entryCount = entries;
+	pCache->maxChars = maxChars;
+	pCache->maxWidth = maxWidth;
+	pCache->maxHeight = maxHeight;
+	for (uint8_t i = 0; i < entries; i += 1) {
+		pCache->entries[i].text = (char*)(pCache->memory + i * (maxChars + bitmapLength));
+		pCache->entries[i].bitmap = pCache->memory + i * (maxChars + bitmapLength) + maxChars;
+	}
+	textcache_clear(pCache);
+	return pCache;
+}
+
+void textcache_destroy(TextCache* pCache) {
+	free(pCache->memory);
+	free(pCache->entries);
+	free(pCache);
+}
+
+void textcache_clear(TextCache* pCache) {
+	pCache->useCounter = 0;
+	for (uint8_t i = 0; i < pCache->entryCount; i += 1) {
+		pCache->entries[i].lastUse = 0;
+	}
+}
+
+const struct TextRun_t* textcache_getRun(TextCache* pCache, enum Graphics_Font font, const char* text, uint8_t textlen) {
+	if ((textlen > pCache->maxChars) || (fonts_getCharacterHeight() > pCache->maxHeight)) {
+		return NULL;
+	}
+	pCache->useCounter += 1;
+	// look for a hit, remember the least recently used entry on the way
+	TextCacheEntry* pVictim = &(pCache->entries[0]);
+	for (uint8_t i = 0; i < pCache->entryCount; i += 1) {
+		TextCacheEntry* pEntry = &(pCache->entries[i]);
+		if ((pEntry->lastUse != 0) && (pEntry->font == font) && (pEntry->textlen == textlen) && (memcmp(pEntry->text, text, textlen) == 0)) {
+			pEntry->lastUse = pCache->useCounter;
+			return &(pEntry->run);
+		}
+		if (pEntry->lastUse < pVictim->lastUse) {
+			pVictim = pEntry;
+		}
+	}
+	// miss: render into the least recently used entry
+	pVictim->font = font;
+	pVictim->textlen = textlen;
+	memcpy(pVictim->text, text, textlen);
+	renderRun(pCache, pVictim, text, textlen);
+	pVictim->lastUse = pCache->useCounter;
+	return &(pVictim->run);
+}
+
+void renderRun(TextCache* pCache, TextCacheEntry* pEntry, const char* text, uint8_t textlen) {
+	uint8_t height = fonts_getCharacterHeight();
+	uint8_t pages = (height + 7) / 8;
+	// first pass: width of the run (= line stride of the bitmap)
+	uint16_t width = 0;
+	uint8_t count = 0;
+	while ((count < textlen) && (width < pCache->maxWidth)) {
+		width += fonts_getCharacterWidth(text[count]);
+		count += 1;
+	}
+	width = MIN(width, pCache->maxWidth);
+	// second pass: copy glyphs page by page
+	uint16_t x = 0;
+	for (uint8_t i = 0; i < count; i += 1) {
+		uint16_t charWidth = fonts_getCharacterWidth(text[i]);
+		uint16_t copyWidth = MIN(charWidth, width - x);
+		const uint8_t* glyph = fonts_decodeCharacter(text[i], pCache->glyphBuffer);
+		for (uint8_t page = 0; page < pages; page += 1) {
+			memcpy(pEntry->bitmap + page * width + x, glyph + page * charWidth, copyWidth);
+		}
+		x += copyWidth;
+	}
+	pEntry->run.width = width;
+	pEntry->run.height = height;
+	pEntry->run.bitmap = pEntry->bitmap;
+}
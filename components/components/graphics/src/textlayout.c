@@ -0,0 +1,106 @@
+/*
+ * Part of the book "Embedded Systems mit RISC-V", dpunkt.verlag
+ * Author: Patrick Ritschel
+ *
+ * see https://ritschel.at/buch-embedded-systems-auf-den-punkt-gebracht/
+ *
+ * The code of this project is in the Public Domain (or CC0 licensed, at your option).
+ * Unless required by applicable law or agreed to in writing, this
+ * software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied.
+ */
+#include <string.h>
+
+#include "fonts.h"
+#include "graphicsctx.h"
+#include "textlayout.h"
+
+#define MIN(a,b) ((a) < (b) ? (a) : (b))
+
+// ***** implementation *****
+uint16_t textlayout_measure(const char* text, uint8_t textlen) {
+	const uint8_t* widths = fonts_getCharacterWidths();
+	uint16_t width = 0;
+	for (uint8_t i = 0; i < textlen; i += 1) {
+		width += widths[(uint8_t)text[i]];
+	}
+	return width;
+}
+
+uint8_t textlayout_fitLine(const char* text, uint8_t textlen, uint16_t maxWidth, uint16_t* pLineWidth) {
+	const uint8_t* widths = fonts_getCharacterWidths();
+	uint16_t width = 0;			// running sum up to and including character i
+	uint8_t breakCount = 0;		// line length when breaking at the last blank
+	uint16_t breakWidth = 0;
+	uint8_t count = 0;			// characters that fit
+	uint16_t countWidth = 0;
+	uint8_t i;
+	for (i = 0; (i < textlen) && (text[i] != '\n'); i += 1) {
+		if ((text[i] == ' ') && (i > 0) && (text[i - 1] != ' ')) {
+			breakCount = i;
+			breakWidth = width;
+		}
+		width += widths[(uint8_t)text[i]];
+		if (width > maxWidth) {
+			break;
+		}
+		count = i + 1;
+		countWidth = width;
+	}
+	if ((i < textlen) && (text[i] != '\n') && (text[i] != ' ') && (breakCount > 0)) {
+		// the line ends within a word -> break at the preceding blank
+		count = breakCount;
+		countWidth = breakWidth;
+	} else {
+		while ((count > 0) && (text[count - 1] == ' ')) {
+			count -= 1;
+			countWidth -= widths[' '];
+		}
+	}
+	if ((count == 0) && (textlen > 0) && (text[0] != '\n')) {
+		// not even one character fits
+		count = 1;
+		countWidth = widths[(uint8_t)text[0]];
+	}
+	if (pLineWidth != NULL) {
+		*pLineWidth = countWidth;
+	}
+	return count;
+}
+
+int textlayout_drawText(GraphicsContext* pContext, int x1, int y1, int x2, int y2, const char* text, enum TextLayout_Align align) {
+	uint8_t height = fonts_getCharacterHeight();
+	uint16_t boxWidth = (x2 > x1) ? x2 - x1 : 0;
+	size_t textlen = strlen(text);
+	int lines = 0;
+	int y = y1;
+	while ((textlen > 0) && (y + height <= y2)) {
+		uint8_t available = MIN(textlen, 255);
+		uint16_t lineWidth;
+		uint8_t count = textlayout_fitLine(text, available, boxWidth, &lineWidth);
+		if (count > 0) {
+			int x = x1;
+			if (align == TEXTLAYOUT_CENTER) {
+				x += ((int)boxWidth - lineWidth) / 2;
+			} else if (align == TEXTLAYOUT_RIGHT) {
+				x += (int)boxWidth - lineWidth;
+			}
+			graphicsctx_setCursor(pContext, x, y);
+			graphicsctx_writeChars(pContext, (char*)text, count);
+			lines += 1;
+		}
+		y += height;
+		// continue after the blanks and the line break
+		text += count;
+		textlen -= count;
+		while ((textlen > 0) && (*text == ' ')) {
+			text += 1;
+			textlen -= 1;
+		}
+		if ((textlen > 0) && (*text == '\n')) {
+			text += 1;
+			textlen -= 1;
+		}
+	}
+	return lines;
+}
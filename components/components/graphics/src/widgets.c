@@ -0,0 +1,396 @@
+/*
+ * Part of the book "Embedded Systems mit RISC-V", dpunkt.verlag
+ * Author: Patrick Ritschel
+ *
+ * see https://ritschel.at/buch-embedded-systems-auf-den-punkt-gebracht/
+ *
+ * The code of this project is in the Public Domain (or CC0 licensed, at your option).
+ * Unless required by applicable law or agreed to in writing, this
+ * software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "graphics.h"
+#include "stripchart.h"
+#include "textlayout.h"
+#include "widgets.h"
+
+#define MAX(a,b) ((a) > (b) ? (a) : (b))
+#define MIN(a,b) ((a) < (b) ? (a) : (b))
+
+struct _WidgetScreen_ {
+	GraphicsContext* pContext;	// NULL: default context
+	Widget* pFirst;
+	SemaphoreHandle_t mutex;
+};
+
+typedef struct _LabelWidget_ {
+	Widget widget;
+	char text[WIDGETS_MAX_TEXTLENGTH + 1];
+	enum TextLayout_Align align;
+} LabelWidget;
+
+typedef struct _ValueWidget_ {
+	LabelWidget label;
+	const char* format;
+	const char* noValueText;
+	int32_t noValue;
+} ValueWidget;
+
+typedef struct _IconWidget_ {
+	Widget widget;
+	const uint8_t* image;
+	bool visible;
+} IconWidget;
+
+typedef struct _BarWidget_ {
+	Widget widget;
+	int32_t maxValue;
+	int32_t value;
+} BarWidget;
+
+typedef struct _ChartWidget_ {
+	Widget widget;
+	StripChart* pStripChart;
+} ChartWidget;
+
+// internal prototypes
+static void initWidget(Widget* pWidget, int x1, int y1, int x2, int y2, void (*draw)(Widget*, GraphicsContext*, bool), bool clearBeforeDraw);
+static void destroyWidget(Widget* pWidget);
+static void lockScreen(Widget* pWidget);
+static void unlockScreen(Widget* pWidget);
+static bool overlapsClearedRegion(const Widget* pCleared, const Widget* pWidget);
+static void drawLabel(Widget* pWidget, GraphicsContext* pContext, bool fullRedraw);
+static void drawIcon(Widget* pWidget, GraphicsContext* pContext, bool fullRedraw);
+static void drawBar(Widget* pWidget, GraphicsContext* pContext, bool fullRedraw);
+static void drawChart(Widget* pWidget, GraphicsContext* pContext, bool fullRedraw);
+static void destroyChart(Widget* pWidget);
+static void setLabelTextLocked(LabelWidget* pLabel, const char* text);
+
+// ***** implementation *****
+WidgetScreen* widgets_createScreen() {
+	return widgets_createScreenOnContext(NULL);
+}
+
+WidgetScreen* widgets_createScreenOnContext(GraphicsContext* pContext) {
+	WidgetScreen* pScreen = malloc(sizeof(WidgetScreen));
+	if (pScreen == NULL) {
+		return NULL;
+	}
+	pScreen->pContext = pContext;
+	pScreen->pFirst = NULL;
+	pScreen->mutex = xSemaphoreCreateMutex();
+	if (pScreen->mutex == NULL) {
+		free(pScreen);
+		return NULL;
+	}
+	return pScreen;
+}
+
+void widgets_destroyScreen(WidgetScreen* pScreen) {
+	Widget* pWidget = pScreen->pFirst;
+	while (pWidget != NULL) {
+		Widget* pNext = pWidget->pNext;
+		pWidget->destroy(pWidget);
+		pWidget = pNext;
+	}
+	vSemaphoreDelete(pScreen->mutex);
+	free(pScreen);
+}
+
+void widgets_addWidget(WidgetScreen* pScreen, Widget* pWidget) {
+	xSemaphoreTake(pScreen->mutex, portMAX_DELAY);
+	Widget** ppLast = &(pScreen->pFirst);
+	while (*ppLast != NULL) {
+		ppLast = &((*ppLast)->pNext);
+	}
+	*ppLast = pWidget;
+	pWidget->pNext = NULL;
+	pWidget->pScreen = pScreen;
+	pWidget->invalid = true;
+	pWidget->fullRedraw = true;
+	xSemaphoreGive(pScreen->mutex);
+}
+
+void widgets_invalidate(Widget* pWidget) {
+	lockScreen(pWidget);
+	pWidget->invalid = true;
+	pWidget->fullRedraw = true;
+	unlockScreen(pWidget);
+}
+
+void widgets_invalidateAll(WidgetScreen* pScreen) {
+	xSemaphoreTake(pScreen->mutex, portMAX_DELAY);
+	for (Widget* pWidget = pScreen->pFirst; pWidget != NULL; pWidget = pWidget->pNext) {
+		pWidget->invalid = true;
+		pWidget->fullRedraw = true;
+	}
+	xSemaphoreGive(pScreen->mutex);
+}
+
+bool widgets_render(WidgetScreen* pScreen) {
+	xSemaphoreTake(pScreen->mutex, portMAX_DELAY);
+	// clearing a widget destroys everything in its (page aligned) region -> redraw overlapping widgets, too
+	bool changed;
+	do {
+		changed = false;
+		for (Widget* pWidget = pScreen->pFirst; pWidget != NULL; pWidget = pWidget->pNext) {
+			if (!(pWidget->invalid && pWidget->fullRedraw && pWidget->clearBeforeDraw)) {
+				continue;
+			}
+			for (Widget* pOther = pScreen->pFirst; pOther != NULL; pOther = pOther->pNext) {
+				if ((pOther != pWidget) && !pOther->fullRedraw && overlapsClearedRegion(pWidget, pOther)) {
+					pOther->invalid = true;
+					pOther->fullRedraw = true;
+					changed = true;
+				}
+			}
+		}
+	} while (changed);
+
+	bool anyInvalid = false;
+	for (Widget* pWidget = pScreen->pFirst; pWidget != NULL; pWidget = pWidget->pNext) {
+		anyInvalid |= pWidget->invalid;
+	}
+	if (anyInvalid) {
+		GraphicsContext* pContext = (pScreen->pContext != NULL) ? pScreen->pContext : graphics_getDefaultContext();
+		graphicsctx_startUpdate(pContext);
+		// first clear, then draw bottom up
+		for (Widget* pWidget = pScreen->pFirst; pWidget != NULL; pWidget = pWidget->pNext) {
+			if (pWidget->invalid && pWidget->fullRedraw && pWidget->clearBeforeDraw) {
+				graphicsctx_clearRegion(pContext, pWidget->x1, pWidget->y1, pWidget->x2, pWidget->y2);
+			}
+		}
+		for (Widget* pWidget = pScreen->pFirst; pWidget != NULL; pWidget = pWidget->pNext) {
+			if (pWidget->invalid) {
+				pWidget->draw(pWidget, pContext, pWidget->fullRedraw);
+				pWidget->invalid = false;
+				pWidget->fullRedraw = false;
+			}
+		}
+		graphicsctx_finishUpdate(pContext);
+	}
+	xSemaphoreGive(pScreen->mutex);
+	return anyInvalid;
+}
+
+void initWidget(Widget* pWidget, int x1, int y1, int x2, int y2, void (*draw)(Widget*, GraphicsContext*, bool), bool clearBeforeDraw) {
+	pWidget->destroy = destroyWidget;
+	pWidget->draw = draw;
+	pWidget->pScreen = NULL;
+	pWidget->pNext = NULL;
+	pWidget->x1 = x1;
+	pWidget->y1 = y1;
+	pWidget->x2 = x2;
+	pWidget->y2 = y2;
+	pWidget->invalid = true;
+	pWidget->fullRedraw = true;
+	pWidget->clearBeforeDraw = clearBeforeDraw;
+}
+
+void destroyWidget(Widget* pWidget) {
+	free(pWidget);
+}
+
+void lockScreen(Widget* pWidget) {
+	if (pWidget->pScreen != NULL) {
+		xSemaphoreTake(pWidget->pScreen->mutex, portMAX_DELAY);
+	}
+}
+
+void unlockScreen(Widget* pWidget) {
+	if (pWidget->pScreen != NULL) {
+		xSemaphoreGive(pWidget->pScreen->mutex);
+	}
+}
+
+// graphics_clearRegion() works on whole pages of 8 lines
+bool overlapsClearedRegion(const Widget* pCleared, const Widget* pWidget) {
+	int y1 = (pCleared->y1 / 8) * 8;
+	int y2 = ((pCleared->y2 + 7) / 8) * 8;
+	return (pCleared->x1 < pWidget->x2) && (pWidget->x1 < pCleared->x2) && (y1 < pWidget->y2) && (pWidget->y1 < y2);
+}
+
+// ***** label and value *****
+Widget* widgets_createLabel(int x1, int y1, int x2, int y2, const char* text) {
+	LabelWidget* pLabel = malloc(sizeof(LabelWidget));
+	if (pLabel == NULL) {
+		return NULL;
+	}
+	initWidget(&(pLabel->widget), x1, y1, x2, y2, drawLabel, true);
+	pLabel->align = TEXTLAYOUT_LEFT;
+	pLabel->text[0] = '\0';
+	setLabelTextLocked(pLabel, text);
+	return (Widget*)pLabel;
+}
+
+void widgets_setLabelText(Widget* pWidget, const char* text) {
+	lockScreen(pWidget);
+	setLabelTextLocked((LabelWidget*)pWidget, text);
+	unlockScreen(pWidget);
+}
+
+void widgets_setLabelAlign(Widget* pWidget, enum TextLayout_Align align) {
+	LabelWidget* pLabel = (LabelWidget*)pWidget;
+	lockScreen(pWidget);
+	if (pLabel->align != align) {
+		pLabel->align = align;
+		pWidget->invalid = true;
+		pWidget->fullRedraw = true;
+	}
+	unlockScreen(pWidget);
+}
+
+void setLabelTextLocked(LabelWidget* pLabel, const char* text) {
+	if (strncmp(pLabel->text, text, WIDGETS_MAX_TEXTLENGTH) != 0) {
+		strncpy(pLabel->text, text, WIDGETS_MAX_TEXTLENGTH);
+		pLabel->text[WIDGETS_MAX_TEXTLENGTH] = '\0';
+		pLabel->widget.invalid = true;
+		pLabel->widget.fullRedraw = true;
+	}
+}
+
+// word wrapped within the bounds, lines below them are dropped
+void drawLabel(Widget* pWidget, GraphicsContext* pContext, bool fullRedraw) {
+	LabelWidget* pLabel = (LabelWidget*)pWidget;
+	textlayout_drawText(pContext, pWidget->x1, pWidget->y1, pWidget->x2, pWidget->y2, pLabel->text, pLabel->align);
+}
+
+Widget* widgets_createValue(int x1, int y1, int x2, int y2, const char* format, int32_t noValue, const char* noValueText) {
+	ValueWidget* pValue = malloc(sizeof(ValueWidget));
+	if (pValue == NULL) {
+		return NULL;
+	}
+	initWidget(&(pValue->label.widget), x1, y1, x2, y2, drawLabel, true);
+	pValue->label.align = TEXTLAYOUT_LEFT;
+	pValue->format = format;
+	pValue->noValue = noValue;
+	pValue->noValueText = noValueText;
+	pValue->label.text[0] = '\0';
+	setLabelTextLocked(&(pValue->label), noValueText);
+	return (Widget*)pValue;
+}
+
+// only a changed text invalidates the widget
+void widgets_setValue(Widget* pWidget, int32_t value) {
+	ValueWidget* pValue = (ValueWidget*)pWidget;
+	char buf[WIDGETS_MAX_TEXTLENGTH + 1];
+	if (value == pValue->noValue) {
+		strncpy(buf, pValue->noValueText, WIDGETS_MAX_TEXTLENGTH);
+		buf[WIDGETS_MAX_TEXTLENGTH] = '\0';
+	} else {
+		snprintf(buf, sizeof(buf), pValue->format, (int)value);
+	}
+	widgets_setLabelText(pWidget, buf);
+}
+
+// ***** icon *****
+Widget* widgets_createIcon(int x, int y, uint8_t width, uint8_t height, const uint8_t* image, bool visible) {
+	IconWidget* pIcon = malloc(sizeof(IconWidget));
+	if (pIcon == NULL) {
+		return NULL;
+	}
+	initWidget(&(pIcon->widget), x, y, x + width, y + height, drawIcon, true);
+	pIcon->image = image;
+	pIcon->visible = visible;
+	return (Widget*)pIcon;
+}
+
+void widgets_setIconVisible(Widget* pWidget, bool visible) {
+	IconWidget* pIcon = (IconWidget*)pWidget;
+	lockScreen(pWidget);
+	if (pIcon->visible != visible) {
+		pIcon->visible = visible;
+		pWidget->invalid = true;
+		pWidget->fullRedraw = true;
+	}
+	unlockScreen(pWidget);
+}
+
+void drawIcon(Widget* pWidget, GraphicsContext* pContext, bool fullRedraw) {
+	IconWidget* pIcon = (IconWidget*)pWidget;
+	if (pIcon->visible) {
+		graphicsctx_setImage(pContext, pWidget->x1, pWidget->y1, pWidget->x2 - pWidget->x1, pWidget->y2 - pWidget->y1, pIcon->image);
+	}
+}
+
+// ***** bar *****
+Widget* widgets_createBar(int x1, int y1, int x2, int y2, int32_t maxValue) {
+	BarWidget* pBar = malloc(sizeof(BarWidget));
+	if (pBar == NULL) {
+		return NULL;
+	}
+	initWidget(&(pBar->widget), x1, y1, x2, y2, drawBar, true);
+	pBar->maxValue = MAX(maxValue, 1);
+	pBar->value = 0;
+	return (Widget*)pBar;
+}
+
+void widgets_setBarValue(Widget* pWidget, int32_t value) {
+	BarWidget* pBar = (BarWidget*)pWidget;
+	value = MAX(0, MIN(value, pBar->maxValue));
+	lockScreen(pWidget);
+	if (pBar->value != value) {
+		pBar->value = value;
+		pWidget->invalid = true;
+		pWidget->fullRedraw = true;
+	}
+	unlockScreen(pWidget);
+}
+
+void drawBar(Widget* pWidget, GraphicsContext* pContext, bool fullRedraw) {
+	BarWidget* pBar = (BarWidget*)pWidget;
+	int x1 = pWidget->x1;
+	int y1 = pWidget->y1;
+	int x2 = pWidget->x2 - 1;
+	int y2 = pWidget->y2 - 1;
+	graphicsctx_drawLine(pContext, x1, y1, x2, y1, 1);
+	graphicsctx_drawLine(pContext, x1, y2, x2, y2, 1);
+	graphicsctx_drawLine(pContext, x1, y1, x1, y2, 1);
+	graphicsctx_drawLine(pContext, x2, y1, x2, y2, 1);
+	int fill = (x2 - x1 - 3) * pBar->value / pBar->maxValue;
+	for (int x = x1 + 2; x < x1 + 2 + fill; x += 1) {
+		graphicsctx_drawLine(pContext, x, y1 + 2, x, y2 - 2, 1);
+	}
+}
+
+// ***** chart *****
+Widget* widgets_createChart(int x1, int y1, int x2, int y2, enum StripChart_Mode mode, int gridY) {
+	ChartWidget* pChart = malloc(sizeof(ChartWidget));
+	if (pChart == NULL) {
+		return NULL;
+	}
+	pChart->pStripChart = stripchart_create(x1, y1, x2 - x1, y2 - y1, mode, gridY);
+	if (pChart->pStripChart == NULL) {
+		free(pChart);
+		return NULL;
+	}
+	// the strip chart renders whole columns, no clearing needed
+	initWidget(&(pChart->widget), x1, y1, x2, y2, drawChart, false);
+	pChart->widget.destroy = destroyChart;
+	return (Widget*)pChart;
+}
+
+// values are plotted with the next widgets_render(), the last (x2 - x1) values are kept
+void widgets_addChartValue(Widget* pWidget, int y) {
+	ChartWidget* pChart = (ChartWidget*)pWidget;
+	lockScreen(pWidget);
+	stripchart_addValue(pChart->pStripChart, y);
+	pWidget->invalid = true;
+	unlockScreen(pWidget);
+}
+
+void destroyChart(Widget* pWidget) {
+	stripchart_destroy(((ChartWidget*)pWidget)->pStripChart);
+	free(pWidget);
+}
+
+void drawChart(Widget* pWidget, GraphicsContext* pContext, bool fullRedraw) {
+	stripchart_render(((ChartWidget*)pWidget)->pStripChart, pContext, fullRedraw);
+}
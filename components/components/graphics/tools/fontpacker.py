@@ -0,0 +1,173 @@
+#!/usr/bin/env python3
+#
+# Part of the book "Embedded Systems mit RISC-V", dpunkt.verlag
+# Author: Patrick Ritschel
+#
+# see https://ritschel.at/buch-embedded-systems-auf-den-punkt-gebracht/
+#
+# The code of this project is in the Public Domain (or CC0 licensed, at your option).
+# Unless required by applicable law or agreed to in writing, this
+# software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+# CONDITIONS OF ANY KIND, either express or implied.
+#
+# Converts a font generated by the SSD1306Converter (raw column bitmaps) into
+# the packed format decoded by fonts.c when GRAPHICS_FONT_PACKED is enabled.
+#
+# Packed glyph record (at offsets[c - first], empty glyphs have no record):
+#   byte 0:  width in columns
+#   byte 1:  (top << 4) | (rows - 1), rows of the vertical bounding box
+#   nibbles: (none for blank glyphs) alternating run lengths of 0 and 1 bits, starting with 0,
+#            scanned column by column, top to bottom within the bounding box.
+#            15 means "15 more bits of the same value", a trailing run of
+#            0 bits is omitted. High nibble first.
+#
+# usage: fontpacker.py [--subset CHARS] input.inc output.inc
+
+import argparse
+import re
+import sys
+
+FONT_HEIGHT = 16
+
+
+def parseFont(path):
+    text = open(path, encoding="latin-1").read()
+    name = re.search(r"#define SSD1306_FONT_(\w+)_CHARACTERCOUNT", text).group(1)
+    body = re.search(r"_Characters\[\] = \{(.*?)\};", text, re.S).group(1)
+    data = [int(v, 16) for v in re.findall(r"0x[0-9a-fA-F]+", re.sub(r"//[^\n]*", "", body))]
+    body = re.search(r"_CharacterOffsets\[\] = \{(.*?)\};", text, re.S).group(1)
+    offsets = [int(v) for v in re.findall(r"^\s*(\d+)", re.sub(r"/\*.*?\*/", "", body), re.M)]
+    glyphs = [data[offsets[c]:offsets[c + 1]] for c in range(len(offsets) - 1)]
+    return name, glyphs
+
+
+def packGlyph(glyph):
+    width = len(glyph) // 2
+    if width == 0:
+        return []
+    columns = [glyph[x] | (glyph[width + x] << 8) for x in range(width)]
+    allBits = 0
+    for column in columns:
+        allBits |= column
+    if allBits == 0:
+        # blank glyph with a width (e.g. space): header only
+        return [width, 0x00]
+    top = 0
+    while not (allBits >> top) & 1:
+        top += 1
+    bottom = FONT_HEIGHT
+    while not (allBits >> (bottom - 1)) & 1:
+        bottom -= 1
+    bits = [(column >> y) & 1 for column in columns for y in range(top, bottom)]
+    runs = []
+    current = 0
+    count = 0
+    for bit in bits:
+        if bit == current:
+            count += 1
+        else:
+            runs.append(count)
+            current = bit
+            count = 1
+    if current == 1:
+        runs.append(count)
+    nibbles = []
+    for run in runs:
+        while run >= 15:
+            nibbles.append(15)
+            run -= 15
+        nibbles.append(run)
+    if len(nibbles) % 2:
+        nibbles.append(0)  # a trailing 0 run of length 0 does not change the glyph
+    packed = [width, (top << 4) | (bottom - top - 1)]
+    packed += [(nibbles[i] << 4) | nibbles[i + 1] for i in range(0, len(nibbles), 2)]
+    return packed
+
+
+def unpackGlyph(packed):
+    # reference decoder, used to verify every generated glyph
+    if not packed:
+        return []
+    width = packed[0]
+    glyph = [0] * (2 * width)
+    top = packed[1] >> 4
+    rows = (packed[1] & 0x0F) + 1
+    if len(packed) == 2:
+        return glyph
+    nibbles = []
+    for b in packed[2:]:
+        nibbles += [b >> 4, b & 0x0F]
+    bit = 0
+    pos = 0
+    value = 0
+    for n in nibbles:
+        for _ in range(n):
+            if value:
+                x, y = divmod(pos, rows)
+                y += top
+                glyph[(y // 8) * width + x] |= 1 << (y % 8)
+            pos += 1
+        if n != 15:
+            value ^= 1
+    return glyph
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Packs a SSD1306Converter font into the nibble run length format")
+    parser.add_argument("--subset", help="characters to keep, all others become empty")
+    parser.add_argument("input")
+    parser.add_argument("output")
+    args = parser.parse_args()
+
+    name, glyphs = parseFont(args.input)
+    rawSize = sum(len(g) for g in glyphs) + 2 * (len(glyphs) + 1)
+    if args.subset:
+        keep = set(args.subset.encode("latin-1"))
+        glyphs = [g if c in keep else [] for c, g in enumerate(glyphs)]
+    used = [c for c, g in enumerate(glyphs) if g]
+    first = used[0] if used else 0
+    last = used[-1] if used else 0
+
+    records = []
+    for c in range(first, last + 1):
+        packed = packGlyph(glyphs[c])
+        assert unpackGlyph(packed) == glyphs[c], "packing failed for code %d" % c
+        records.append(packed)
+    maxWidth = max(len(g) // 2 for g in glyphs)
+
+    out = []
+    out.append("/* THIS FILE IS AUTO-GENERATED BY tools/fontpacker.py!                                */")
+    out.append("/* DON'T MODIFY IT BY HAND SINCE IT CAN GET REPLACED AUTOMATICALLY.                    */")
+    out.append("")
+    out.append("/* The generated code is a packed font for the SSD1306Driver, see fontpacker.py for the format. */")
+    out.append("/* source: %s%s */" % (args.input.split("/")[-1], ", subset" if args.subset else ""))
+    out.append("")
+    out.append("/* *** Font >%s< *** */" % name)
+    out.append("#define SSD1306_FONT_%s_FIRSTCHARACTER\t\t\t%d" % (name, first))
+    out.append("#define SSD1306_FONT_%s_PACKEDCHARACTERCOUNT\t\t%d" % (name, last - first + 1))
+    out.append("#define SSD1306_FONT_%s_MAXWIDTH\t\t\t\t%d" % (name, maxWidth))
+    out.append("")
+    out.append("static const uint8_t gFont_%s_PackedCharacters[] = {" % name)
+    offsets = []
+    offset = 0
+    for i, packed in enumerate(records):
+        offsets.append(offset)
+        offset += len(packed)
+        out.append("\t%s\t// code %d" % ("".join("0x%x, " % b for b in packed), first + i))
+    offsets.append(offset)
+    out.append("};")
+    out.append("")
+    out.append("static const uint16_t gFont_%s_PackedOffsets[] = {" % name)
+    for i, value in enumerate(offsets):
+        out.append("\t%d /* code %d */," % (value, first + i))
+    out.append("};")
+    out.append("")
+    with open(args.output, "w", encoding="latin-1") as f:
+        f.write("\n".join(out))
+
+    packedSize = offset + 2 * len(offsets)
+    print("%s: raw %d bytes, packed %d bytes (%d%%)" % (name, rawSize, packedSize, 100 * packedSize // rawSize), file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
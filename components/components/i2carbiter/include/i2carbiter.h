@@ -0,0 +1,66 @@
+/*
+ * Part of the book "Embedded Systems mit RISC-V", dpunkt.verlag
+ * Author: Patrick Ritschel
+ *
+ * see https://ritschel.at/buch-embedded-systems-auf-den-punkt-gebracht/
+ *
+ * The code of this project is in the Public Domain (or CC0 licensed, at your option).
+ * Unless required by applicable law or agreed to in writing, this
+ * software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#ifndef COMPONENTS_I2CARBITER_I2CARBITER_H_
+#define COMPONENTS_I2CARBITER_I2CARBITER_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "sdkconfig.h"
+#if !CONFIG_IDF_TARGET_LINUX
+#include "driver/i2c.h"
+#else
+typedef int i2c_port_t;
+#endif
+
+// max. number of arbitrated I2C ports
+#define I2CARBITER_MAXPORTS				2
+
+// client priorities, a higher one gets the bus first
+#define I2CARBITER_PRIORITY_LOW			1		// e.g. display transfers, split into short transactions
+#define I2CARBITER_PRIORITY_HIGH		10		// e.g. sensor FIFO reads with a deadline
+
+typedef struct _I2CArbiterClient_ I2CArbiterClient;
+
+struct I2CArbiterStats_t {
+	uint32_t transactions;			// outermost acquisitions
+	uint64_t busyTime_us;			// holding the bus
+	uint32_t maxHoldTime_us;
+	uint64_t waitTime_us;			// until the bus was granted
+	uint32_t maxWaitTime_us;
+	uint64_t elapsed_us;			// since the last reset: utilization = busyTime_us / elapsed_us
+};
+
+/*
+ * All drivers of a bus go through its arbiter. A transaction is never interrupted: when the bus is released,
+ * the waiting client with the highest priority gets it (the longest waiting one of equal priority). Meanwhile
+ * the task holding the bus inherits the task priority of the waiting ones. Low priority clients keep their
+ * transactions short, then a high priority client waits for at most one of them (plus tasks of higher
+ * priority than its own). Clients are created during initialization, a client is used by one task at a time.
+ * @return the client or NULL if out of memory or more than I2CARBITER_MAXPORTS ports are used
+ */
+I2CArbiterClient* i2carbiter_createClient(i2c_port_t port, const char* name, uint8_t priority);
+// the client must not hold the bus
+void i2carbiter_destroyClient(I2CArbiterClient* pClient);
+// blocks until the bus is granted, recursive: e.g. several transactions of a client as one unit
+void i2carbiter_acquire(I2CArbiterClient* pClient);
+void i2carbiter_release(I2CArbiterClient* pClient);
+
+#if (CONFIG_I2CARBITER_STATS == 1)
+void i2carbiter_getStats(I2CArbiterClient* pClient, struct I2CArbiterStats_t* pStats);
+void i2carbiter_resetStats(i2c_port_t port);
+// utilization and wait times of all clients of the port since the last call
+void i2carbiter_logStats(i2c_port_t port);
+#endif
+
+#endif /* COMPONENTS_I2CARBITER_I2CARBITER_H_ */
@@ -0,0 +1,249 @@
+/*
+ * Part of the book "Embedded Systems mit RISC-V", dpunkt.verlag
+ * Author: Patrick Ritschel
+ *
+ * see https://ritschel.at/buch-embedded-systems-auf-den-punkt-gebracht/
+ *
+ * The code of this project is in the Public Domain (or CC0 licensed, at your option).
+ * Unless required by applicable law or agreed to in writing, this
+ * software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <sys/param.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "i2carbiter.h"
+
+#define TAG			"i2carbiter"
+
+struct I2CArbiterBus_t {
+	i2c_port_t port;
+	SemaphoreHandle_t mutex;	// protects the state, not held during transactions
+	I2CArbiterClient* pOwner;	// NULL: the bus is free
+	I2CArbiterClient* pClients;
+#if (CONFIG_I2CARBITER_STATS == 1)
+	int64_t statsStart_us;
+#endif
+};
+
+struct _I2CArbiterClient_ {
+	struct I2CArbiterBus_t* pBus;
+	I2CArbiterClient* pNext;
+	const char* name;
+	uint8_t priority;
+	SemaphoreHandle_t hold;		// taken by the client's task while waiting and holding the bus: priority inheritance
+	bool waiting;
+	int64_t waitStart_us;
+	uint8_t depth;				// recursive acquisitions
+#if (CONFIG_I2CARBITER_STATS == 1)
+	int64_t holdStart_us;
+	struct I2CArbiterStats_t stats;
+#endif
+};
+
+static struct I2CArbiterBus_t gBuses[I2CARBITER_MAXPORTS];
+static uint8_t gBusCount = 0;
+
+// internal prototypes
+static struct I2CArbiterBus_t* getBus(i2c_port_t port, bool create);
+static void grantBus(I2CArbiterClient* pClient, int64_t now);
+static I2CArbiterClient* getNextOwner(struct I2CArbiterBus_t* pBus);
+
+// ***** implementation *****
+I2CArbiterClient* i2carbiter_createClient(i2c_port_t port, const char* name, uint8_t priority) {
+	struct I2CArbiterBus_t* pBus = getBus(port, true);
+	if (pBus == NULL) {
+		return NULL;
+	}
+	I2CArbiterClient* pClient = calloc(1, sizeof(I2CArbiterClient));
+	if (pClient == NULL) {
+		return NULL;
+	}
+	pClient->hold = xSemaphoreCreateMutex();
+	if (pClient->hold == NULL) {
+		free(pClient);
+		return NULL;
+	}
+	pClient->pBus = pBus;
+	pClient->name = name;
+	pClient->priority = priority;
+	xSemaphoreTake(pBus->mutex, portMAX_DELAY);
+	pClient->pNext = pBus->pClients;
+	pBus->pClients = pClient;
+	xSemaphoreGive(pBus->mutex);
+	return pClient;
+}
+
+void i2carbiter_destroyClient(I2CArbiterClient* pClient) {
+	struct I2CArbiterBus_t* pBus = pClient->pBus;
+	xSemaphoreTake(pBus->mutex, portMAX_DELAY);
+	I2CArbiterClient** ppNext = &(pBus->pClients);
+	while (*ppNext != pClient) {
+		ppNext = &((*ppNext)->pNext);
+	}
+	*ppNext = pClient->pNext;
+	xSemaphoreGive(pBus->mutex);
+	vSemaphoreDelete(pClient->hold);
+	free(pClient);
+}
+
+void i2carbiter_acquire(I2CArbiterClient* pClient) {
+	struct I2CArbiterBus_t* pBus = pClient->pBus;
+	xSemaphoreTake(pBus->mutex, portMAX_DELAY);
+	if (pBus->pOwner == pClient) {
+		pClient->depth += 1;
+		xSemaphoreGive(pBus->mutex);
+		return;
+	}
+	xSemaphoreGive(pBus->mutex);
+	// only contended for a moment by waiting clients passing through it
+	xSemaphoreTake(pClient->hold, portMAX_DELAY);
+	xSemaphoreTake(pBus->mutex, portMAX_DELAY);
+	int64_t now = esp_timer_get_time();
+	pClient->waitStart_us = now;
+	if (pBus->pOwner == NULL) {
+		grantBus(pClient, now);
+		xSemaphoreGive(pBus->mutex);
+		return;
+	}
+	pClient->waiting = true;
+	while (pBus->pOwner != pClient) {
+		I2CArbiterClient* pOwner = pBus->pOwner;
+		xSemaphoreGive(pBus->mutex);
+		// blocks until the owner releases the bus, the owner's task inherits our priority meanwhile: e.g. the display
+		// finishes its chunk although tasks between its and our priority are ready
+		xSemaphoreTake(pOwner->hold, portMAX_DELAY);
+		xSemaphoreGive(pOwner->hold);
+		// handed over by i2carbiter_release(), to us or to the next owner
+		xSemaphoreTake(pBus->mutex, portMAX_DELAY);
+	}
+	xSemaphoreGive(pBus->mutex);
+}
+
+void i2carbiter_release(I2CArbiterClient* pClient) {
+	struct I2CArbiterBus_t* pBus = pClient->pBus;
+	xSemaphoreTake(pBus->mutex, portMAX_DELAY);
+	assert(pBus->pOwner == pClient);
+	pClient->depth -= 1;
+	if (pClient->depth > 0) {
+		xSemaphoreGive(pBus->mutex);
+		return;
+	}
+	int64_t now = esp_timer_get_time();
+#if (CONFIG_I2CARBITER_STATS == 1)
+	uint32_t hold = now - pClient->holdStart_us;
+	pClient->stats.busyTime_us += hold;
+	pClient->stats.maxHoldTime_us = MAX(pClient->stats.maxHoldTime_us, hold);
+#endif
+	pBus->pOwner = NULL;
+	I2CArbiterClient* pNext = getNextOwner(pBus);
+	if (pNext != NULL) {
+		pNext->waiting = false;
+		grantBus(pNext, now);
+	}
+	xSemaphoreGive(pBus->mutex);
+	// wakes the waiting clients, ends an inherited priority
+	xSemaphoreGive(pClient->hold);
+}
+
+#if (CONFIG_I2CARBITER_STATS == 1)
+void i2carbiter_getStats(I2CArbiterClient* pClient, struct I2CArbiterStats_t* pStats) {
+	struct I2CArbiterBus_t* pBus = pClient->pBus;
+	xSemaphoreTake(pBus->mutex, portMAX_DELAY);
+	*pStats = pClient->stats;
+	pStats->elapsed_us = esp_timer_get_time() - pBus->statsStart_us;
+	xSemaphoreGive(pBus->mutex);
+}
+
+void i2carbiter_resetStats(i2c_port_t port) {
+	struct I2CArbiterBus_t* pBus = getBus(port, false);
+	if (pBus == NULL) {
+		return;
+	}
+	xSemaphoreTake(pBus->mutex, portMAX_DELAY);
+	for (I2CArbiterClient* pClient = pBus->pClients; pClient != NULL; pClient = pClient->pNext) {
+		memset(&pClient->stats, 0, sizeof(pClient->stats));
+	}
+	pBus->statsStart_us = esp_timer_get_time();
+	xSemaphoreGive(pBus->mutex);
+}
+
+void i2carbiter_logStats(i2c_port_t port) {
+	struct I2CArbiterBus_t* pBus = getBus(port, false);
+	if (pBus == NULL) {
+		return;
+	}
+	for (I2CArbiterClient* pClient = pBus->pClients; pClient != NULL; pClient = pClient->pNext) {
+		struct I2CArbiterStats_t stats;
+		i2carbiter_getStats(pClient, &stats);
+		uint32_t transactions = (stats.transactions > 0) ? stats.transactions : 1;
+		uint32_t utilization = (stats.elapsed_us > 0) ? stats.busyTime_us * 1000 / stats.elapsed_us : 0;
+		ESP_LOGI(TAG, "port %d %s: %" PRIu32 " transactions, bus %" PRIu32 ".%" PRIu32 " %%, hold max %" PRIu32 " us, wait %" PRIu32 " us (max %" PRIu32 ")",
+				port, pClient->name, stats.transactions, utilization / 10, utilization % 10, stats.maxHoldTime_us,
+				(uint32_t)(stats.waitTime_us / transactions), stats.maxWaitTime_us);
+	}
+	i2carbiter_resetStats(port);
+}
+#endif
+
+struct I2CArbiterBus_t* getBus(i2c_port_t port, bool create) {
+	for (uint8_t i = 0; i < gBusCount; i += 1) {
+		if (gBuses[i].port == port) {
+			return &gBuses[i];
+		}
+	}
+	if (!create) {
+		return NULL;
+	}
+	if (gBusCount == I2CARBITER_MAXPORTS) {
+		ESP_LOGE(TAG, "More than %d ports", I2CARBITER_MAXPORTS);
+		return NULL;
+	}
+	struct I2CArbiterBus_t* pBus = &gBuses[gBusCount];
+	pBus->mutex = xSemaphoreCreateMutex();
+	if (pBus->mutex == NULL) {
+		return NULL;
+	}
+	pBus->port = port;
+	pBus->pOwner = NULL;
+	pBus->pClients = NULL;
+#if (CONFIG_I2CARBITER_STATS == 1)
+	pBus->statsStart_us = esp_timer_get_time();
+#endif
+	gBusCount += 1;
+	return pBus;
+}
+
+// called with the bus mutex taken
+void grantBus(I2CArbiterClient* pClient, int64_t now) {
+	pClient->pBus->pOwner = pClient;
+	pClient->depth = 1;
+#if (CONFIG_I2CARBITER_STATS == 1)
+	uint32_t wait = now - pClient->waitStart_us;
+	pClient->holdStart_us = now;
+	pClient->stats.transactions += 1;
+	pClient->stats.waitTime_us += wait;
+	pClient->stats.maxWaitTime_us = MAX(pClient->stats.maxWaitTime_us, wait);
+#endif
+}
+
+// the waiting client with the highest priority, of equal ones the longest waiting
+I2CArbiterClient* getNextOwner(struct I2CArbiterBus_t* pBus) {
+	I2CArbiterClient* pNext = NULL;
+	for (I2CArbiterClient* pClient = pBus->pClients; pClient != NULL; pClient = pClient->pNext) {
+		if (!pClient->waiting) {
+			continue;
+		}
+		if ((pNext == NULL) || (pClient->priority > pNext->priority) || ((pClient->priority == pNext->priority) && (pClient->waitStart_us < pNext->waitStart_us))) {
+			pNext = pClient;
+		}
+	}
+	return pNext;
+}
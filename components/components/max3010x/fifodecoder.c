@@ -0,0 +1,93 @@
+/*
+ * Example of the book "Embedded Systems mit RISC-V", dpunkt.verlag
+ * Author: Patrick Ritschel
+ *
+ * see https://ritschel.at/buch-embedded-systems-auf-den-punkt-gebracht/
+ *
+ * The code of this project is in the Public Domain (or CC0 licensed, at your option).
+ * Unless required by applicable law or agreed to in writing, this
+ * software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+
+#include <stddef.h>
+#include <string.h>
+
+#include "max3010x.h"
+#include "fifodecoder.h"
+
+// FIFO layout of the parts, the ADC value is left-justified within adcBits bits of the slot
+struct FifoLayout_t {
+	uint8_t partID;
+	uint8_t bytesPerSlot;
+	uint8_t adcBits;			// max. resolution
+	uint8_t minADCBits;
+	uint8_t maxSlots;
+};
+
+static const struct FifoLayout_t gFifoLayouts[] = {
+		{ MAX3010X_PARTID_MAX30100, 2, 16, 13, 2 },
+		{ MAX3010X_PARTID_MAX30102, 3, 18, 15, FIFODECODER_MAXSLOTS }
+};
+
+// internal prototypes
+static void decodeStrided(const struct FifoFormat_t* pFormat, const uint8_t* data, uint16_t count, uint16_t stride, uint32_t* values);
+
+// ***** implementation *****
+bool fifodecoder_initFormat(struct FifoFormat_t* pFormat, uint8_t partID, uint8_t slotCount, uint8_t adcBits) {
+	const struct FifoLayout_t* pLayout = NULL;
+	for (uint8_t i = 0; i < sizeof(gFifoLayouts) / sizeof(gFifoLayouts[0]); i += 1) {
+		if (gFifoLayouts[i].partID == partID) {
+			pLayout = &gFifoLayouts[i];
+		}
+	}
+	if ((pLayout == NULL) || (adcBits < pLayout->minADCBits) || (adcBits > pLayout->adcBits) || (slotCount == 0) || (slotCount > pLayout->maxSlots)) {
+		return false;
+	}
+	pFormat->bytesPerSlot = pLayout->bytesPerSlot;
+	pFormat->slotCount = slotCount;
+	pFormat->shift = pLayout->adcBits - adcBits;
+	pFormat->mask = (1UL << pLayout->adcBits) - 1;
+	pFormat->irSlot = FIFODECODER_NOSLOT;
+	pFormat->redSlot = FIFODECODER_NOSLOT;
+	return true;
+}
+
+uint16_t fifodecoder_decode(const struct FifoFormat_t* pFormat, const uint8_t* data, uint16_t samples, uint32_t* frames) {
+	uint16_t count = samples * pFormat->slotCount;
+	// the frames are contiguous slot values
+	decodeStrided(pFormat, data, count, pFormat->bytesPerSlot, frames);
+	return count;
+}
+
+void fifodecoder_decodeIRRed(const struct FifoFormat_t* pFormat, const uint8_t* data, uint16_t samples, uint32_t* irValues, uint32_t* redValues) {
+	uint16_t bytesPerSample = fifodecoder_getBytesPerSample(pFormat);
+	if (pFormat->irSlot != FIFODECODER_NOSLOT) {
+		decodeStrided(pFormat, data + pFormat->irSlot * pFormat->bytesPerSlot, samples, bytesPerSample, irValues);
+	} else {
+		memset(irValues, 0, samples * sizeof(uint32_t));
+	}
+	if (pFormat->redSlot != FIFODECODER_NOSLOT) {
+		decodeStrided(pFormat, data + pFormat->redSlot * pFormat->bytesPerSlot, samples, bytesPerSample, redValues);
+	} else {
+		memset(redValues, 0, samples * sizeof(uint32_t));
+	}
+}
+
+// the slot width is the only case distinction, the loops are straight-line code
+void decodeStrided(const struct FifoFormat_t* pFormat, const uint8_t* data, uint16_t count, uint16_t stride, uint32_t* values) {
+	uint32_t mask = pFormat->mask;
+	uint8_t shift = pFormat->shift;
+	if (pFormat->bytesPerSlot == 3) {
+		for (uint16_t i = 0; i < count; i += 1) {
+			values[i] = ((((uint32_t)data[0] << 16) | ((uint32_t)data[1] << 8) | data[2]) & mask) >> shift;
+			data += stride;
+		}
+	} else {
+		for (uint16_t i = 0; i < count; i += 1) {
+			values[i] = ((((uint32_t)data[0] << 8) | data[1]) & mask) >> shift;
+			data += stride;
+		}
+	}
+}
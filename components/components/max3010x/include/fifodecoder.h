@@ -0,0 +1,52 @@
+/*
+ * Example of the book "Embedded Systems mit RISC-V", dpunkt.verlag
+ * Author: Patrick Ritschel
+ *
+ * see https://ritschel.at/buch-embedded-systems-auf-den-punkt-gebracht/
+ *
+ * The code of this project is in the Public Domain (or CC0 licensed, at your option).
+ * Unless required by applicable law or agreed to in writing, this
+ * software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+
+#ifndef COMPONENTS_MAX3010X_INCLUDE_FIFODECODER_H_
+#define COMPONENTS_MAX3010X_INCLUDE_FIFODECODER_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// max. active slots per sample (multi-LED mode)
+#define FIFODECODER_MAXSLOTS							4
+#define FIFODECODER_NOSLOT								-1
+
+// layout of the FIFO samples, derived from part, mode and ADC resolution
+struct FifoFormat_t {
+	uint8_t bytesPerSlot;		// 3: MAX30102, 2: MAX30100
+	uint8_t slotCount;			// active slots per sample, 1..FIFODECODER_MAXSLOTS
+	uint8_t shift;				// the ADC value is left-justified within the slot
+	uint32_t mask;
+	int8_t irSlot;				// FIFODECODER_NOSLOT: not sampled
+	int8_t redSlot;
+};
+
+/**
+ * Initializes the format for the given part, slotCount active slots and an ADC resolution of adcBits.
+ * The slot roles (irSlot, redSlot) are set to FIFODECODER_NOSLOT.
+ * @return false if the part is unknown or the resolution or slot count is not supported by it
+ */
+bool fifodecoder_initFormat(struct FifoFormat_t* pFormat, uint8_t partID, uint8_t slotCount, uint8_t adcBits);
+static inline uint16_t fifodecoder_getBytesPerSample(const struct FifoFormat_t* pFormat) {
+	return pFormat->bytesPerSlot * pFormat->slotCount;
+}
+/**
+ * Unpacks the raw FIFO bytes of samples samples in one pass into frames, interleaved by slot
+ * (frames[sample * slotCount + slot]).
+ * @return the number of values written
+ */
+uint16_t fifodecoder_decode(const struct FifoFormat_t* pFormat, const uint8_t* data, uint16_t samples, uint32_t* frames);
+// unpacks the IR and red slot into separate arrays, missing slots are set to 0
+void fifodecoder_decodeIRRed(const struct FifoFormat_t* pFormat, const uint8_t* data, uint16_t samples, uint32_t* irValues, uint32_t* redValues);
+
+#endif /* COMPONENTS_MAX3010X_INCLUDE_FIFODECODER_H_ */
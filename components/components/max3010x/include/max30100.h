@@ -16,6 +16,8 @@
 #include "max3010x.h"
 
 // registers
+#define MAX30100_REG_INTERRUPTSTATUS					0x00
+#define MAX30100_REG_INTERRUPTENABLE					0x01
 #define MAX30100_REG_FIFOWRPTR							0x02
 #define MAX30100_REG_FIFOOVFCTR							0x03
 #define MAX30100_REG_FIFORDPTR							0x04
@@ -24,7 +26,13 @@
 #define MAX30100_REG_SPO2CONFIG							0x07
 #define MAX30100_REG_LEDCONFIG							0x09
 
+// configuration registers kept in the shadow (the temperature enable of the mode register is not used)
+#define MAX30100_SHADOWREGS								((1ULL << MAX30100_REG_INTERRUPTENABLE) | (1ULL << MAX30100_REG_MODECONFIG) | \
+														 (1ULL << MAX30100_REG_SPO2CONFIG) | (1ULL << MAX30100_REG_LEDCONFIG))
+
 // masks
+#define MAX30100_INT_AFULL								(1 << 7)
+
 #define MAX30100_MODECONFIG_RESET						(1 << 6)
 
 #define MAX30100_SPO2CONFIG_HIRESEN						(1 << 6)
@@ -36,6 +36,12 @@
 #define MAX30102_REG_DIETEMPFRAC						0x20
 #define MAX30102_REG_DIETEMPCONFIG						0x21
 
+// configuration registers kept in the shadow (the die temperature config clears itself)
+#define MAX30102_SHADOWREGS								((1ULL << MAX30102_REG_INTERRUPTENABLE1) | (1ULL << MAX30102_REG_INTERRUPTENABLE2) | \
+														 (1ULL << MAX30102_REG_FIFOCONFIG) | (1ULL << MAX30102_REG_MODECONFIG) | (1ULL << MAX30102_REG_SPO2CONFIG) | \
+														 (1ULL << MAX30102_REG_LEDPULSEAMP1) | (1ULL << MAX30102_REG_LEDPULSEAMP2) | (1ULL << MAX30102_REG_PILOTPA) | \
+														 (1ULL << MAX30102_REG_MULTILEDCTRL12) | (1ULL << MAX30102_REG_MULTILEDCTRL34))
+
 // masks
 #define MAX30102_INT1_PWRRDY							(1 << 0)
 #define MAX30102_INT1_ALCOVF							(1 << 5)
@@ -43,6 +49,7 @@
 #define MAX30102_INT1_AFULL								(1 << 7)
 #define MAX30102_INT2_DIETEMPDY							(1 << 1)
 
+#define MAX30102_FIFOCONFIG_AFULL(samples)				((MAX30102_FIFOSIZE - (samples)) & 0x0F) // unread samples at the interrupt, 17..32
 #define MAX30102_FIFOCONFIG_ROLLOVEREN					(1 << 4)
 #define MAX30102_FIFOCONFIG_SMPAVENONE					(0 << 5)
 #define MAX30102_FIFOCONFIG_SMPAVE2						(1 << 5)
@@ -57,6 +64,9 @@
 #define MAX30102_MODECONFIG_SPO2MODE					(3)
 #define MAX30102_MODECONFIG_MULTILEDMODE				(7)
 
+#define MAX30102_MULTILEDCTRL_SLOT_RED					1 // LED1
+#define MAX30102_MULTILEDCTRL_SLOT_IR					2 // LED2
+
 #define MAX30102_SPO2CONFIG_LEDPW_69us_ADC15bit			(0)
 #define MAX30102_SPO2CONFIG_LEDPW_118us_ADC16bit		(1)
 #define MAX30102_SPO2CONFIG_LEDPW_215us_ADC17bit		(2)
@@ -14,16 +14,41 @@
 #define COMPONENTS_PULSEOXI_INCLUDE_MAX3010X_H_
 
 #include <stdint.h>
+#include <stdbool.h>
+#include "sdkconfig.h"
+#include "esp_err.h"
+#if !CONFIG_IDF_TARGET_LINUX
 #include "driver/i2c.h"
+#include "driver/gpio.h"
+#else
+// no I2C and GPIO drivers, the simulated sensor is used (CONFIG_MAX3010X_SIMULATION)
+typedef int i2c_port_t;
+typedef int gpio_num_t;
+#define GPIO_NUM_NC										(-1)
+#endif
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "fifodecoder.h"
 
 #define MAX3010X_TAG									"max3010x"
 #define MAX3010X_I2C_ADDR								0x57
-#define MAX3010X_I2C_TIMEOUT_ms							1000
+#define MAX3010X_I2C_TIMEOUT_ms							100
+
+// max. samples of one FIFO burst (FIFO size of the MAX30102)
+#define MAX3010X_BURST_MAXSAMPLES						32
+// burst buffers per device: double buffering
+#define MAX3010X_BURSTCOUNT								2
+// sensors served by the acquisition task
+#define MAX3010X_MAXDEVICES								4
+// no I2C multiplexer between the port and the sensor
+#define MAX3010X_NOMUX									0x00
 
 #define MAX3010X_PARTID_MAX30100						0x11
 #define MAX3010X_PARTID_MAX30102						0x15
 
 // registers
+#define MAX3010X_SHADOWSIZE								0x22	// configuration registers 0x00..0x21
 #define MAX3010X_REG_REVISION							0xFE
 #define MAX3010X_REG_PARTID								0xFF
 
@@ -31,41 +56,196 @@
 #define MAX3010X_MODE_HR_ONLY							0x02
 #define MAX3010X_MODE_SPO2_HR							0x03
 
+// sampling configuration, 0: default of the part
+struct Max3010xConfig_t {
+	uint8_t mode;				// MAX3010X_MODE_xxx (or MAX30102_MODECONFIG_MULTILEDMODE)
+	uint16_t samplingRate;		// Hz, MAX30102: 50..3200, MAX30100: 50..1000
+	uint8_t averaging;			// samples averaged into one FIFO sample (MAX30102 only): 1, 2, 4..32
+	uint16_t pulseWidth_us;		// determines the ADC resolution, 0: longest possible at the sampling rate
+	uint16_t adcRange_nA;		// MAX30102 only: 2048..16384, 0: 4096 nA
+};
+
+// I2C connection of a sensor: directly on the port or behind a TCA9548A compatible multiplexer
+struct Max3010xBus_t {
+	i2c_port_t i2cPort;
+	uint8_t muxAddress;			// MAX3010X_NOMUX: no multiplexer
+	uint8_t muxChannel;			// 0..7
+};
+
+struct Max3010xDevice_t;
+// multiplexer shared by the sensors behind it
+struct Max3010xMux_t;
+
 // function pointers
-typedef esp_err_t (*SoftResetFct_t)(void);
-typedef esp_err_t (*SetupFct_t)(uint8_t mode, uint16_t samplingRate);
-typedef uint16_t (*ReadFIFOFct_t)(uint32_t* irValues, uint32_t* redValues, uint16_t maxcnt);
-typedef void (*Max3010x_DataAvailableCallback_t)();
+typedef esp_err_t (*SoftResetFct_t)(struct Max3010xDevice_t* pDevice);
+typedef esp_err_t (*SetupFct_t)(struct Max3010xDevice_t* pDevice, const struct Max3010xConfig_t* pConfig);
+// validates the combination against the datasheet, resolves the defaults and derives the FIFO layout
+typedef esp_err_t (*CheckConfigFct_t)(struct Max3010xDevice_t* pDevice, struct Max3010xConfig_t* pConfig, struct FifoFormat_t* pFormat);
+typedef esp_err_t (*ConfigureFct_t)(struct Max3010xDevice_t* pDevice, const struct Max3010xConfig_t* pConfig);
+typedef esp_err_t (*SetLEDCurrentsFct_t)(struct Max3010xDevice_t* pDevice, uint8_t irLEDCurrent, uint8_t redLEDCurrent);
+typedef esp_err_t (*ReadFIFOFct_t)(struct Max3010xDevice_t* pDevice, uint32_t* irValues, uint32_t* redValues, uint16_t maxcnt, uint16_t* pCount);
+typedef void (*Max3010x_DataAvailableCallback_t)(struct Max3010xDevice_t* pDevice);
+
+// samples read from the FIFO in one burst
+struct Max3010xBurst_t {
+	uint16_t count;
+	// the LED currents were changed by the auto gain control before these samples (filters need to be re-primed)
+	bool gainChanged;
+	uint8_t irLEDCurrent;
+	uint8_t redLEDCurrent;
+	uint32_t irValues[MAX3010X_BURST_MAXSAMPLES];
+	uint32_t redValues[MAX3010X_BURST_MAXSAMPLES];
+	// time each sample was taken (max3010x_getTime()), reconstructed from the FIFO level and the sample clock
+	int64_t timestamps_us[MAX3010X_BURST_MAXSAMPLES];
+};
 
 // device struct
 struct Max3010xDevice_t {
-	i2c_port_t i2cPort;
+	struct Max3010xBus_t bus;
+	struct Max3010xMux_t* pMux;	// NULL: connected directly
+	struct _I2CArbiterClient_* pBusClient;	// shares the port with other drivers, NULL with the simulation
+	gpio_num_t gpioIRQ;			// GPIO_NUM_NC: the FIFO is polled
+	Max3010x_DataAvailableCallback_t dataAvailableCB;
 	uint8_t partID;
 	uint8_t revision;
+	// sampling configuration and FIFO reads are mutually exclusive
+	SemaphoreHandle_t mutex;
 
-	// for setting the LEDs currents
+	// for setting the LEDs currents (register values)
 	uint8_t irLEDCurrent;
 	uint8_t redLEDCurrent;
+	uint8_t maxLEDCurrent;
+	// LED current auto gain control
+	bool agcEnabled;
+	bool agcChanged;			// the currents were changed after the last burst
+
+	// FIFO size and unread samples when the almost full interrupt is raised: the part's range, the threshold of the
+	// current configuration (lowered for the drain latency)
+	uint8_t fifoSize;
+	uint8_t minFifoAlmostFull;
+	uint8_t maxFifoAlmostFull;
+	uint8_t fifoAlmostFull;
+	bool polled;				// no IRQ line or the interrupt leaves too little time to drain the FIFO
+	// current sampling configuration (defaults resolved) and sample layout
+	struct Max3010xConfig_t config;
+	struct FifoFormat_t fifoFormat;
+
+	// shadow copy of the configuration registers (bit n: register n)
+	uint8_t shadow[MAX3010X_SHADOWSIZE];
+	uint64_t shadowCacheable;	// registers without self-changing bits, set by the part
+	uint64_t shadowValid;
+	uint64_t shadowDirty;
+
+	// set by readFIFOFct: time of the FIFO pointer read, samples were lost since the previous read
+	int64_t fifoReadTime_us;
+	bool fifoOverflow;
+	// sample clock, follows the oscillator of the part: the newest sample so far was taken at sampleTime_ns,
+	// the next ones every samplePeriod_ns
+	bool clockLocked;
+	int64_t sampleTime_ns;
+	uint32_t samplePeriod_ns;
+
+	// acquisition, the bursts circulate between the free and the filled queue
+	bool acquiring;
+	volatile bool irqPending;
+	volatile int64_t irqTime_us;
+	TickType_t lastReadTick;
+	TickType_t retryTick;		// after a failed transfer the device is skipped until then
+	struct Max3010xBurst_t* pBurst;	// taken from the free queue, not yet filled
+	QueueHandle_t freeBurstQueue;
+	QueueHandle_t filledBurstQueue;
+	struct Max3010xBurst_t bursts[MAX3010X_BURSTCOUNT];
 
 	// function pointers
 	SoftResetFct_t softResetFct;
 	SetupFct_t setupFct;
+	CheckConfigFct_t checkConfigFct;
+	ConfigureFct_t configureFct;
+	SetLEDCurrentsFct_t setLEDCurrentsFct;
 	ReadFIFOFct_t readFIFOFct;
 };
 
 // function prototypes
 // the given i2c port needs to be initialized previously, max. data rate = 400kHz
+// with an IRQ line the GPIO ISR service has to be installed (gpio_install_isr_service()), the callback is
+// called from interrupt context when the FIFO is almost full
+// creates the default device (pDevice NULL below)
 esp_err_t max3010x_init(i2c_port_t i2cPort, gpio_num_t gpioIRQ, Max3010x_DataAvailableCallback_t dataAvailableCB);
+/**
+ * Creates a handle for a further sensor, e.g. on a second port or another multiplexer channel. Each device has
+ * its own shadow registers, IRQ line and burst buffers.
+ * @return ESP_ERR_NO_MEM if MAX3010X_MAXDEVICES are in use, ESP_ERR_NOT_FOUND if no supported part answers
+ */
+esp_err_t max3010x_createDevice(const struct Max3010xBus_t* pBus, gpio_num_t gpioIRQ, Max3010x_DataAvailableCallback_t dataAvailableCB, struct Max3010xDevice_t** ppDevice);
+// the device of max3010x_init()
 struct Max3010xDevice_t* max3010x_getDevice();
 const char* max3010x_getDeviceName(const struct Max3010xDevice_t* pDevice);
 
-esp_err_t max3010x_writeReadDevice(const uint8_t* write_buffer, size_t write_size, uint8_t* read_buffer, size_t read_size);
-uint8_t max3010x_readRegister(uint8_t reg, esp_err_t* pRes);
-esp_err_t max3010x_writeRegister(uint8_t reg, uint8_t value);
-esp_err_t max3010x_readModifyWriteRegister(uint8_t reg, uint8_t mask, uint8_t value);
+// register access (selects the multiplexer channel)
+esp_err_t max3010x_writeReadDevice(struct Max3010xDevice_t* pDevice, const uint8_t* write_buffer, size_t write_size, uint8_t* read_buffer, size_t read_size);
+uint8_t max3010x_readRegister(struct Max3010xDevice_t* pDevice, uint8_t reg, esp_err_t* pRes);
+// the shadow value of cacheable registers, read from the part only once
+uint8_t max3010x_readCachedRegister(struct Max3010xDevice_t* pDevice, uint8_t reg, esp_err_t* pRes);
+esp_err_t max3010x_writeRegister(struct Max3010xDevice_t* pDevice, uint8_t reg, uint8_t value);
+// consecutive registers in one auto-incrementing transaction
+esp_err_t max3010x_writeRegisters(struct Max3010xDevice_t* pDevice, uint8_t reg, const uint8_t* values, uint8_t count);
+// single write with the shadow value, the register is only read if not cached yet
+esp_err_t max3010x_readModifyWriteRegister(struct Max3010xDevice_t* pDevice, uint8_t reg, uint8_t mask, uint8_t value);
+/*
+ * Changes the shadow of a cacheable register without I2C transfer, max3010x_commit() writes all changed
+ * registers, consecutive ones in one burst.
+ */
+esp_err_t max3010x_stageRegister(struct Max3010xDevice_t* pDevice, uint8_t reg, uint8_t mask, uint8_t value);
+esp_err_t max3010x_commit(struct Max3010xDevice_t* pDevice);
+// after a reset: all cacheable registers have their power-on value 0x00
+void max3010x_resetShadow(struct Max3010xDevice_t* pDevice);
 
-esp_err_t max3010x_softReset(void);
-esp_err_t max3010x_setup(uint8_t mode, uint16_t samplingRate);
-uint16_t max3010x_readFIFO(uint32_t* irValues, uint32_t* redValues, uint16_t maxcnt);
+// pDevice NULL: the device of max3010x_init()
+esp_err_t max3010x_softReset(struct Max3010xDevice_t* pDevice);
+/**
+ * Resets the part and starts sampling with the given configuration. The configuration has to be supported by
+ * the part and the FIFO must be drained in time (see max3010x_checkConfig()).
+ * @return ESP_ERR_INVALID_ARG if the configuration is not possible
+ */
+esp_err_t max3010x_setup(struct Max3010xDevice_t* pDevice, const struct Max3010xConfig_t* pConfig);
+// switches the sampling configuration without reset (LED currents stay), the FIFO is cleared
+esp_err_t max3010x_configure(struct Max3010xDevice_t* pDevice, const struct Max3010xConfig_t* pConfig);
+/**
+ * Checks the configuration against the datasheet limits of the part and the FIFO drain budget: the time until
+ * the FIFO overflows after the interrupt (or the poll) has to cover CONFIG_MAX3010X_DRAIN_LATENCY_ms. The almost
+ * full threshold is lowered as far as needed, if even the part's lowest one leaves too little time the FIFO is
+ * polled.
+ * @return ESP_OK if the configuration may be applied
+ */
+esp_err_t max3010x_checkConfig(struct Max3010xDevice_t* pDevice, const struct Max3010xConfig_t* pConfig);
+// rate of the FIFO samples (sampling rate / averaging), rounded down: the exact period is max3010x_getSamplePeriod()
+uint16_t max3010x_getSampleRate(struct Max3010xDevice_t* pDevice);
+// FIFO sample period measured against max3010x_getTime() by the acquisition, the nominal one before, 0 before max3010x_setup()
+uint32_t max3010x_getSamplePeriod(struct Max3010xDevice_t* pDevice);
+// time base of the sample timestamps in us: esp_timer_get_time(), the virtual time of the simulated sensor
+int64_t max3010x_getTime(void);
+// register values, 0..maxLEDCurrent of the device
+esp_err_t max3010x_setLEDCurrents(struct Max3010xDevice_t* pDevice, uint8_t irLEDCurrent, uint8_t redLEDCurrent);
+/*
+ * The acquisition task keeps the DC level of each channel within a window of the ADC range by adapting the LED
+ * currents. Bursts after a change are marked with gainChanged.
+ */
+void max3010x_enableAGC(struct Max3010xDevice_t* pDevice, bool enable);
+// reads the available samples in one burst and acknowledges the interrupt, 0 on errors
+uint16_t max3010x_readFIFO(struct Max3010xDevice_t* pDevice, uint32_t* irValues, uint32_t* redValues, uint16_t maxcnt);
+
+/*
+ * Acquisition in a worker task: it waits for the interrupts (or polls), reads the FIFO into one of two burst
+ * buffers of the device and queues it, while the caller processes the other one. Call after max3010x_setup(),
+ * the burst buffers are returned with max3010x_releaseBurst(). The I2C transfer then never blocks the processing
+ * task. One task serves all devices round robin with one FIFO burst per turn: a device whose consumer holds both
+ * buffers is skipped, one whose transfer failed is retried later, neither delays the others.
+ * Every sample gets the time it was taken, independent of when the burst is read or processed: the part's
+ * sample clock is tracked from the interrupt times (the FIFO level is known then) or the poll times.
+ */
+esp_err_t max3010x_startAcquisition(struct Max3010xDevice_t* pDevice);
+// the next filled burst or NULL on timeout
+const struct Max3010xBurst_t* max3010x_receiveBurst(struct Max3010xDevice_t* pDevice, TickType_t timeout);
+void max3010x_releaseBurst(struct Max3010xDevice_t* pDevice, const struct Max3010xBurst_t* pBurst);
 
 #endif /* COMPONENTS_PULSEOXI_INCLUDE_MAX3010X_H_ */
@@ -0,0 +1,49 @@
+/*
+ * Example of the book "Embedded Systems mit RISC-V", dpunkt.verlag
+ * Author: Patrick Ritschel
+ *
+ * see https://ritschel.at/buch-embedded-systems-auf-den-punkt-gebracht/
+ *
+ * The code of this project is in the Public Domain (or CC0 licensed, at your option).
+ * Unless required by applicable law or agreed to in writing, this
+ * software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#ifndef COMPONENTS_MAX3010X_INCLUDE_MAX3010XSIM_H_
+#define COMPONENTS_MAX3010X_INCLUDE_MAX3010XSIM_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+/*
+ * Register model of the MAX30102 (or MAX30100 with CONFIG_MAX3010X_SIMULATION_MAX30100) used instead of the I2C
+ * transfers with CONFIG_MAX3010X_SIMULATION. The sensor samples a PPG trace into its FIFO at the configured
+ * sampling rate (CONFIG_MAX3010X_SIMULATION_TIMELAPSE times faster than real time), scaled by the LED currents
+ * and truncated to the ADC resolution. FIFO pointers wrap, the overflow counter counts lost samples (or
+ * overwritten ones with roll over), reading the status registers clears them.
+ */
+void max3010xsim_init(void);
+/**
+ * Replays the samples (at the 18 bit full scale of the MAX30102, measured with the default LED currents of the
+ * setup), recorded at traceRate_Hz, in a loop. The arrays have to stay valid. NULL: synthetic pulse of 72 bpm.
+ * May be called before max3010x_init().
+ */
+void max3010xsim_setTrace(const uint32_t* irValues, const uint32_t* redValues, uint32_t count, uint16_t traceRate_Hz);
+/**
+ * Loads a trace file: CSV with one "ir,red" line per sample (other lines are skipped) or, if the name ends
+ * with ".bin", little endian uint32 pairs ir, red.
+ * @return ESP_ERR_NOT_FOUND if the file cannot be opened, ESP_ERR_INVALID_SIZE if it holds no samples
+ */
+esp_err_t max3010xsim_loadTrace(const char* path, uint16_t traceRate_Hz);
+// samples lost by FIFO overflows since max3010xsim_init()
+uint32_t max3010xsim_getLostSamples(void);
+// virtual time of the model in us
+int64_t max3010xsim_getTime(void);
+
+// I2C seam of the driver
+esp_err_t max3010xsim_writeRead(const uint8_t* writeBuffer, size_t writeSize, uint8_t* readBuffer, size_t readSize);
+esp_err_t max3010xsim_write(const uint8_t* writeBuffer, size_t writeSize);
+
+#endif /* COMPONENTS_MAX3010X_INCLUDE_MAX3010XSIM_H_ */
@@ -10,77 +10,155 @@
  * CONDITIONS OF ANY KIND, either express or implied.
  */
 
+#include <stdio.h>
+#include <sys/param.h>
+
 #include "esp_check.h"
+#include "freertos/task.h"
 #include "max30100.h"
 
 #define TAG		"MAX30100"
 #define PROBLEM "I2C communication problem"
 
-static esp_err_t softReset(void);
-static esp_err_t setup(uint8_t mode, uint16_t samplingRate);
-static uint16_t readFIFO(uint32_t* irValues, uint32_t* redValues, uint16_t maxcnt);
+#define MAX30100_FIFOSIZE		16
+
+// register values are the indices
+static const uint16_t gSamplingRates[] = { 50, 100, 167, 200, 400, 600, 800, 1000 };
+static const uint16_t gPulseWidths_us[] = { 200, 400, 800, 1600 };		// 13..16 bit ADC resolution
+// longest pulse width (index) per sampling rate (datasheet tables 8 and 9)
+static const int8_t gMaxPulseWidthSpO2[] = { 3, 3, 2, 2, 1, 0, 0, 0 };
+static const int8_t gMaxPulseWidthHR[] = { 3, 3, 3, 3, 2, 1, 1, 0 };
+
+static esp_err_t softReset(struct Max3010xDevice_t* pDevice);
+static esp_err_t setup(struct Max3010xDevice_t* pDevice, const struct Max3010xConfig_t* pConfig);
+static esp_err_t checkConfig(struct Max3010xDevice_t* pDevice, struct Max3010xConfig_t* pConfig, struct FifoFormat_t* pFormat);
+static esp_err_t configure(struct Max3010xDevice_t* pDevice, const struct Max3010xConfig_t* pConfig);
+static esp_err_t setLEDCurrents(struct Max3010xDevice_t* pDevice, uint8_t irLEDCurrent, uint8_t redLEDCurrent);
+static esp_err_t readFIFO(struct Max3010xDevice_t* pDevice, uint32_t* irValues, uint32_t* redValues, uint16_t maxcnt, uint16_t* pCount);
+static int8_t indexOf(const uint16_t* values, uint8_t count, uint16_t value);
 
 
 void max30100_initCallbacks(struct Max3010xDevice_t* pDevice) {
+	pDevice->fifoSize = MAX30100_FIFOSIZE;
+	pDevice->minFifoAlmostFull = MAX30100_FIFOSIZE - 1; // fixed
+	pDevice->maxFifoAlmostFull = MAX30100_FIFOSIZE - 1;
+	pDevice->fifoAlmostFull = MAX30100_FIFOSIZE - 1;
+	pDevice->shadowCacheable = MAX30100_SHADOWREGS;
+	pDevice->maxLEDCurrent = MAX30100_LEDCURRENT_50mA;
 	pDevice->softResetFct = softReset;
 	pDevice->setupFct = setup;
+	pDevice->checkConfigFct = checkConfig;
+	pDevice->configureFct = configure;
+	pDevice->setLEDCurrentsFct = setLEDCurrents;
 	pDevice->readFIFOFct = readFIFO;
 }
 
-esp_err_t softReset() {
-	esp_err_t res = max3010x_readModifyWriteRegister(MAX30100_REG_MODECONFIG, ~MAX30100_MODECONFIG_RESET, MAX30100_MODECONFIG_RESET);
+esp_err_t softReset(struct Max3010xDevice_t* pDevice) {
+	esp_err_t res = max3010x_readModifyWriteRegister(pDevice, MAX30100_REG_MODECONFIG, ~MAX30100_MODECONFIG_RESET, MAX30100_MODECONFIG_RESET);
 	ESP_RETURN_ON_ERROR(res, TAG, "Reset cannot be sent");
 	// Poll for bit to clear, reset is then complete
 	//todo implement a timeout
 	uint8_t status;
 	do {
-		status = max3010x_readRegister(MAX30100_REG_MODECONFIG, &res);
+		status = max3010x_readRegister(pDevice, MAX30100_REG_MODECONFIG, &res);
 		ESP_RETURN_ON_ERROR(res, TAG, PROBLEM);
 		vTaskDelay(pdMS_TO_TICKS(1));
 	} while (status & MAX30100_MODECONFIG_RESET);
+	max3010x_resetShadow(pDevice);
 	return ESP_OK;
 }
 
-// start with 100Hz sampling rate, 1600us pulse width, middle LED currents, high resolution (16 bit)
-esp_err_t setup(uint8_t mode, uint16_t samplingRate) {
+// reset, middle LED currents, interrupts and the sampling configuration
+esp_err_t setup(struct Max3010xDevice_t* pDevice, const struct Max3010xConfig_t* pConfig) {
 	// stop eventually ongoing sampling
-	ESP_RETURN_ON_ERROR(softReset(), TAG, PROBLEM);
+	ESP_RETURN_ON_ERROR(softReset(pDevice), TAG, PROBLEM);
 
+	pDevice->redLEDCurrent = MAX30100_LEDCURRENT_27_1mA;
+	pDevice->irLEDCurrent = MAX30100_LEDCURRENT_27_1mA;
+	// staged, written together with the sampling configuration
+	ESP_RETURN_ON_ERROR(max3010x_stageRegister(pDevice, MAX30100_REG_LEDCONFIG, 0x00, (pDevice->redLEDCurrent << 4) | pDevice->irLEDCurrent), TAG, PROBLEM);
+	// initialize IRQ: interrupt when the FIFO is almost full (fixed at 15 of 16 samples), none if polled
+	uint8_t intEnable = (pDevice->gpioIRQ != GPIO_NUM_NC) ? MAX30100_INT_AFULL : 0x00;
+	ESP_RETURN_ON_ERROR(max3010x_stageRegister(pDevice, MAX30100_REG_INTERRUPTENABLE, 0x00, intEnable), TAG, PROBLEM);
+	ESP_RETURN_ON_ERROR(configure(pDevice, pConfig), TAG, PROBLEM);
+	// clear interrupt status, releases the INT line
+	esp_err_t res;
+	max3010x_readRegister(pDevice, MAX30100_REG_INTERRUPTSTATUS, &res);
+	ESP_RETURN_ON_ERROR(res, TAG, PROBLEM);
+	return ESP_OK;
+}
+
+esp_err_t checkConfig(struct Max3010xDevice_t* pDevice, struct Max3010xConfig_t* pConfig, struct FifoFormat_t* pFormat) {
+	int8_t rateIndex = indexOf(gSamplingRates, sizeof(gSamplingRates) / sizeof(gSamplingRates[0]), pConfig->samplingRate);
+	ESP_RETURN_ON_FALSE(rateIndex >= 0, ESP_ERR_INVALID_ARG, TAG, "Sampling rate %d Hz not supported", pConfig->samplingRate);
+	int8_t maxPulseWidthIndex = (pConfig->mode == MAX3010X_MODE_HR_ONLY) ? gMaxPulseWidthHR[rateIndex] : gMaxPulseWidthSpO2[rateIndex];
+	if (pConfig->pulseWidth_us == 0) {
+		pConfig->pulseWidth_us = gPulseWidths_us[maxPulseWidthIndex];
+	}
+	int8_t pulseWidthIndex = indexOf(gPulseWidths_us, sizeof(gPulseWidths_us) / sizeof(gPulseWidths_us[0]), pConfig->pulseWidth_us);
+	ESP_RETURN_ON_FALSE((pulseWidthIndex >= 0) && (pulseWidthIndex <= maxPulseWidthIndex), ESP_ERR_INVALID_ARG, TAG, "Pulse width %d us not possible at %d Hz", pConfig->pulseWidth_us, pConfig->samplingRate);
+	// neither averaging nor ADC range
+	if (pConfig->averaging == 0) {
+		pConfig->averaging = 1;
+	}
+	ESP_RETURN_ON_FALSE((pConfig->averaging == 1) && (pConfig->adcRange_nA == 0), ESP_ERR_INVALID_ARG, TAG, "Averaging and ADC range not supported");
+	// the FIFO always holds IR and red (zero in heart rate mode)
+	ESP_RETURN_ON_FALSE(fifodecoder_initFormat(pFormat, MAX3010X_PARTID_MAX30100, 2, 13 + pulseWidthIndex), ESP_ERR_INVALID_ARG, TAG, "Unsupported FIFO format");
+	pFormat->irSlot = 0;
+	pFormat->redSlot = 1;
+	return ESP_OK;
+}
+
+// sampling registers only, without reset: the FIFO is cleared, its samples may have another layout
+esp_err_t configure(struct Max3010xDevice_t* pDevice, const struct Max3010xConfig_t* pConfig) {
+	uint8_t rateIndex = indexOf(gSamplingRates, sizeof(gSamplingRates) / sizeof(gSamplingRates[0]), pConfig->samplingRate);
+	uint8_t pulseWidthIndex = indexOf(gPulseWidths_us, sizeof(gPulseWidths_us) / sizeof(gPulseWidths_us[0]), pConfig->pulseWidth_us);
+	// high resolution: 16 bit at 1600us pulse width
+	uint8_t hiRes = (pulseWidthIndex == MAX30100_LEDPULSEWIDTH_1600us_ADC16) ? MAX30100_SPO2CONFIG_HIRESEN : 0;
+	// mode and SpO2 configuration are consecutive: one burst (together with other staged registers)
+	ESP_RETURN_ON_ERROR(max3010x_stageRegister(pDevice, MAX30100_REG_MODECONFIG, 0xF8, pConfig->mode), TAG, PROBLEM);
+	ESP_RETURN_ON_ERROR(max3010x_stageRegister(pDevice, MAX30100_REG_SPO2CONFIG, 0xA0, hiRes | (rateIndex << 2) | pulseWidthIndex), TAG, PROBLEM);
+	ESP_RETURN_ON_ERROR(max3010x_commit(pDevice), TAG, PROBLEM);
 	// clear FIFO pointers
-	ESP_RETURN_ON_ERROR(max3010x_writeRegister(MAX30100_REG_FIFOWRPTR, 0x00), TAG, PROBLEM);
-	ESP_RETURN_ON_ERROR(max3010x_writeRegister(MAX30100_REG_FIFOOVFCTR, 0x00), TAG, PROBLEM);
-	ESP_RETURN_ON_ERROR(max3010x_writeRegister(MAX30100_REG_FIFORDPTR, 0x00), TAG, PROBLEM);
-
-	// initialize sampling
-	ESP_RETURN_ON_ERROR(max3010x_readModifyWriteRegister(MAX30100_REG_MODECONFIG, 0xF8, mode), TAG, PROBLEM);
-	assert(samplingRate == 100);
-	ESP_RETURN_ON_ERROR(max3010x_readModifyWriteRegister(MAX30100_REG_SPO2CONFIG, 0xE3, MAX30100_SAMPLINGRATE_100Hz << 2), TAG, PROBLEM);
-	ESP_RETURN_ON_ERROR(max3010x_readModifyWriteRegister(MAX30100_REG_SPO2CONFIG, 0xFC, MAX30100_LEDPULSEWIDTH_1600us_ADC16), TAG, PROBLEM);
-	max3010x_getDevice()->redLEDCurrent = MAX30100_LEDCURRENT_27_1mA;
-	max3010x_getDevice()->irLEDCurrent = MAX30100_LEDCURRENT_27_1mA;
-	ESP_RETURN_ON_ERROR(max3010x_writeRegister(MAX30100_REG_LEDCONFIG, (max3010x_getDevice()->redLEDCurrent << 4) | max3010x_getDevice()->irLEDCurrent), TAG, PROBLEM);
-	ESP_RETURN_ON_ERROR(max3010x_readModifyWriteRegister(MAX30100_REG_SPO2CONFIG, ~MAX30100_SPO2CONFIG_HIRESEN, MAX30100_SPO2CONFIG_HIRESEN), TAG, PROBLEM);
+	static const uint8_t zeros[3] = { 0x00, 0x00, 0x00 };
+	ESP_RETURN_ON_ERROR(max3010x_writeRegisters(pDevice, MAX30100_REG_FIFOWRPTR, zeros, sizeof(zeros)), TAG, PROBLEM);
 	return ESP_OK;
 }
 
-uint16_t readFIFO(uint32_t* irValues, uint32_t* redValues, uint16_t maxcnt) {
-	uint8_t reg = MAX30100_REG_FIFOWRPTR;
+esp_err_t readFIFO(struct Max3010xDevice_t* pDevice, uint32_t* irValues, uint32_t* redValues, uint16_t maxcnt, uint16_t* pCount) {
+	*pCount = 0;
+	// one transaction for the interrupt status (reading clears it) and the FIFO pointers
+	uint8_t reg = MAX30100_REG_INTERRUPTSTATUS;
 	uint8_t data[4 * 16];
-	max3010x_writeReadDevice(&reg, 1, data, 3);
-	uint16_t cnt = (data[0] - data[2]) & 0xF;
-	if (data[1]) {
+	ESP_RETURN_ON_ERROR(max3010x_writeReadDevice(pDevice, &reg, 1, data, MAX30100_REG_FIFORDPTR - MAX30100_REG_INTERRUPTSTATUS + 1), TAG, PROBLEM);
+	pDevice->fifoReadTime_us = max3010x_getTime();
+	pDevice->fifoOverflow = (data[MAX30100_REG_FIFOOVFCTR] != 0);
+	uint16_t cnt = (data[MAX30100_REG_FIFOWRPTR] - data[MAX30100_REG_FIFORDPTR]) & 0xF;
+	if (pDevice->fifoOverflow) {
 		cnt = 16;
 		printf("ALARM!!!! OVERFLOW!!!\n");
 	}
 	if (cnt > 0) {
 		cnt = MIN(cnt, maxcnt);
 
+		const struct FifoFormat_t* pFormat = &(pDevice->fifoFormat);
 		reg = MAX30100_REG_FIFODATA;
-		max3010x_writeReadDevice(&reg, 1, data, 4 * cnt);
-		for (uint8_t i = 0; i < cnt; i += 1) {
-			*irValues++ = (data[0] << 8) | data[1];
-			*redValues++ = (data[2] << 8) | data[3];
+		ESP_RETURN_ON_ERROR(max3010x_writeReadDevice(pDevice, &reg, 1, data, cnt * fifodecoder_getBytesPerSample(pFormat)), TAG, PROBLEM);
+		fifodecoder_decodeIRRed(pFormat, data, cnt, irValues, redValues);
+	}
+	*pCount = cnt;
+	return ESP_OK;
+}
+
+esp_err_t setLEDCurrents(struct Max3010xDevice_t* pDevice, uint8_t irLEDCurrent, uint8_t redLEDCurrent) {
+	return max3010x_writeRegister(pDevice, MAX30100_REG_LEDCONFIG, (redLEDCurrent << 4) | irLEDCurrent);
+}
+
+int8_t indexOf(const uint16_t* values, uint8_t count, uint16_t value) {
+	for (uint8_t i = 0; i < count; i += 1) {
+		if (values[i] == value) {
+			return i;
 		}
 	}
-	return cnt;
+	return -1;
 }
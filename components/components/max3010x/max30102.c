@@ -10,103 +10,205 @@
  * CONDITIONS OF ANY KIND, either express or implied.
  */
 
+#include <stdio.h>
+#include <sys/param.h>
+
+#include "sdkconfig.h"
 #include "esp_check.h"
+#include "freertos/task.h"
 #include "max30102.h"
 
 #define TAG		"MAX30102"
 #define PROBLEM "I2C communication problem"
 
-static esp_err_t softReset(void);
-static esp_err_t setup(uint8_t mode, uint16_t samplingRate);
-static uint16_t readFIFO(uint32_t* irValues, uint32_t* redValues, uint16_t maxcnt);
+// register values are the indices
+static const uint16_t gSamplingRates[] = { 50, 100, 200, 400, 800, 1000, 1600, 3200 };
+static const uint16_t gPulseWidths_us[] = { 69, 118, 215, 411 };		// 15..18 bit ADC resolution
+static const uint16_t gADCRanges_nA[] = { 2048, 4096, 8192, 16384 };
+// longest pulse width (index) per sampling rate, -1: rate not possible (datasheet tables 11 and 12)
+static const int8_t gMaxPulseWidthSpO2[] = { 3, 3, 3, 3, 2, 1, 0, -1 };
+static const int8_t gMaxPulseWidthHR[] = { 3, 3, 3, 3, 3, 2, 1, 0 };
+
+#define DEFAULT_ADCRANGE_nA		4096
+
+static esp_err_t softReset(struct Max3010xDevice_t* pDevice);
+static esp_err_t setup(struct Max3010xDevice_t* pDevice, const struct Max3010xConfig_t* pConfig);
+static esp_err_t checkConfig(struct Max3010xDevice_t* pDevice, struct Max3010xConfig_t* pConfig, struct FifoFormat_t* pFormat);
+static esp_err_t configure(struct Max3010xDevice_t* pDevice, const struct Max3010xConfig_t* pConfig);
+static esp_err_t setLEDCurrents(struct Max3010xDevice_t* pDevice, uint8_t irLEDCurrent, uint8_t redLEDCurrent);
+static esp_err_t readFIFO(struct Max3010xDevice_t* pDevice, uint32_t* irValues, uint32_t* redValues, uint16_t maxcnt, uint16_t* pCount);
+static esp_err_t initFifoFormat(struct Max3010xDevice_t* pDevice, uint8_t mode, uint8_t adcBits, struct FifoFormat_t* pFormat);
+static int8_t indexOf(const uint16_t* values, uint8_t count, uint16_t value);
 
 // ***** implementation *****
 void max30102_initCallbacks(struct Max3010xDevice_t* pDevice) {
+	pDevice->fifoSize = MAX30102_FIFOSIZE;
+	pDevice->minFifoAlmostFull = MAX30102_FIFOSIZE - 15;
+	pDevice->maxFifoAlmostFull = CONFIG_MAX3010X_FIFO_ALMOSTFULL;
+	pDevice->fifoAlmostFull = CONFIG_MAX3010X_FIFO_ALMOSTFULL;
+	pDevice->shadowCacheable = MAX30102_SHADOWREGS;
+	pDevice->maxLEDCurrent = 0xFF; // 51 mA
 	pDevice->softResetFct = softReset;
 	pDevice->setupFct = setup;
+	pDevice->checkConfigFct = checkConfig;
+	pDevice->configureFct = configure;
+	pDevice->setLEDCurrentsFct = setLEDCurrents;
 	pDevice->readFIFOFct = readFIFO;
 }
 
-esp_err_t softReset() {
-	esp_err_t res = max3010x_readModifyWriteRegister(MAX30102_REG_MODECONFIG, ~MAX30102_MODECONFIG_RESET, MAX30102_MODECONFIG_RESET);
+esp_err_t softReset(struct Max3010xDevice_t* pDevice) {
+	esp_err_t res = max3010x_readModifyWriteRegister(pDevice, MAX30102_REG_MODECONFIG, ~MAX30102_MODECONFIG_RESET, MAX30102_MODECONFIG_RESET);
 	ESP_RETURN_ON_ERROR(res, TAG, "Reset cannot be sent");
 	// Poll for bit to clear, reset is then complete
 	//todo implement a timeout
 	uint8_t status;
 	do {
-		status = max3010x_readRegister(MAX30102_REG_MODECONFIG, &res);
+		status = max3010x_readRegister(pDevice, MAX30102_REG_MODECONFIG, &res);
 		ESP_RETURN_ON_ERROR(res, TAG, PROBLEM);
 		vTaskDelay(pdMS_TO_TICKS(1));
 	} while (status & MAX30102_MODECONFIG_RESET);
+	max3010x_resetShadow(pDevice);
 	return ESP_OK;
 }
 
-// start with 100Hz sampling rate, 1600us pulse width, middle LED currents, high resolution (16 bit)
-esp_err_t setup(uint8_t mode, uint16_t samplingRate) {
+// reset, middle LED currents, interrupts and the sampling configuration
+esp_err_t setup(struct Max3010xDevice_t* pDevice, const struct Max3010xConfig_t* pConfig) {
 	// stop eventually ongoing sampling
-	ESP_RETURN_ON_ERROR(softReset(), TAG, "Reset failed");
+	ESP_RETURN_ON_ERROR(softReset(pDevice), TAG, "Reset failed");
 
-	// clear FIFO pointers
-	ESP_RETURN_ON_ERROR(max3010x_writeRegister(MAX30102_REG_FIFOWRPTR, 0x00), TAG, PROBLEM);
-	ESP_RETURN_ON_ERROR(max3010x_writeRegister(MAX30102_REG_FIFOOVFCTR, 0x00), TAG, PROBLEM);
-	ESP_RETURN_ON_ERROR(max3010x_writeRegister(MAX30102_REG_FIFORDPTR, 0x00), TAG, PROBLEM);
-
-	// initialize sampling
-	// 800Hz, 8-times averaged -> 100 Hz samples
-//	max3010x_readModifyWriteRegister(MAX30102_REG_FIFOCONFIG, 0x00, MAX30102_FIFOCONFIG_SMPAVE8);
-//	max3010x_writeRegister(MAX30102_REG_SPO2CONFIG, MAX30102_SPO2CONFIG_SAMPLERATE_800 | MAX30102_SPO2CONFIG_LEDPW_215us_ADC17bit | MAX30102_SPO2CONFIG_ADCRGE_11);
-	ESP_RETURN_ON_ERROR(max3010x_readModifyWriteRegister(MAX30102_REG_FIFOCONFIG, 0x00, MAX30102_FIFOCONFIG_SMPAVENONE | 0x0F), TAG, PROBLEM); // almost full: 17, no averaging
-	ESP_RETURN_ON_ERROR(max3010x_writeRegister(MAX30102_REG_SPO2CONFIG, MAX30102_SPO2CONFIG_SAMPLERATE_100 | MAX30102_SPO2CONFIG_LEDPW_411us_ADC18bit | MAX30102_SPO2CONFIG_ADCRGE_01), TAG, PROBLEM);
-	ESP_RETURN_ON_ERROR(max3010x_readModifyWriteRegister(MAX30102_REG_MODECONFIG, 0xF8, mode), TAG, PROBLEM);
-	assert(samplingRate == 100);
-	max3010x_getDevice()->redLEDCurrent = MAX30102_LEDCURRENT_uA_TO_REGVAL(7200); // 7,2 mA
-	max3010x_getDevice()->irLEDCurrent = MAX30102_LEDCURRENT_uA_TO_REGVAL(7200); // 7,2 mA
-	ESP_RETURN_ON_ERROR(max3010x_writeRegister(MAX30102_REG_LEDPULSEAMP1, max3010x_getDevice()->redLEDCurrent), TAG, PROBLEM);
-	ESP_RETURN_ON_ERROR(max3010x_writeRegister(MAX30102_REG_LEDPULSEAMP2, max3010x_getDevice()->irLEDCurrent), TAG, PROBLEM);
-	ESP_RETURN_ON_ERROR(max3010x_writeRegister(MAX30102_REG_PILOTPA, MAX30102_LEDCURRENT_uA_TO_REGVAL(25400)), TAG, PROBLEM); // 25,4 mA for Pilot LED
-	// clear interrupt status
-	esp_err_t res;
-	uint8_t intStatus = max3010x_readRegister(MAX30102_REG_INTERRUPTSTATUS1, &res);
-	ESP_RETURN_ON_ERROR(res, TAG, PROBLEM);
-	printf("Setup intstatus1 %02X\n", intStatus);
-	// initialize IRQ: interrupt when new data is available
-	//max3010x_writeRegister(MAX30102_REG_INTERRUPTENABLE1, MAX30102_INT1_AFULL);
-	//max3010x_writeRegister(MAX30102_REG_INTERRUPTENABLE2, 0x00);
+	// staged, written together with the sampling configuration
+	pDevice->redLEDCurrent = MAX30102_LEDCURRENT_uA_TO_REGVAL(7200); // 7,2 mA
+	pDevice->irLEDCurrent = MAX30102_LEDCURRENT_uA_TO_REGVAL(7200); // 7,2 mA
+	ESP_RETURN_ON_ERROR(max3010x_stageRegister(pDevice, MAX30102_REG_LEDPULSEAMP1, 0x00, pDevice->redLEDCurrent), TAG, PROBLEM);
+	ESP_RETURN_ON_ERROR(max3010x_stageRegister(pDevice, MAX30102_REG_LEDPULSEAMP2, 0x00, pDevice->irLEDCurrent), TAG, PROBLEM);
+	ESP_RETURN_ON_ERROR(max3010x_stageRegister(pDevice, MAX30102_REG_PILOTPA, 0x00, MAX30102_LEDCURRENT_uA_TO_REGVAL(25400)), TAG, PROBLEM); // 25,4 mA for Pilot LED
+	// initialize IRQ: interrupt when the FIFO is almost full, none if polled
+	uint8_t intEnable = (pDevice->gpioIRQ != GPIO_NUM_NC) ? MAX30102_INT1_AFULL : 0x00;
+	ESP_RETURN_ON_ERROR(max3010x_stageRegister(pDevice, MAX30102_REG_INTERRUPTENABLE1, 0x00, intEnable), TAG, PROBLEM);
+	ESP_RETURN_ON_ERROR(max3010x_stageRegister(pDevice, MAX30102_REG_INTERRUPTENABLE2, 0x00, 0x00), TAG, PROBLEM);
+	ESP_RETURN_ON_ERROR(configure(pDevice, pConfig), TAG, PROBLEM);
+	// clear interrupt status (power ready after the reset) in one read, releases the INT line
+	uint8_t reg = MAX30102_REG_INTERRUPTSTATUS1;
+	uint8_t status[2];
+	ESP_RETURN_ON_ERROR(max3010x_writeReadDevice(pDevice, &reg, 1, status, sizeof(status)), TAG, PROBLEM);
 	return ESP_OK;
 }
 
-uint16_t readFIFO(uint32_t* irValues, uint32_t* redValues, uint16_t maxcnt) {
-//	// clear interrupt status
-//	uint8_t intStatus = max3010x_readRegister(MAX30102_REG_INTERRUPTSTATUS1);
-//	intStatus = max3010x_readRegister(MAX30102_REG_INTERRUPTSTATUS2);
+esp_err_t checkConfig(struct Max3010xDevice_t* pDevice, struct Max3010xConfig_t* pConfig, struct FifoFormat_t* pFormat) {
+	int8_t rateIndex = indexOf(gSamplingRates, sizeof(gSamplingRates) / sizeof(gSamplingRates[0]), pConfig->samplingRate);
+	ESP_RETURN_ON_FALSE(rateIndex >= 0, ESP_ERR_INVALID_ARG, TAG, "Sampling rate %d Hz not supported", pConfig->samplingRate);
+	// one LED in heart rate mode, two (or more) otherwise
+	int8_t maxPulseWidthIndex = (pConfig->mode == MAX30102_MODECONFIG_HEARTRATEMODE) ? gMaxPulseWidthHR[rateIndex] : gMaxPulseWidthSpO2[rateIndex];
+	ESP_RETURN_ON_FALSE(maxPulseWidthIndex >= 0, ESP_ERR_INVALID_ARG, TAG, "Sampling rate %d Hz not possible in mode %d", pConfig->samplingRate, pConfig->mode);
+	if (pConfig->pulseWidth_us == 0) {
+		pConfig->pulseWidth_us = gPulseWidths_us[maxPulseWidthIndex];
+	}
+	int8_t pulseWidthIndex = indexOf(gPulseWidths_us, sizeof(gPulseWidths_us) / sizeof(gPulseWidths_us[0]), pConfig->pulseWidth_us);
+	ESP_RETURN_ON_FALSE((pulseWidthIndex >= 0) && (pulseWidthIndex <= maxPulseWidthIndex), ESP_ERR_INVALID_ARG, TAG, "Pulse width %d us not possible at %d Hz", pConfig->pulseWidth_us, pConfig->samplingRate);
+	if (pConfig->adcRange_nA == 0) {
+		pConfig->adcRange_nA = DEFAULT_ADCRANGE_nA;
+	}
+	ESP_RETURN_ON_FALSE(indexOf(gADCRanges_nA, sizeof(gADCRanges_nA) / sizeof(gADCRanges_nA[0]), pConfig->adcRange_nA) >= 0, ESP_ERR_INVALID_ARG, TAG, "ADC range %d nA not supported", pConfig->adcRange_nA);
+	if (pConfig->averaging == 0) {
+		pConfig->averaging = 1;
+	}
+	ESP_RETURN_ON_FALSE((pConfig->averaging <= 32) && ((pConfig->averaging & (pConfig->averaging - 1)) == 0), ESP_ERR_INVALID_ARG, TAG, "Averaging of %d samples not supported", pConfig->averaging);
+	ESP_RETURN_ON_ERROR(initFifoFormat(pDevice, pConfig->mode, 15 + pulseWidthIndex, pFormat), TAG, "Unsupported FIFO format");
+	return ESP_OK;
+}
 
-	uint8_t reg = MAX30102_REG_FIFOWRPTR;
-	uint8_t data[6 * MAX30102_FIFOSIZE];
-	max3010x_writeReadDevice(&reg, 1, data, 3);
-	uint16_t cnt = (data[0] - data[2]) & 0x1F;
-	if (data[1]) {
+// sampling registers only, without reset: the FIFO is cleared, its samples may have another layout
+esp_err_t configure(struct Max3010xDevice_t* pDevice, const struct Max3010xConfig_t* pConfig) {
+	uint8_t rateIndex = indexOf(gSamplingRates, sizeof(gSamplingRates) / sizeof(gSamplingRates[0]), pConfig->samplingRate);
+	uint8_t pulseWidthIndex = indexOf(gPulseWidths_us, sizeof(gPulseWidths_us) / sizeof(gPulseWidths_us[0]), pConfig->pulseWidth_us);
+	uint8_t rangeIndex = indexOf(gADCRanges_nA, sizeof(gADCRanges_nA) / sizeof(gADCRanges_nA[0]), pConfig->adcRange_nA);
+	uint8_t averagingIndex = 0;
+	while ((1 << averagingIndex) < pConfig->averaging) {
+		averagingIndex += 1;
+	}
+	// FIFO, mode and SpO2 configuration are consecutive: one burst (together with other staged registers)
+	ESP_RETURN_ON_ERROR(max3010x_stageRegister(pDevice, MAX30102_REG_FIFOCONFIG, 0x00, (averagingIndex << 5) | MAX30102_FIFOCONFIG_AFULL(pDevice->fifoAlmostFull)), TAG, PROBLEM);
+	ESP_RETURN_ON_ERROR(max3010x_stageRegister(pDevice, MAX30102_REG_MODECONFIG, 0xF8, pConfig->mode), TAG, PROBLEM);
+	ESP_RETURN_ON_ERROR(max3010x_stageRegister(pDevice, MAX30102_REG_SPO2CONFIG, 0x80, (rangeIndex << 5) | (rateIndex << 2) | pulseWidthIndex), TAG, PROBLEM);
+	ESP_RETURN_ON_ERROR(max3010x_commit(pDevice), TAG, PROBLEM);
+	// clear FIFO pointers
+	static const uint8_t zeros[3] = { 0x00, 0x00, 0x00 };
+	ESP_RETURN_ON_ERROR(max3010x_writeRegisters(pDevice, MAX30102_REG_FIFOWRPTR, zeros, sizeof(zeros)), TAG, PROBLEM);
+	return ESP_OK;
+}
+
+esp_err_t readFIFO(struct Max3010xDevice_t* pDevice, uint32_t* irValues, uint32_t* redValues, uint16_t maxcnt, uint16_t* pCount) {
+	*pCount = 0;
+	// one transaction for the interrupt status (reading clears it and releases the INT line) and the FIFO
+	// pointers: 0x00 status 1, 0x01 status 2, 0x02, 0x03 enables, 0x04 write pointer, 0x05 overflow, 0x06 read pointer
+	uint8_t reg = MAX30102_REG_INTERRUPTSTATUS1;
+	uint8_t data[3 * FIFODECODER_MAXSLOTS * MAX30102_FIFOSIZE];
+	ESP_RETURN_ON_ERROR(max3010x_writeReadDevice(pDevice, &reg, 1, data, MAX30102_REG_FIFORDPTR - MAX30102_REG_INTERRUPTSTATUS1 + 1), TAG, PROBLEM);
+	pDevice->fifoReadTime_us = max3010x_getTime();
+	pDevice->fifoOverflow = (data[MAX30102_REG_FIFOOVFCTR] != 0);
+	uint16_t cnt = (data[MAX30102_REG_FIFOWRPTR] - data[MAX30102_REG_FIFORDPTR]) & 0x1F;
+	if (pDevice->fifoOverflow) {
 		cnt = 32;
 		printf("ALARM!!!! OVERFLOW!!!\n");
 	}
 	if (cnt > 0) {
 		cnt = MIN(cnt, maxcnt);
 
+		// all samples in one burst, the read pointer advances automatically
+		const struct FifoFormat_t* pFormat = &(pDevice->fifoFormat);
 		reg = MAX30102_REG_FIFODATA;
-		max3010x_writeReadDevice(&reg, 1, data, 6 * cnt);
-		for (uint8_t i = 0; i < cnt; i += 1) {
-			uint32_t val = data[0 + i * 6];
-			val <<= 8;
-			val |= data[1 + i * 6];
-			val <<= 8;
-			val |= data[2 + i * 6];
-			*redValues++ = val & 0x0003FFFF;
-			val = data[3];
-			val <<= 8;
-			val |= data[4 + i * 6];
-			val <<= 8;
-			val |= data[5 + i * 6];
-			*irValues++ = val & 0x0003FFFF;
+		ESP_RETURN_ON_ERROR(max3010x_writeReadDevice(pDevice, &reg, 1, data, cnt * fifodecoder_getBytesPerSample(pFormat)), TAG, PROBLEM);
+		fifodecoder_decodeIRRed(pFormat, data, cnt, irValues, redValues);
+	}
+	*pCount = cnt;
+	return ESP_OK;
+}
+
+// heart rate mode: red only, SpO2 mode: red and IR, multi-LED mode: the slots configured in MULTILEDCTRL
+esp_err_t initFifoFormat(struct Max3010xDevice_t* pDevice, uint8_t mode, uint8_t adcBits, struct FifoFormat_t* pFormat) {
+	uint8_t slots[FIFODECODER_MAXSLOTS] = { MAX30102_MULTILEDCTRL_SLOT_RED, MAX30102_MULTILEDCTRL_SLOT_IR, 0, 0 };
+	uint8_t slotCount = (mode == MAX30102_MODECONFIG_HEARTRATEMODE) ? 1 : 2;
+	if (mode == MAX30102_MODECONFIG_MULTILEDMODE) {
+		esp_err_t res;
+		uint8_t ctrl12 = max3010x_readCachedRegister(pDevice, MAX30102_REG_MULTILEDCTRL12, &res);
+		ESP_RETURN_ON_ERROR(res, TAG, PROBLEM);
+		uint8_t ctrl34 = max3010x_readCachedRegister(pDevice, MAX30102_REG_MULTILEDCTRL34, &res);
+		ESP_RETURN_ON_ERROR(res, TAG, PROBLEM);
+		slots[0] = ctrl12 & 0x07;
+		slots[1] = (ctrl12 >> 4) & 0x07;
+		slots[2] = ctrl34 & 0x07;
+		slots[3] = (ctrl34 >> 4) & 0x07;
+		// the active slots are contiguous, the first disabled one ends the sample
+		slotCount = 0;
+		while ((slotCount < FIFODECODER_MAXSLOTS) && (slots[slotCount] != 0)) {
+			slotCount += 1;
+		}
+	}
+	if (!fifodecoder_initFormat(pFormat, MAX3010X_PARTID_MAX30102, slotCount, adcBits)) {
+		return ESP_ERR_INVALID_ARG;
+	}
+	for (int8_t i = slotCount - 1; i >= 0; i -= 1) {
+		if (slots[i] == MAX30102_MULTILEDCTRL_SLOT_RED) {
+			pFormat->redSlot = i;
+		} else if (slots[i] == MAX30102_MULTILEDCTRL_SLOT_IR) {
+			pFormat->irSlot = i;
+		}
+	}
+	return ESP_OK;
+}
+
+// LED1 (red) and LED2 (IR) are consecutive: one burst
+esp_err_t setLEDCurrents(struct Max3010xDevice_t* pDevice, uint8_t irLEDCurrent, uint8_t redLEDCurrent) {
+	ESP_RETURN_ON_ERROR(max3010x_stageRegister(pDevice, MAX30102_REG_LEDPULSEAMP1, 0x00, redLEDCurrent), TAG, PROBLEM);
+	ESP_RETURN_ON_ERROR(max3010x_stageRegister(pDevice, MAX30102_REG_LEDPULSEAMP2, 0x00, irLEDCurrent), TAG, PROBLEM);
+	return max3010x_commit(pDevice);
+}
+
+int8_t indexOf(const uint16_t* values, uint8_t count, uint16_t value) {
+	for (uint8_t i = 0; i < count; i += 1) {
+		if (values[i] == value) {
+			return i;
 		}
 	}
-	return cnt;
+	return -1;
 }
@@ -10,51 +10,450 @@
  * CONDITIONS OF ANY KIND, either express or implied.
  */
 
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+
 #include "esp_log.h"
-#include "driver/gpio.h"
 #include "esp_check.h"
+#include "esp_timer.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
 
 #include "max30100.h"
 #include "max30102.h"
 #include "max3010x.h"
+#include "max3010xsim.h"
+#if (CONFIG_MAX3010X_SIMULATION != 1)
+#include "i2carbiter.h"
+#endif
 
 #define TAG			"MAX3010x"
 #define PROBLEM 	"I2C communication problem"
 
-static struct Max3010xDevice_t gDevice = { 0 };
-static Max3010x_DataAvailableCallback_t gDataAvailableCB;
 
+#define ACQUISITION_TASK_STACKSIZE	3072
+#define ACQUISITION_TASK_PRIORITY	4		// above the processing tasks: the FIFO must not overflow
+#define ACQUISITION_POLLPERIOD_ms	10		// in the time of the sensor
+#define ACQUISITION_RETRY_ms		500		// a device that failed is skipped meanwhile, its timeouts don't delay the others
+
+// auto gain control: the DC level is kept between AGC_LOW and AGC_HIGH percent of the ADC full scale
+#define AGC_LOW_PERCENT				25
+#define AGC_TARGET_PERCENT			50
+#define AGC_HIGH_PERCENT			75
+#define AGC_NOFINGER_PERCENT		2		// below: nothing on the sensor, the current is kept
+
+// sample clock tracking: per burst the phase is corrected by 1/PHASE, the period by 1/FREQUENCY of the error
+// (critically damped: FREQUENCY = PHASE^2 * 4)
+#define CLOCK_PHASE_DIVIDER			16
+#define CLOCK_FREQUENCY_DIVIDER		1024
+#define CLOCK_RESYNC_PERIODS		4		// larger errors: samples lost or the read was late, restart from the observation
+#define CLOCK_MAXDEVIATION_PERCENT	5		// oscillator tolerance of the part
+
+#if CONFIG_IDF_TARGET_LINUX && (CONFIG_MAX3010X_SIMULATION != 1)
+#error "the linux target requires CONFIG_MAX3010X_SIMULATION"
+#endif
+
+#if (CONFIG_MAX3010X_SIMULATION == 1)
+// the simulated sensor runs CONFIG_MAX3010X_SIMULATION_TIMELAPSE times faster: poll as often in its time, at least every tick
+#define ACQUISITION_TIMELAPSE		CONFIG_MAX3010X_SIMULATION_TIMELAPSE
+#else
+#define ACQUISITION_TIMELAPSE		1
+#endif
+#define ACQUISITION_POLLTICKS		MAX(pdMS_TO_TICKS(ACQUISITION_POLLPERIOD_ms) / ACQUISITION_TIMELAPSE, 1)
+
+struct Max3010xMux_t {
+	i2c_port_t i2cPort;
+	uint8_t address;
+	int8_t selectedChannel;		// -1: unknown, the devices hold the bus from the selection until the end of the transfer
+};
+
+static struct Max3010xDevice_t* gDefaultDevice = NULL;
+static struct Max3010xDevice_t* gDevices[MAX3010X_MAXDEVICES];
+static volatile uint8_t gDeviceCount = 0;
+static struct Max3010xMux_t gMuxes[MAX3010X_MAXDEVICES];
+static uint8_t gMuxCount = 0;
+static TaskHandle_t gAcquisitionTaskHandle = NULL;
+
+// internal prototypes
+#if !CONFIG_IDF_TARGET_LINUX
 static void IRAM_ATTR gpioISR(void* arg);
+#endif
+static struct Max3010xDevice_t* getDevice(struct Max3010xDevice_t* pDevice);
+static esp_err_t attachMux(struct Max3010xDevice_t* pDevice);
+static esp_err_t identifyDevice(struct Max3010xDevice_t* pDevice);
+static esp_err_t initIRQ(struct Max3010xDevice_t* pDevice);
+static esp_err_t selectChannel(struct Max3010xDevice_t* pDevice);
+static void releaseChannel(struct Max3010xDevice_t* pDevice);
+static void acquireBus(struct Max3010xDevice_t* pDevice);
+static void releaseBus(struct Max3010xDevice_t* pDevice);
+static void acquisitionTaskMainFunc(void* pvParameters);
+static TickType_t getReadInterval(struct Max3010xDevice_t* pDevice);
+static TickType_t getWaitTime(void);
+static void serveDevice(struct Max3010xDevice_t* pDevice);
+static void timestampBurst(struct Max3010xDevice_t* pDevice, struct Max3010xBurst_t* pBurst, int64_t irqTime_us);
+static uint32_t getNominalPeriod(const struct Max3010xConfig_t* pConfig);
+static esp_err_t checkConfig(struct Max3010xDevice_t* pDevice, struct Max3010xConfig_t* pConfig, struct FifoFormat_t* pFormat, uint8_t* pAlmostFull, bool* pPolled);
+static esp_err_t applyConfig(struct Max3010xDevice_t* pDevice, const struct Max3010xConfig_t* pConfig, ConfigureFct_t configureFct);
+static bool isCacheable(const struct Max3010xDevice_t* pDevice, uint8_t reg);
+static void updateAGC(struct Max3010xDevice_t* pDevice, struct Max3010xBurst_t* pBurst);
+static uint8_t adjustLEDCurrent(uint8_t current, const uint32_t* values, uint16_t count, uint32_t fullScale, uint8_t maxCurrent);
 
 
 // Note: callback will be called from interrupt context!
 // if no IRQ line is connected, use GPIO_NUM_NC as gpioIRQ
 esp_err_t max3010x_init(i2c_port_t i2cPort, gpio_num_t gpioIRQ, Max3010x_DataAvailableCallback_t dataAvailableCB) {
-	gDevice.i2cPort = i2cPort;
-	gDataAvailableCB = dataAvailableCB;
+	struct Max3010xBus_t bus = {
+			.i2cPort = i2cPort,
+			.muxAddress = MAX3010X_NOMUX,
+			.muxChannel = 0
+	};
+	return max3010x_createDevice(&bus, gpioIRQ, dataAvailableCB, &gDefaultDevice);
+}
+
+esp_err_t max3010x_createDevice(const struct Max3010xBus_t* pBus, gpio_num_t gpioIRQ, Max3010x_DataAvailableCallback_t dataAvailableCB, struct Max3010xDevice_t** ppDevice) {
+#if (CONFIG_MAX3010X_SIMULATION == 1)
+	// one simulated sensor for all handles, it has no INT line
+	if (gDeviceCount == 0) {
+		max3010xsim_init();
+	}
+	gpioIRQ = GPIO_NUM_NC;
+#endif
+	ESP_RETURN_ON_FALSE(gDeviceCount < MAX3010X_MAXDEVICES, ESP_ERR_NO_MEM, TAG, "More than %d devices", MAX3010X_MAXDEVICES);
+	struct Max3010xDevice_t* pDevice = calloc(1, sizeof(struct Max3010xDevice_t));
+	ESP_RETURN_ON_FALSE(pDevice != NULL, ESP_ERR_NO_MEM, TAG, "Cannot allocate device");
+	pDevice->bus = *pBus;
+	pDevice->gpioIRQ = gpioIRQ;
+	pDevice->polled = (gpioIRQ == GPIO_NUM_NC);
+	pDevice->dataAvailableCB = dataAvailableCB;
+	pDevice->mutex = xSemaphoreCreateMutex();
+	esp_err_t res = (pDevice->mutex != NULL) ? ESP_OK : ESP_ERR_NO_MEM;
+#if (CONFIG_MAX3010X_SIMULATION != 1)
+	if (res == ESP_OK) {
+		// FIFO reads have a deadline: the sensors get the bus before other clients (e.g. the display)
+		pDevice->pBusClient = i2carbiter_createClient(pBus->i2cPort, "max3010x", I2CARBITER_PRIORITY_HIGH);
+		res = (pDevice->pBusClient != NULL) ? ESP_OK : ESP_ERR_NO_MEM;
+	}
+#endif
+	if ((res == ESP_OK) && (pBus->muxAddress != MAX3010X_NOMUX)) {
+		res = attachMux(pDevice);
+	}
+	if (res == ESP_OK) {
+		res = identifyDevice(pDevice);
+	}
+	if (res == ESP_OK) {
+		res = initIRQ(pDevice);
+	}
+	if (res != ESP_OK) {
+		if (pDevice->mutex != NULL) {
+			vSemaphoreDelete(pDevice->mutex);
+		}
+#if (CONFIG_MAX3010X_SIMULATION != 1)
+		if (pDevice->pBusClient != NULL) {
+			i2carbiter_destroyClient(pDevice->pBusClient);
+		}
+#endif
+		free(pDevice);
+		return res;
+	}
+	gDevices[gDeviceCount] = pDevice;
+	gDeviceCount += 1;
+	*ppDevice = pDevice;
+	return ESP_OK;
+}
+
+struct Max3010xDevice_t* max3010x_getDevice() {
+	return gDefaultDevice;
+}
+
+const char* max3010x_getDeviceName(const struct Max3010xDevice_t* pDevice) {
+	if (pDevice != NULL) {
+		switch (pDevice->partID) {
+			case MAX3010X_PARTID_MAX30100:
+				return "MAX30100";
+			case MAX3010X_PARTID_MAX30102:
+				return "MAX30102";
+			default:
+				return "Unknown";
+		}
+	}
+	return NULL;
+}
+
+esp_err_t max3010x_writeReadDevice(struct Max3010xDevice_t* pDevice, const uint8_t* write_buffer, size_t write_size, uint8_t* read_buffer, size_t read_size) {
+	esp_err_t res = selectChannel(pDevice);
+	if (res == ESP_OK) {
+#if (CONFIG_MAX3010X_SIMULATION == 1)
+		res = max3010xsim_writeRead(write_buffer, write_size, read_buffer, read_size);
+#else
+		res = i2c_master_write_read_device(pDevice->bus.i2cPort, MAX3010X_I2C_ADDR, write_buffer, write_size, read_buffer, read_size, pdMS_TO_TICKS(MAX3010X_I2C_TIMEOUT_ms));
+#endif
+	}
+	releaseChannel(pDevice);
+	return res;
+}
+
+uint8_t max3010x_readRegister(struct Max3010xDevice_t* pDevice, uint8_t reg, esp_err_t* pRes) {
+	uint8_t data;
+	*pRes = max3010x_writeReadDevice(pDevice, &reg, 1, &data, 1);
+	return data;
+}
+
+uint8_t max3010x_readCachedRegister(struct Max3010xDevice_t* pDevice, uint8_t reg, esp_err_t* pRes) {
+	if (!isCacheable(pDevice, reg)) {
+		return max3010x_readRegister(pDevice, reg, pRes);
+	}
+	if (!(pDevice->shadowValid & (1ULL << reg))) {
+		uint8_t value = max3010x_readRegister(pDevice, reg, pRes);
+		if (*pRes != ESP_OK) {
+			return value;
+		}
+		pDevice->shadow[reg] = value;
+		pDevice->shadowValid |= (1ULL << reg);
+	}
+	*pRes = ESP_OK;
+	return pDevice->shadow[reg];
+}
+
+esp_err_t max3010x_writeRegister(struct Max3010xDevice_t* pDevice, uint8_t reg, uint8_t value) {
+	return max3010x_writeRegisters(pDevice, reg, &value, 1);
+}
+
+esp_err_t max3010x_writeRegisters(struct Max3010xDevice_t* pDevice, uint8_t reg, const uint8_t* values, uint8_t count) {
+	assert(count <= MAX3010X_SHADOWSIZE);
+	uint8_t buf[1 + MAX3010X_SHADOWSIZE];
+	buf[0] = reg;
+	memcpy(buf + 1, values, count);
+	esp_err_t res = selectChannel(pDevice);
+	if (res == ESP_OK) {
+#if (CONFIG_MAX3010X_SIMULATION == 1)
+		res = max3010xsim_write(buf, count + 1);
+#else
+		res = i2c_master_write_to_device(pDevice->bus.i2cPort, MAX3010X_I2C_ADDR, buf, count + 1, pdMS_TO_TICKS(MAX3010X_I2C_TIMEOUT_ms));
+#endif
+	}
+	releaseChannel(pDevice);
+	if (res == ESP_OK) {
+		for (uint8_t i = 0; i < count; i += 1) {
+			if (isCacheable(pDevice, reg + i)) {
+				pDevice->shadow[reg + i] = buf[1 + i];
+				pDevice->shadowValid |= (1ULL << (reg + i));
+				pDevice->shadowDirty &= ~(1ULL << (reg + i));
+			}
+		}
+	}
+	return res;
+}
+
+esp_err_t max3010x_readModifyWriteRegister(struct Max3010xDevice_t* pDevice, uint8_t reg, uint8_t mask, uint8_t value) {
+	esp_err_t res;
+	uint8_t current = max3010x_readCachedRegister(pDevice, reg, &res);
+	ESP_RETURN_ON_ERROR(res, TAG, PROBLEM);
+	return max3010x_writeRegister(pDevice, reg, (current & mask) | value);
+}
+
+esp_err_t max3010x_stageRegister(struct Max3010xDevice_t* pDevice, uint8_t reg, uint8_t mask, uint8_t value) {
+	ESP_RETURN_ON_FALSE(isCacheable(pDevice, reg), ESP_ERR_INVALID_ARG, TAG, "Register %02X not cacheable", reg);
+	esp_err_t res;
+	uint8_t current = max3010x_readCachedRegister(pDevice, reg, &res);
+	ESP_RETURN_ON_ERROR(res, TAG, PROBLEM);
+	pDevice->shadow[reg] = (current & mask) | value;
+	pDevice->shadowDirty |= (1ULL << reg);
+	return ESP_OK;
+}
+
+esp_err_t max3010x_commit(struct Max3010xDevice_t* pDevice) {
+	uint8_t reg = 0;
+	while (reg < MAX3010X_SHADOWSIZE) {
+		if (!(pDevice->shadowDirty & (1ULL << reg))) {
+			reg += 1;
+			continue;
+		}
+		// the run of consecutive dirty registers in one burst
+		uint8_t count = 1;
+		while ((reg + count < MAX3010X_SHADOWSIZE) && (pDevice->shadowDirty & (1ULL << (reg + count)))) {
+			count += 1;
+		}
+		ESP_RETURN_ON_ERROR(max3010x_writeRegisters(pDevice, reg, &pDevice->shadow[reg], count), TAG, PROBLEM);
+		reg += count;
+	}
+	return ESP_OK;
+}
+
+void max3010x_resetShadow(struct Max3010xDevice_t* pDevice) {
+	memset(pDevice->shadow, 0x00, sizeof(pDevice->shadow));
+	pDevice->shadowValid = pDevice->shadowCacheable;
+	pDevice->shadowDirty = 0;
+}
+
+esp_err_t max3010x_softReset(struct Max3010xDevice_t* pDevice) {
+	pDevice = getDevice(pDevice);
+	assert(pDevice->softResetFct != NULL);
+	return pDevice->softResetFct(pDevice);
+}
+
+esp_err_t max3010x_setup(struct Max3010xDevice_t* pDevice, const struct Max3010xConfig_t* pConfig) {
+	pDevice = getDevice(pDevice);
+	assert(pDevice->setupFct != NULL);
+	return applyConfig(pDevice, pConfig, pDevice->setupFct);
+}
+
+esp_err_t max3010x_configure(struct Max3010xDevice_t* pDevice, const struct Max3010xConfig_t* pConfig) {
+	pDevice = getDevice(pDevice);
+	assert(pDevice->configureFct != NULL);
+	return applyConfig(pDevice, pConfig, pDevice->configureFct);
+}
+
+esp_err_t max3010x_checkConfig(struct Max3010xDevice_t* pDevice, const struct Max3010xConfig_t* pConfig) {
+	pDevice = getDevice(pDevice);
+	struct Max3010xConfig_t config = *pConfig;
+	struct FifoFormat_t format;
+	uint8_t almostFull;
+	bool polled;
+	xSemaphoreTake(pDevice->mutex, portMAX_DELAY);
+	esp_err_t res = checkConfig(pDevice, &config, &format, &almostFull, &polled);
+	xSemaphoreGive(pDevice->mutex);
+	return res;
+}
+
+uint16_t max3010x_getSampleRate(struct Max3010xDevice_t* pDevice) {
+	pDevice = getDevice(pDevice);
+	return pDevice->config.samplingRate / pDevice->config.averaging;
+}
+
+uint32_t max3010x_getSamplePeriod(struct Max3010xDevice_t* pDevice) {
+	return getDevice(pDevice)->samplePeriod_ns;
+}
+
+int64_t max3010x_getTime() {
+#if (CONFIG_MAX3010X_SIMULATION == 1)
+	return max3010xsim_getTime();
+#else
+	return esp_timer_get_time();
+#endif
+}
 
-	// read out part ID
+esp_err_t max3010x_setLEDCurrents(struct Max3010xDevice_t* pDevice, uint8_t irLEDCurrent, uint8_t redLEDCurrent) {
+	pDevice = getDevice(pDevice);
+	assert(pDevice->setLEDCurrentsFct != NULL);
+	ESP_RETURN_ON_FALSE((irLEDCurrent <= pDevice->maxLEDCurrent) && (redLEDCurrent <= pDevice->maxLEDCurrent), ESP_ERR_INVALID_ARG, TAG, "LED current out of range");
+	xSemaphoreTake(pDevice->mutex, portMAX_DELAY);
+	esp_err_t res = pDevice->setLEDCurrentsFct(pDevice, irLEDCurrent, redLEDCurrent);
+	if (res == ESP_OK) {
+		pDevice->irLEDCurrent = irLEDCurrent;
+		pDevice->redLEDCurrent = redLEDCurrent;
+		pDevice->agcChanged = true;
+	}
+	xSemaphoreGive(pDevice->mutex);
+	return res;
+}
+
+void max3010x_enableAGC(struct Max3010xDevice_t* pDevice, bool enable) {
+	getDevice(pDevice)->agcEnabled = enable;
+}
+
+uint16_t max3010x_readFIFO(struct Max3010xDevice_t* pDevice, uint32_t* irValues, uint32_t* redValues, uint16_t maxcnt) {
+	pDevice = getDevice(pDevice);
+	assert(pDevice->readFIFOFct != NULL);
+	uint16_t cnt = 0;
+	xSemaphoreTake(pDevice->mutex, portMAX_DELAY);
+	pDevice->readFIFOFct(pDevice, irValues, redValues, maxcnt, &cnt);
+	xSemaphoreGive(pDevice->mutex);
+	return cnt;
+}
+
+esp_err_t max3010x_startAcquisition(struct Max3010xDevice_t* pDevice) {
+	pDevice = getDevice(pDevice);
+	if (pDevice->acquiring) {
+		return ESP_ERR_INVALID_STATE;
+	}
+	pDevice->freeBurstQueue = xQueueCreate(MAX3010X_BURSTCOUNT, sizeof(struct Max3010xBurst_t*));
+	pDevice->filledBurstQueue = xQueueCreate(MAX3010X_BURSTCOUNT, sizeof(struct Max3010xBurst_t*));
+	ESP_RETURN_ON_FALSE((pDevice->freeBurstQueue != NULL) && (pDevice->filledBurstQueue != NULL), ESP_ERR_NO_MEM, TAG, "Cannot create burst queues");
+	for (uint8_t i = 0; i < MAX3010X_BURSTCOUNT; i += 1) {
+		struct Max3010xBurst_t* pBurst = &pDevice->bursts[i];
+		xQueueSend(pDevice->freeBurstQueue, &pBurst, 0);
+	}
+	if (gAcquisitionTaskHandle == NULL) {
+		xTaskCreate(acquisitionTaskMainFunc, "MAX3010X", ACQUISITION_TASK_STACKSIZE, NULL, ACQUISITION_TASK_PRIORITY, &gAcquisitionTaskHandle);
+		ESP_RETURN_ON_FALSE(gAcquisitionTaskHandle != NULL, ESP_ERR_NO_MEM, TAG, "Cannot create acquisition task");
+	}
+	pDevice->lastReadTick = xTaskGetTickCount();
+	pDevice->clockLocked = false;
+	pDevice->acquiring = true;
+	xTaskNotifyGive(gAcquisitionTaskHandle);
+	return ESP_OK;
+}
+
+const struct Max3010xBurst_t* max3010x_receiveBurst(struct Max3010xDevice_t* pDevice, TickType_t timeout) {
+	pDevice = getDevice(pDevice);
+	struct Max3010xBurst_t* pBurst;
+	if (xQueueReceive(pDevice->filledBurstQueue, &pBurst, timeout) != pdTRUE) {
+		return NULL;
+	}
+	return pBurst;
+}
+
+void max3010x_releaseBurst(struct Max3010xDevice_t* pDevice, const struct Max3010xBurst_t* pBurst) {
+	pDevice = getDevice(pDevice);
+	xQueueSend(pDevice->freeBurstQueue, &pBurst, portMAX_DELAY);
+	// the device may have been skipped for lack of a buffer
+	xTaskNotifyGive(gAcquisitionTaskHandle);
+}
+
+struct Max3010xDevice_t* getDevice(struct Max3010xDevice_t* pDevice) {
+	return (pDevice != NULL) ? pDevice : gDefaultDevice;
+}
+
+// the devices behind one multiplexer share its channel selection
+esp_err_t attachMux(struct Max3010xDevice_t* pDevice) {
+	for (uint8_t i = 0; i < gMuxCount; i += 1) {
+		if ((gMuxes[i].i2cPort == pDevice->bus.i2cPort) && (gMuxes[i].address == pDevice->bus.muxAddress)) {
+			pDevice->pMux = &gMuxes[i];
+			return ESP_OK;
+		}
+	}
+	ESP_RETURN_ON_FALSE(gMuxCount < MAX3010X_MAXDEVICES, ESP_ERR_NO_MEM, TAG, "More than %d multiplexers", MAX3010X_MAXDEVICES);
+	struct Max3010xMux_t* pMux = &gMuxes[gMuxCount];
+	pMux->i2cPort = pDevice->bus.i2cPort;
+	pMux->address = pDevice->bus.muxAddress;
+	pMux->selectedChannel = -1;
+	gMuxCount += 1;
+	pDevice->pMux = pMux;
+	return ESP_OK;
+}
+
+// read out part ID
+esp_err_t identifyDevice(struct Max3010xDevice_t* pDevice) {
 	esp_err_t res = ESP_OK;
-	gDevice.partID = max3010x_readRegister(MAX3010X_REG_PARTID, &res);
+	pDevice->partID = max3010x_readRegister(pDevice, MAX3010X_REG_PARTID, &res);
 	ESP_RETURN_ON_ERROR(res, TAG, PROBLEM);
-	gDevice.revision = max3010x_readRegister(MAX3010X_REG_REVISION, &res);
+	pDevice->revision = max3010x_readRegister(pDevice, MAX3010X_REG_REVISION, &res);
 	ESP_RETURN_ON_ERROR(res, TAG, PROBLEM);
-	switch (gDevice.partID) {
+	switch (pDevice->partID) {
 		case MAX3010X_PARTID_MAX30100:
-			ESP_LOGI(MAX3010X_TAG, "init max3010X, found MAX30100 rev %d", gDevice.revision);
-			max30100_initCallbacks(&gDevice);
+			max30100_initCallbacks(pDevice);
 			break;
 		case MAX3010X_PARTID_MAX30102:
-			ESP_LOGI(MAX3010X_TAG, "init max3010X, found MAX30102 rev %d", gDevice.revision);
-			max30102_initCallbacks(&gDevice);
+			max30102_initCallbacks(pDevice);
 			break;
 		default:
-			assert(false);
+			ESP_LOGE(TAG, "Unknown part ID %02X on port %d", pDevice->partID, pDevice->bus.i2cPort);
+			return ESP_ERR_NOT_FOUND;
 	}
-	// setup IRQ line
-	if (gpioIRQ != GPIO_NUM_NC) {
+	ESP_LOGI(MAX3010X_TAG, "init max3010X, found %s rev %d on port %d channel %d", max3010x_getDeviceName(pDevice), pDevice->revision, pDevice->bus.i2cPort,
+			(pDevice->pMux != NULL) ? pDevice->bus.muxChannel : -1);
+	return ESP_OK;
+}
+
+// setup IRQ line
+esp_err_t initIRQ(struct Max3010xDevice_t* pDevice) {
+#if !CONFIG_IDF_TARGET_LINUX
+	if (pDevice->gpioIRQ != GPIO_NUM_NC) {
 		gpio_config_t gpioIRQConfig = {
-				.pin_bit_mask = (1 << gpioIRQ),
+				.pin_bit_mask = (1ULL << pDevice->gpioIRQ),
 				.mode = GPIO_MODE_DEF_INPUT,
 				.pull_up_en = GPIO_PULLUP_ENABLE,
 				.pull_down_en = GPIO_PULLDOWN_DISABLE,
@@ -62,74 +461,281 @@ esp_err_t max3010x_init(i2c_port_t i2cPort, gpio_num_t gpioIRQ, Max3010x_DataAva
 		};
 		ESP_RETURN_ON_ERROR(gpio_config(&gpioIRQConfig), TAG, "Problem during gpio_config");
 		//hook isr handler for specific gpio pin
-		ESP_RETURN_ON_ERROR(gpio_isr_handler_add(gpioIRQ, gpioISR, NULL), TAG, "Problem during gpio_isr_handler_add");
+		ESP_RETURN_ON_ERROR(gpio_isr_handler_add(pDevice->gpioIRQ, gpioISR, pDevice), TAG, "Problem during gpio_isr_handler_add");
 	}
+#endif
 	return ESP_OK;
 }
 
-struct Max3010xDevice_t* max3010x_getDevice() {
-	return &gDevice;
+// takes the bus, the multiplexer channel is only switched if another device used it meanwhile
+esp_err_t selectChannel(struct Max3010xDevice_t* pDevice) {
+	acquireBus(pDevice);
+	struct Max3010xMux_t* pMux = pDevice->pMux;
+	if (pMux == NULL) {
+		return ESP_OK;
+	}
+	if (pMux->selectedChannel == pDevice->bus.muxChannel) {
+		return ESP_OK;
+	}
+	esp_err_t res = ESP_OK;
+#if (CONFIG_MAX3010X_SIMULATION != 1)
+	uint8_t channelMask = 1 << pDevice->bus.muxChannel;
+	res = i2c_master_write_to_device(pMux->i2cPort, pMux->address, &channelMask, 1, pdMS_TO_TICKS(MAX3010X_I2C_TIMEOUT_ms));
+#endif
+	pMux->selectedChannel = (res == ESP_OK) ? pDevice->bus.muxChannel : -1;
+	return res;
 }
 
-const char* max3010x_getDeviceName(const struct Max3010xDevice_t* pDevice) {
-	if (pDevice != NULL) {
-		switch (pDevice->partID) {
-			case MAX3010X_PARTID_MAX30100:
-				return "MAX30100";
-			case MAX3010X_PARTID_MAX30102:
-				return "MAX30102";
-			default:
-				return "Unknown";
+void releaseChannel(struct Max3010xDevice_t* pDevice) {
+	releaseBus(pDevice);
+}
+
+// recursive, the simulated sensor has no bus
+void acquireBus(struct Max3010xDevice_t* pDevice) {
+#if (CONFIG_MAX3010X_SIMULATION != 1)
+	i2carbiter_acquire(pDevice->pBusClient);
+#endif
+}
+
+void releaseBus(struct Max3010xDevice_t* pDevice) {
+#if (CONFIG_MAX3010X_SIMULATION != 1)
+	i2carbiter_release(pDevice->pBusClient);
+#endif
+}
+
+void acquisitionTaskMainFunc(void* pvParameters) {
+	uint8_t first = 0;
+	while (true) {
+		// woken by the interrupts and released buffers
+		ulTaskNotifyTake(pdTRUE, getWaitTime());
+		// round robin with one FIFO burst per device, the device served first changes every round
+		uint8_t count = gDeviceCount;
+		for (uint8_t i = 0; i < count; i += 1) {
+			serveDevice(gDevices[(first + i) % count]);
 		}
+		first = (count > 0) ? (first + 1) % count : 0;
 	}
-	return NULL;
 }
 
-esp_err_t max3010x_writeReadDevice(const uint8_t* write_buffer, size_t write_size, uint8_t* read_buffer, size_t read_size) {
-	return i2c_master_write_read_device(gDevice.i2cPort, MAX3010X_I2C_ADDR, write_buffer, write_size, read_buffer, read_size, pdMS_TO_TICKS(MAX3010X_I2C_TIMEOUT_ms));
+TickType_t getReadInterval(struct Max3010xDevice_t* pDevice) {
+	if (pDevice->polled) {
+		return ACQUISITION_POLLTICKS;
+	}
+	// a missed edge would stop the acquisition: read at the latest when the FIFO should be full twice
+	return pdMS_TO_TICKS((uint64_t)2 * pDevice->fifoAlmostFull * getNominalPeriod(&(pDevice->config)) / 1000000);
 }
 
-uint8_t max3010x_readRegister(uint8_t reg, esp_err_t* pRes) {
-	uint8_t data;
-	*pRes = max3010x_writeReadDevice(&reg, 1, &data, 1);
-	return data;
+// the poll period if any device is polled, waits for a free buffer or is retried, the shortest IRQ timeout otherwise
+TickType_t getWaitTime() {
+	TickType_t waitTime = portMAX_DELAY;
+	for (uint8_t i = 0; i < gDeviceCount; i += 1) {
+		struct Max3010xDevice_t* pDevice = gDevices[i];
+		if (!pDevice->acquiring) {
+			continue;
+		}
+		TickType_t interval = getReadInterval(pDevice);
+		if (pDevice->irqPending || (pDevice->retryTick != 0)) {
+			interval = ACQUISITION_POLLTICKS;
+		}
+		waitTime = MIN(waitTime, MAX(interval, 1));
+	}
+	return waitTime;
+}
+
+// reads the FIFO if the interrupt was raised or the read interval has passed
+void serveDevice(struct Max3010xDevice_t* pDevice) {
+	TickType_t now = xTaskGetTickCount();
+	if (!pDevice->acquiring) {
+		return;
+	}
+	if (pDevice->retryTick != 0) {
+		if ((int32_t)(now - pDevice->retryTick) < 0) {
+			return;
+		}
+		pDevice->retryTick = 0;
+	}
+	if (!pDevice->irqPending && (now - pDevice->lastReadTick < getReadInterval(pDevice))) {
+		return;
+	}
+	// while the consumer holds both buffers the samples stay in the FIFO
+	if ((pDevice->pBurst == NULL) && (xQueueReceive(pDevice->freeBurstQueue, &pDevice->pBurst, 0) != pdTRUE)) {
+		return;
+	}
+	// the interrupt time belongs to this burst if it was raised after the previous read
+	int64_t irqTime_us = (pDevice->irqPending && (pDevice->irqTime_us > pDevice->fifoReadTime_us)) ? pDevice->irqTime_us : 0;
+	pDevice->irqPending = false;
+	pDevice->lastReadTick = now;
+	struct Max3010xBurst_t* pBurst = pDevice->pBurst;
+	uint16_t count = 0;
+	xSemaphoreTake(pDevice->mutex, portMAX_DELAY);
+	// pointers and data in one go, no other client in between
+	acquireBus(pDevice);
+	esp_err_t res = pDevice->readFIFOFct(pDevice, pBurst->irValues, pBurst->redValues, MAX3010X_BURST_MAXSAMPLES, &count);
+	releaseBus(pDevice);
+	xSemaphoreGive(pDevice->mutex);
+	if (res != ESP_OK) {
+		ESP_LOGW(TAG, "%s on port %d not responding, retry in %d ms", max3010x_getDeviceName(pDevice), pDevice->bus.i2cPort, ACQUISITION_RETRY_ms);
+		pDevice->retryTick = MAX(now + pdMS_TO_TICKS(ACQUISITION_RETRY_ms), 1);
+		pDevice->clockLocked = false;
+		return;
+	}
+	if (count == 0) {
+		return;
+	}
+	pBurst->count = count;
+	timestampBurst(pDevice, pBurst, irqTime_us);
+	updateAGC(pDevice, pBurst);
+	pDevice->pBurst = NULL;
+	xQueueSend(pDevice->filledBurstQueue, &pBurst, 0);
+}
+
+/*
+ * Each burst yields one observation of the sample clock: at the interrupt the FIFO held fifoAlmostFull unread
+ * samples, i.e. that one was just taken; at a poll the newest sample was taken within the last period. The
+ * tracked phase and period smooth the read jitter and follow the drift of the part's oscillator, the samples
+ * of a burst are equally spaced.
+ */
+void timestampBurst(struct Max3010xDevice_t* pDevice, struct Max3010xBurst_t* pBurst, int64_t irqTime_us) {
+	uint16_t count = pBurst->count;
+	int64_t period_ns = pDevice->samplePeriod_ns;
+	int64_t newest_ns;
+	if ((irqTime_us != 0) && (count >= pDevice->fifoAlmostFull)) {
+		newest_ns = irqTime_us * 1000 + (count - pDevice->fifoAlmostFull) * period_ns;
+	} else {
+		newest_ns = pDevice->fifoReadTime_us * 1000 - period_ns / 2;
+	}
+	if (pDevice->clockLocked && !pDevice->fifoOverflow) {
+		int64_t predicted_ns = pDevice->sampleTime_ns + count * period_ns;
+		int64_t error_ns = newest_ns - predicted_ns;
+		if (llabs(error_ns) < CLOCK_RESYNC_PERIODS * period_ns) {
+			// not per sample: the burst size correlates with the read jitter and would bias the period
+			period_ns += error_ns / CLOCK_FREQUENCY_DIVIDER;
+			newest_ns = predicted_ns + error_ns / CLOCK_PHASE_DIVIDER;
+		}
+	}
+	int64_t nominal_ns = getNominalPeriod(&(pDevice->config));
+	int64_t maxDeviation_ns = nominal_ns * CLOCK_MAXDEVIATION_PERCENT / 100;
+	pDevice->samplePeriod_ns = MAX(nominal_ns - maxDeviation_ns, MIN(period_ns, nominal_ns + maxDeviation_ns));
+	pDevice->sampleTime_ns = newest_ns;
+	pDevice->clockLocked = true;
+	for (uint16_t i = 0; i < count; i += 1) {
+		pBurst->timestamps_us[i] = (newest_ns - (int64_t)(count - 1 - i) * pDevice->samplePeriod_ns) / 1000;
+	}
 }
 
-esp_err_t max3010x_writeRegister(uint8_t reg, uint8_t value) {
-	uint8_t buf[2] = { reg, 0 };
-	buf[1] = value;
-	return i2c_master_write_to_device(gDevice.i2cPort, MAX3010X_I2C_ADDR, buf, 2, pdMS_TO_TICKS(MAX3010X_I2C_TIMEOUT_ms));
+// FIFO sample period in ns, from the configuration: the sample rate in Hz is no integer e.g. at 100 Hz with averaging 32
+uint32_t getNominalPeriod(const struct Max3010xConfig_t* pConfig) {
+	return (uint64_t)pConfig->averaging * 1000000000ULL / pConfig->samplingRate;
 }
 
-//Given a register, read it, mask it, and then set the thing
-esp_err_t max3010x_readModifyWriteRegister(uint8_t reg, uint8_t mask, uint8_t value) {
-	// Grab current register context
-	uint8_t buf[2] = { reg, 0 };
-	max3010x_writeReadDevice(buf, 1, (buf + 1), 1);
-	// Zero-out the portions of the register we're interested in
-	buf[1] &= mask;
-	buf[1] |= value;
-	// Change contents
-	return i2c_master_write_to_device(gDevice.i2cPort, MAX3010X_I2C_ADDR, buf, 2, pdMS_TO_TICKS(MAX3010X_I2C_TIMEOUT_ms));
+// the part's limits and the drain budget: the highest almost full threshold that leaves the drain latency, else polling
+esp_err_t checkConfig(struct Max3010xDevice_t* pDevice, struct Max3010xConfig_t* pConfig, struct FifoFormat_t* pFormat, uint8_t* pAlmostFull, bool* pPolled) {
+	assert(pDevice->checkConfigFct != NULL);
+	ESP_RETURN_ON_ERROR(pDevice->checkConfigFct(pDevice, pConfig, pFormat), TAG, "Configuration not supported by %s", max3010x_getDeviceName(pDevice));
+	uint32_t period_ns = getNominalPeriod(pConfig);
+	// samples taken during the drain latency (rounded up), they must fit into the FIFO after the interrupt
+	int32_t latencySamples = ((uint64_t)CONFIG_MAX3010X_DRAIN_LATENCY_ms * 1000000 + period_ns - 1) / period_ns;
+	int32_t almostFull = MIN((int32_t)pDevice->maxFifoAlmostFull, (int32_t)pDevice->fifoSize - latencySamples);
+	*pPolled = (pDevice->gpioIRQ == GPIO_NUM_NC) || (almostFull < pDevice->minFifoAlmostFull);
+	*pAlmostFull = *pPolled ? pDevice->maxFifoAlmostFull : almostFull;
+	if (*pPolled) {
+		// time from the poll until the FIFO overflows, in the time of the sensor (ticks are rounded)
+		uint32_t fill_us = (uint64_t)pDevice->fifoSize * period_ns / 1000;
+		uint32_t poll_us = ACQUISITION_POLLTICKS * portTICK_PERIOD_MS * 1000UL * ACQUISITION_TIMELAPSE;
+		uint32_t headroom_us = (fill_us > poll_us) ? fill_us - poll_us : 0;
+		ESP_RETURN_ON_FALSE(headroom_us >= CONFIG_MAX3010X_DRAIN_LATENCY_ms * 1000UL, ESP_ERR_INVALID_ARG, TAG,
+				"FIFO overflows %lu us after the poll at %lu ns per sample, use averaging", (unsigned long)headroom_us, (unsigned long)period_ns);
+	}
+	return ESP_OK;
 }
 
-esp_err_t max3010x_softReset() {
-	assert(gDevice.softResetFct != NULL);
-	return gDevice.softResetFct();
+esp_err_t applyConfig(struct Max3010xDevice_t* pDevice, const struct Max3010xConfig_t* pConfig, ConfigureFct_t configureFct) {
+	struct Max3010xConfig_t config = *pConfig;
+	struct FifoFormat_t format;
+	uint8_t almostFull;
+	bool polled;
+	xSemaphoreTake(pDevice->mutex, portMAX_DELAY);
+	esp_err_t res = checkConfig(pDevice, &config, &format, &almostFull, &polled);
+	if (res == ESP_OK) {
+		// the threshold is written by configureFct
+		uint8_t prevAlmostFull = pDevice->fifoAlmostFull;
+		pDevice->fifoAlmostFull = almostFull;
+		res = configureFct(pDevice, &config);
+		if (res != ESP_OK) {
+			pDevice->fifoAlmostFull = prevAlmostFull;
+		}
+	}
+	if (res == ESP_OK) {
+		if (polled && (pDevice->gpioIRQ != GPIO_NUM_NC)) {
+			ESP_LOGW(TAG, "%s: the interrupt at %d samples leaves less than %d ms at %lu ns per sample, the FIFO is polled", max3010x_getDeviceName(pDevice),
+					pDevice->minFifoAlmostFull, CONFIG_MAX3010X_DRAIN_LATENCY_ms, (unsigned long)getNominalPeriod(&config));
+		} else if (!polled && (almostFull < pDevice->maxFifoAlmostFull)) {
+			ESP_LOGI(TAG, "%s: almost full interrupt lowered to %d samples for the drain latency", max3010x_getDeviceName(pDevice), almostFull);
+		}
+		pDevice->polled = polled;
+		pDevice->config = config;
+		pDevice->fifoFormat = format;
+		// the FIFO was cleared, the nominal period until the clock is tracked again
+		pDevice->samplePeriod_ns = getNominalPeriod(&config);
+		pDevice->clockLocked = false;
+	}
+	xSemaphoreGive(pDevice->mutex);
+	return res;
+}
+
+// the currents are changed right after reading a burst, i.e. the next burst is measured with the new ones
+void updateAGC(struct Max3010xDevice_t* pDevice, struct Max3010xBurst_t* pBurst) {
+	pBurst->gainChanged = pDevice->agcChanged;
+	pBurst->irLEDCurrent = pDevice->irLEDCurrent;
+	pBurst->redLEDCurrent = pDevice->redLEDCurrent;
+	pDevice->agcChanged = false;
+	if (!pDevice->agcEnabled || pBurst->gainChanged) {
+		// wait for the first burst with the current settings
+		return;
+	}
+	uint32_t fullScale = pDevice->fifoFormat.mask >> pDevice->fifoFormat.shift;
+	uint8_t irLEDCurrent = adjustLEDCurrent(pDevice->irLEDCurrent, pBurst->irValues, pBurst->count, fullScale, pDevice->maxLEDCurrent);
+	uint8_t redLEDCurrent = pDevice->redLEDCurrent;
+	if (pDevice->fifoFormat.redSlot != FIFODECODER_NOSLOT) {
+		redLEDCurrent = adjustLEDCurrent(pDevice->redLEDCurrent, pBurst->redValues, pBurst->count, fullScale, pDevice->maxLEDCurrent);
+	}
+	if ((irLEDCurrent != pDevice->irLEDCurrent) || (redLEDCurrent != pDevice->redLEDCurrent)) {
+		ESP_LOGD(TAG, "AGC: IR %d -> %d, red %d -> %d", pDevice->irLEDCurrent, irLEDCurrent, pDevice->redLEDCurrent, redLEDCurrent);
+		max3010x_setLEDCurrents(pDevice, irLEDCurrent, redLEDCurrent);
+	}
 }
 
-esp_err_t max3010x_setup(uint8_t mode, uint16_t samplingRate) {
-	assert(gDevice.setupFct != NULL);
-	return gDevice.setupFct(mode, samplingRate);
+// hysteresis: within the window the current is kept, outside it is set to reach the target level
+uint8_t adjustLEDCurrent(uint8_t current, const uint32_t* values, uint16_t count, uint32_t fullScale, uint8_t maxCurrent) {
+	uint32_t sum = 0;
+	for (uint16_t i = 0; i < count; i += 1) {
+		sum += values[i];
+	}
+	uint32_t dc = sum / count;
+	if ((dc < fullScale / 100 * AGC_NOFINGER_PERCENT) || ((dc >= fullScale / 100 * AGC_LOW_PERCENT) && (dc <= fullScale / 100 * AGC_HIGH_PERCENT))) {
+		return current;
+	}
+	// the photo current is proportional to the LED current (a saturated channel needs several steps)
+	uint32_t newCurrent = (uint32_t)current * (fullScale / 100 * AGC_TARGET_PERCENT) / dc;
+	return MAX(1, MIN(newCurrent, maxCurrent));
 }
 
-uint16_t max3010x_readFIFO(uint32_t* irValue, uint32_t* redValue, uint16_t maxcnt) {
-	assert(gDevice.readFIFOFct != NULL);
-	return gDevice.readFIFOFct(irValue, redValue, maxcnt);
+bool isCacheable(const struct Max3010xDevice_t* pDevice, uint8_t reg) {
+	return (reg < MAX3010X_SHADOWSIZE) && (pDevice->shadowCacheable & (1ULL << reg));
 }
 
+#if !CONFIG_IDF_TARGET_LINUX
 void gpioISR(void* arg) {
-	if (gDataAvailableCB != NULL) {
-		gDataAvailableCB();
+	struct Max3010xDevice_t* pDevice = arg;
+	pDevice->irqTime_us = esp_timer_get_time();
+	pDevice->irqPending = true;
+	if (gAcquisitionTaskHandle != NULL) {
+		BaseType_t higherPriorityTaskWoken = pdFALSE;
+		vTaskNotifyGiveFromISR(gAcquisitionTaskHandle, &higherPriorityTaskWoken);
+		portYIELD_FROM_ISR(higherPriorityTaskWoken);
+	}
+	if (pDevice->dataAvailableCB != NULL) {
+		pDevice->dataAvailableCB(pDevice);
 	}
 }
+#endif
@@ -0,0 +1,505 @@
+/*
+ * Example of the book "Embedded Systems mit RISC-V", dpunkt.verlag
+ * Author: Patrick Ritschel
+ *
+ * see https://ritschel.at/buch-embedded-systems-auf-den-punkt-gebracht/
+ *
+ * The code of this project is in the Public Domain (or CC0 licensed, at your option).
+ * Unless required by applicable law or agreed to in writing, this
+ * software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/param.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "sdkconfig.h"
+
+#include "max30100.h"
+#include "max30102.h"
+#include "max3010x.h"
+#include "max3010xsim.h"
+
+#if (CONFIG_MAX3010X_SIMULATION == 1)
+
+#define TAG			"MAX3010xSim"
+
+#define SIM_REGCOUNT				256
+#define SIM_MAXSAMPLEBYTES			(3 * FIFODECODER_MAXSLOTS)
+#define SIM_FULLSCALE				0x3FFFF		// trace values: 18 bit
+#define SIM_CATCHUP_SAMPLES			64			// after longer pauses the older samples are counted as lost at once
+
+// synthetic pulse: 72 bpm, AC/DC of red half of IR (SpO2 about 97%)
+#define SIM_PULSE_mHz				1200
+#define SIM_IR_DC					100000
+#define SIM_IR_AC					1500
+#define SIM_RED_DC					80000
+#define SIM_RED_AC					600
+
+// register map and FIFO of the simulated part
+struct SimPart_t {
+	uint8_t partID;
+	uint8_t revision;
+	uint8_t fifoSize;
+	uint8_t regWritePtr;
+	uint8_t regOverflow;
+	uint8_t regReadPtr;
+	uint8_t regData;
+	uint8_t regMode;
+	uint8_t regSpO2;
+	uint8_t overflowMax;		// the counter saturates
+	uint8_t bytesPerSlot;
+	uint8_t adcBits;			// max. resolution, pulse width 0: adcBits - 3
+	uint8_t ledReference;		// LED current register value at which the trace values are measured
+	const uint16_t* samplingRates;
+};
+
+struct SimState_t {
+	const struct SimPart_t* pPart;
+	uint8_t regs[SIM_REGCOUNT];
+	uint8_t fifo[MAX30102_FIFOSIZE][SIM_MAXSAMPLEBYTES];
+	uint8_t fifoBytes[MAX30102_FIFOSIZE];
+	uint8_t unread;				// samples, the pointers are equal for empty and full
+	uint8_t readByte;			// position within the sample at the read pointer
+	bool sampling;
+	int64_t start_us;			// virtual time of the first sample
+	int64_t nextSample_us;
+	uint32_t lostSamples;
+	// trace
+	const uint32_t* irValues;
+	const uint32_t* redValues;
+	uint32_t count;
+	uint16_t traceRate_Hz;
+	uint32_t* loadedValues;		// allocated by max3010xsim_loadTrace()
+};
+
+static const uint16_t gMAX30102SamplingRates[] = { 50, 100, 200, 400, 800, 1000, 1600, 3200 };
+static const uint16_t gMAX30100SamplingRates[] = { 50, 100, 167, 200, 400, 600, 800, 1000 };
+
+static const struct SimPart_t gMAX30102Part = {
+		MAX3010X_PARTID_MAX30102, 3, MAX30102_FIFOSIZE, MAX30102_REG_FIFOWRPTR, MAX30102_REG_FIFOOVFCTR, MAX30102_REG_FIFORDPTR, MAX30102_REG_FIFODATA,
+		MAX30102_REG_MODECONFIG, MAX30102_REG_SPO2CONFIG, 0x1F, 3, 18, MAX30102_LEDCURRENT_uA_TO_REGVAL(7200), gMAX30102SamplingRates
+};
+static const struct SimPart_t gMAX30100Part = {
+		MAX3010X_PARTID_MAX30100, 1, 16, MAX30100_REG_FIFOWRPTR, MAX30100_REG_FIFOOVFCTR, MAX30100_REG_FIFORDPTR, MAX30100_REG_FIFODATA,
+		MAX30100_REG_MODECONFIG, MAX30100_REG_SPO2CONFIG, 0x0F, 2, 16, MAX30100_LEDCURRENT_27_1mA, gMAX30100SamplingRates
+};
+
+static struct SimState_t gSim = { 0 };
+static SemaphoreHandle_t gSimMutex = NULL;
+
+// internal prototypes
+static void lock(void);
+static void unlock(void);
+static void setTrace(const uint32_t* irValues, const uint32_t* redValues, uint32_t count, uint16_t traceRate_Hz, uint32_t* loadedValues);
+static void resetRegisters(void);
+static int64_t getVirtualTime(void);
+static bool isSampling(void);
+static uint32_t getSamplePeriod(void);
+static void advance(void);
+static void pushSample(int64_t time_us);
+static void getTraceValues(int64_t time_us, uint32_t* pIR, uint32_t* pRed);
+static uint8_t getSlots(uint8_t* slots);
+static uint32_t encodeSlot(uint32_t traceValue, uint8_t ledCurrent);
+static uint8_t readRegister(uint8_t reg);
+static void writeRegister(uint8_t reg, uint8_t value);
+static void syncUnread(void);
+
+// ***** implementation *****
+void max3010xsim_init() {
+	if (gSimMutex == NULL) {
+		gSimMutex = xSemaphoreCreateMutex();
+		assert(gSimMutex != NULL);
+	}
+	xSemaphoreTake(gSimMutex, portMAX_DELAY);
+#if (CONFIG_MAX3010X_SIMULATION_MAX30100 == 1)
+	gSim.pPart = &gMAX30100Part;
+#else
+	gSim.pPart = &gMAX30102Part;
+#endif
+	gSim.lostSamples = 0;
+	resetRegisters();
+	xSemaphoreGive(gSimMutex);
+	ESP_LOGI(TAG, "simulated %s, time lapse %d", (gSim.pPart->partID == MAX3010X_PARTID_MAX30100) ? "MAX30100" : "MAX30102", CONFIG_MAX3010X_SIMULATION_TIMELAPSE);
+}
+
+void max3010xsim_setTrace(const uint32_t* irValues, const uint32_t* redValues, uint32_t count, uint16_t traceRate_Hz) {
+	lock();
+	setTrace(irValues, redValues, count, traceRate_Hz, NULL);
+	unlock();
+}
+
+esp_err_t max3010xsim_loadTrace(const char* path, uint16_t traceRate_Hz) {
+	FILE* pFile = fopen(path, "rb");
+	if (pFile == NULL) {
+		ESP_LOGE(TAG, "cannot open %s", path);
+		return ESP_ERR_NOT_FOUND;
+	}
+	size_t len = strlen(path);
+	bool binary = (len > 4) && (strcmp(path + len - 4, ".bin") == 0);
+	uint32_t capacity = 1024;
+	uint32_t count = 0;
+	uint32_t* values = malloc(2 * capacity * sizeof(uint32_t));	// pairs ir, red
+	char line[64];
+	while (values != NULL) {
+		uint32_t ir;
+		uint32_t red;
+		if (binary) {
+			uint8_t raw[8];
+			if (fread(raw, 1, sizeof(raw), pFile) != sizeof(raw)) {
+				break;
+			}
+			ir = raw[0] | (raw[1] << 8) | (raw[2] << 16) | ((uint32_t)raw[3] << 24);
+			red = raw[4] | (raw[5] << 8) | (raw[6] << 16) | ((uint32_t)raw[7] << 24);
+		} else {
+			if (fgets(line, sizeof(line), pFile) == NULL) {
+				break;
+			}
+			unsigned long irValue;
+			unsigned long redValue;
+			if (sscanf(line, "%lu,%lu", &irValue, &redValue) != 2) {
+				continue;	// header or comment
+			}
+			ir = irValue;
+			red = redValue;
+		}
+		if (count == capacity) {
+			capacity *= 2;
+			uint32_t* enlarged = realloc(values, 2 * capacity * sizeof(uint32_t));
+			if (enlarged == NULL) {
+				free(values);
+				values = NULL;
+				break;
+			}
+			values = enlarged;
+		}
+		values[count] = ir;
+		values[capacity + count] = red;		// moved behind the IR values at the end
+		count += 1;
+	}
+	fclose(pFile);
+	if (values == NULL) {
+		return ESP_ERR_NO_MEM;
+	}
+	if (count == 0) {
+		free(values);
+		ESP_LOGE(TAG, "no samples in %s", path);
+		return ESP_ERR_INVALID_SIZE;
+	}
+	memmove(values + count, values + capacity, count * sizeof(uint32_t));
+	lock();
+	setTrace(values, values + count, count, traceRate_Hz, values);
+	unlock();
+	ESP_LOGI(TAG, "%lu samples loaded from %s", (unsigned long)count, path);
+	return ESP_OK;
+}
+
+uint32_t max3010xsim_getLostSamples() {
+	return gSim.lostSamples;
+}
+
+int64_t max3010xsim_getTime() {
+	return getVirtualTime();
+}
+
+// the register pointer is set by the first written byte, reading increments it (except for the FIFO data)
+esp_err_t max3010xsim_writeRead(const uint8_t* writeBuffer, size_t writeSize, uint8_t* readBuffer, size_t readSize) {
+	if ((writeSize != 1) || (gSim.pPart == NULL)) {
+		return ESP_ERR_INVALID_ARG;
+	}
+	xSemaphoreTake(gSimMutex, portMAX_DELAY);
+	advance();
+	uint8_t reg = writeBuffer[0];
+	for (size_t i = 0; i < readSize; i += 1) {
+		readBuffer[i] = readRegister(reg);
+		if (reg != gSim.pPart->regData) {
+			reg += 1;
+		}
+	}
+	xSemaphoreGive(gSimMutex);
+	return ESP_OK;
+}
+
+esp_err_t max3010xsim_write(const uint8_t* writeBuffer, size_t writeSize) {
+	if ((writeSize == 0) || (gSim.pPart == NULL)) {
+		return ESP_ERR_INVALID_ARG;
+	}
+	xSemaphoreTake(gSimMutex, portMAX_DELAY);
+	// the samples until now with the old configuration, the new one takes effect with the next sample
+	advance();
+	uint8_t reg = writeBuffer[0];
+	for (size_t i = 1; i < writeSize; i += 1) {
+		writeRegister(reg, writeBuffer[i]);
+		if (reg != gSim.pPart->regData) {
+			reg += 1;
+		}
+	}
+	advance();
+	xSemaphoreGive(gSimMutex);
+	return ESP_OK;
+}
+
+// the trace may be set before max3010x_init()
+void lock() {
+	if (gSimMutex != NULL) {
+		xSemaphoreTake(gSimMutex, portMAX_DELAY);
+	}
+}
+
+void unlock() {
+	if (gSimMutex != NULL) {
+		xSemaphoreGive(gSimMutex);
+	}
+}
+
+void setTrace(const uint32_t* irValues, const uint32_t* redValues, uint32_t count, uint16_t traceRate_Hz, uint32_t* loadedValues) {
+	free(gSim.loadedValues);
+	gSim.loadedValues = loadedValues;
+	if ((irValues == NULL) || (redValues == NULL) || (traceRate_Hz == 0)) {
+		count = 0;
+	}
+	gSim.irValues = irValues;
+	gSim.redValues = redValues;
+	gSim.count = count;
+	gSim.traceRate_Hz = traceRate_Hz;
+	// the replay starts with the next sample
+	gSim.start_us = gSim.nextSample_us;
+}
+
+// power-on state: all registers 0, FIFO empty, power ready
+void resetRegisters() {
+	memset(gSim.regs, 0, sizeof(gSim.regs));
+	gSim.regs[MAX3010X_REG_PARTID] = gSim.pPart->partID;
+	gSim.regs[MAX3010X_REG_REVISION] = gSim.pPart->revision;
+	gSim.regs[MAX30102_REG_INTERRUPTSTATUS1] = MAX30102_INT1_PWRRDY;
+	gSim.unread = 0;
+	gSim.readByte = 0;
+	gSim.sampling = false;
+}
+
+int64_t getVirtualTime() {
+	return esp_timer_get_time() * CONFIG_MAX3010X_SIMULATION_TIMELAPSE;
+}
+
+// a mode with LEDs and not shut down
+bool isSampling() {
+	uint8_t mode = gSim.regs[gSim.pPart->regMode];
+	if (mode & MAX30102_MODECONFIG_SHDN) {
+		return false;
+	}
+	mode &= 0x07;
+	return (mode == MAX3010X_MODE_HR_ONLY) || (mode == MAX3010X_MODE_SPO2_HR) || ((mode == MAX30102_MODECONFIG_MULTILEDMODE) && (gSim.pPart->partID == MAX3010X_PARTID_MAX30102));
+}
+
+// the MAX30102 averages the samples before they are put into the FIFO
+uint32_t getSamplePeriod() {
+	uint16_t rate = gSim.pPart->samplingRates[(gSim.regs[gSim.pPart->regSpO2] >> 2) & 0x07];
+	uint32_t averaging = 1;
+	if (gSim.pPart->partID == MAX3010X_PARTID_MAX30102) {
+		averaging = 1 << MIN(gSim.regs[MAX30102_REG_FIFOCONFIG] >> 5, 5);
+	}
+	// the oscillator of the part deviates from the nominal rate
+	return (int64_t)1000000 * averaging * 1000000 / (1000000 + CONFIG_MAX3010X_SIMULATION_CLOCK_PPM) / rate;
+}
+
+// puts the samples taken since the last access into the FIFO
+void advance() {
+	int64_t now_us = getVirtualTime();
+	if (!isSampling()) {
+		gSim.sampling = false;
+		return;
+	}
+	if (!gSim.sampling) {
+		gSim.sampling = true;
+		gSim.start_us = now_us;
+		gSim.nextSample_us = now_us + getSamplePeriod();
+	}
+	uint32_t period_us = getSamplePeriod();
+	int64_t missing = (now_us - gSim.nextSample_us) / period_us;
+	if (missing > SIM_CATCHUP_SAMPLES) {
+		missing -= SIM_CATCHUP_SAMPLES;
+		gSim.nextSample_us += missing * period_us;
+		gSim.lostSamples += missing;
+		gSim.regs[gSim.pPart->regOverflow] = gSim.pPart->overflowMax;
+	}
+	while (gSim.nextSample_us <= now_us) {
+		pushSample(gSim.nextSample_us);
+		gSim.nextSample_us += period_us;
+	}
+}
+
+// a full FIFO loses the new sample, with roll over (MAX30102) the oldest one
+void pushSample(int64_t time_us) {
+	const struct SimPart_t* pPart = gSim.pPart;
+	uint8_t* pOverflow = &gSim.regs[pPart->regOverflow];
+	if (gSim.unread == pPart->fifoSize) {
+		*pOverflow = MIN(*pOverflow + 1, pPart->overflowMax);
+		gSim.lostSamples += 1;
+		if ((pPart->partID != MAX3010X_PARTID_MAX30102) || !(gSim.regs[MAX30102_REG_FIFOCONFIG] & MAX30102_FIFOCONFIG_ROLLOVEREN)) {
+			return;
+		}
+		gSim.regs[pPart->regReadPtr] = (gSim.regs[pPart->regReadPtr] + 1) % pPart->fifoSize;
+		gSim.unread -= 1;
+		gSim.readByte = 0;
+	}
+
+	uint32_t ir;
+	uint32_t red;
+	getTraceValues(time_us, &ir, &red);
+	uint8_t slots[FIFODECODER_MAXSLOTS];
+	uint8_t slotCount = getSlots(slots);
+	uint8_t writePtr = gSim.regs[pPart->regWritePtr];
+	uint8_t* pSample = gSim.fifo[writePtr];
+	for (uint8_t i = 0; i < slotCount; i += 1) {
+		uint32_t value;
+		if (slots[i] == 0) {
+			value = 0;	// no LED
+		} else if (pPart->partID == MAX3010X_PARTID_MAX30100) {
+			// IR in the lower, red in the upper nibble; HR mode: IR only
+			uint8_t ledConfig = gSim.regs[MAX30100_REG_LEDCONFIG];
+			value = (slots[i] == MAX30102_MULTILEDCTRL_SLOT_IR) ? encodeSlot(ir, ledConfig & 0x0F) : encodeSlot(red, ledConfig >> 4);
+		} else if (slots[i] == MAX30102_MULTILEDCTRL_SLOT_RED) {
+			value = encodeSlot(red, gSim.regs[MAX30102_REG_LEDPULSEAMP1]);
+		} else if (slots[i] == MAX30102_MULTILEDCTRL_SLOT_IR) {
+			value = encodeSlot(ir, gSim.regs[MAX30102_REG_LEDPULSEAMP2]);
+		} else {
+			value = 0;	// pilot
+		}
+		// MSB first
+		for (int8_t b = pPart->bytesPerSlot - 1; b >= 0; b -= 1) {
+			*pSample++ = (uint8_t)(value >> (8 * b));
+		}
+	}
+	gSim.fifoBytes[writePtr] = slotCount * pPart->bytesPerSlot;
+	gSim.regs[pPart->regWritePtr] = (writePtr + 1) % pPart->fifoSize;
+	gSim.unread += 1;
+
+	// interrupt status, the MAX30100 interrupts at 15 of 16 samples
+	uint8_t status = gSim.regs[MAX30102_REG_INTERRUPTSTATUS1] | MAX30102_INT1_PPGRDY;
+	uint8_t almostFull = pPart->fifoSize - 1;
+	if (pPart->partID == MAX3010X_PARTID_MAX30102) {
+		almostFull = pPart->fifoSize - (gSim.regs[MAX30102_REG_FIFOCONFIG] & 0x0F);
+	}
+	if (gSim.unread == almostFull) {
+		status |= MAX30102_INT1_AFULL;
+	}
+	gSim.regs[MAX30102_REG_INTERRUPTSTATUS1] = status;
+}
+
+// the trace loops, without one a synthetic pulse is generated
+void getTraceValues(int64_t time_us, uint32_t* pIR, uint32_t* pRed) {
+	int64_t elapsed_us = time_us - gSim.start_us;
+	if (gSim.count > 0) {
+		uint32_t index = (uint64_t)elapsed_us * gSim.traceRate_Hz / 1000000 % gSim.count;
+		*pIR = gSim.irValues[index];
+		*pRed = gSim.redValues[index];
+	} else {
+		// the absorption rises with the systolic pulse, followed by the dicrotic notch
+		float phase = 2.0f * (float)M_PI * (float)(elapsed_us % (1000000000LL / SIM_PULSE_mHz)) * SIM_PULSE_mHz / 1.0e9f;
+		float pulse = sinf(phase) + 0.3f * sinf(2.0f * phase);
+		*pIR = (uint32_t)(SIM_IR_DC - SIM_IR_AC * pulse);
+		*pRed = (uint32_t)(SIM_RED_DC - SIM_RED_AC * pulse);
+	}
+}
+
+// slot contents as in MULTILEDCTRL: 1 red, 2 IR (the MAX30100 has fixed slots IR, red)
+uint8_t getSlots(uint8_t* slots) {
+	uint8_t mode = gSim.regs[gSim.pPart->regMode] & 0x07;
+	if (gSim.pPart->partID == MAX3010X_PARTID_MAX30100) {
+		slots[0] = MAX30102_MULTILEDCTRL_SLOT_IR;
+		slots[1] = (mode == MAX3010X_MODE_SPO2_HR) ? MAX30102_MULTILEDCTRL_SLOT_RED : 0;
+		return 2;
+	}
+	if (mode == MAX3010X_MODE_HR_ONLY) {
+		slots[0] = MAX30102_MULTILEDCTRL_SLOT_RED;
+		return 1;
+	}
+	if (mode == MAX3010X_MODE_SPO2_HR) {
+		slots[0] = MAX30102_MULTILEDCTRL_SLOT_RED;
+		slots[1] = MAX30102_MULTILEDCTRL_SLOT_IR;
+		return 2;
+	}
+	uint8_t ctrl12 = gSim.regs[MAX30102_REG_MULTILEDCTRL12];
+	uint8_t ctrl34 = gSim.regs[MAX30102_REG_MULTILEDCTRL34];
+	uint8_t all[FIFODECODER_MAXSLOTS] = { ctrl12 & 0x07, (ctrl12 >> 4) & 0x07, ctrl34 & 0x07, (ctrl34 >> 4) & 0x07 };
+	uint8_t count = 0;
+	while ((count < FIFODECODER_MAXSLOTS) && (all[count] != 0)) {
+		slots[count] = all[count];
+		count += 1;
+	}
+	return count;
+}
+
+// the photo current is proportional to the LED current, the ADC value is left-justified with the resolution
+// of the pulse width
+uint32_t encodeSlot(uint32_t traceValue, uint8_t ledCurrent) {
+	const struct SimPart_t* pPart = gSim.pPart;
+	uint64_t value = (uint64_t)traceValue * ledCurrent / pPart->ledReference;
+	value = MIN(value, SIM_FULLSCALE) >> (18 - pPart->adcBits);
+	uint8_t adcBits = pPart->adcBits - 3 + (gSim.regs[pPart->regSpO2] & 0x03);
+	uint32_t shift = pPart->adcBits - adcBits;
+	return ((uint32_t)value >> shift) << shift;
+}
+
+uint8_t readRegister(uint8_t reg) {
+	const struct SimPart_t* pPart = gSim.pPart;
+	if (reg == pPart->regData) {
+		// the read pointer advances after the last byte of a sample, nothing is popped from an empty FIFO
+		if (gSim.unread == 0) {
+			return 0;
+		}
+		uint8_t readPtr = gSim.regs[pPart->regReadPtr];
+		uint8_t value = gSim.fifo[readPtr][gSim.readByte];
+		gSim.readByte += 1;
+		if (gSim.readByte >= gSim.fifoBytes[readPtr]) {
+			gSim.readByte = 0;
+			gSim.regs[pPart->regReadPtr] = (readPtr + 1) % pPart->fifoSize;
+			gSim.unread -= 1;
+			gSim.regs[pPart->regOverflow] = 0;
+		}
+		return value;
+	}
+	uint8_t value = gSim.regs[reg];
+	// reading clears the interrupt status
+	if ((reg == MAX30102_REG_INTERRUPTSTATUS1) || ((reg == MAX30102_REG_INTERRUPTSTATUS2) && (pPart->partID == MAX3010X_PARTID_MAX30102))) {
+		gSim.regs[reg] = 0;
+	}
+	return value;
+}
+
+void writeRegister(uint8_t reg, uint8_t value) {
+	const struct SimPart_t* pPart = gSim.pPart;
+	if ((reg == MAX30102_REG_INTERRUPTSTATUS1) || (reg == pPart->regData) || (reg >= MAX3010X_REG_REVISION) ||
+			((reg == MAX30102_REG_INTERRUPTSTATUS2) && (pPart->partID == MAX3010X_PARTID_MAX30102))) {
+		return;		// read only
+	}
+	if ((reg == pPart->regMode) && (value & MAX30102_MODECONFIG_RESET)) {
+		// the reset bit clears itself
+		resetRegisters();
+		return;
+	}
+	if ((reg == pPart->regWritePtr) || (reg == pPart->regReadPtr)) {
+		gSim.regs[reg] = value % pPart->fifoSize;
+		syncUnread();
+		return;
+	}
+	if (reg == pPart->regOverflow) {
+		gSim.regs[reg] = MIN(value, pPart->overflowMax);
+		return;
+	}
+	gSim.regs[reg] = value;
+}
+
+// after the pointers have been written, equal ones mean empty
+void syncUnread() {
+	gSim.unread = (gSim.regs[gSim.pPart->regWritePtr] + gSim.pPart->fifoSize - gSim.regs[gSim.pPart->regReadPtr]) % gSim.pPart->fifoSize;
+	gSim.readByte = 0;
+}
+
+#endif
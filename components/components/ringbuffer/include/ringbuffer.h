@@ -21,7 +21,7 @@
 #define RINGBUFFER_ERROR_FULL			-2
 #define RINGBUFFER_ERROR_OUTOFMEMORY	-3
 
-typedef int32_t RingbufferHandle;
+typedef intptr_t RingbufferHandle;	// the pointer, negative: error (64 bit on the linux target)
 
 /**
  * Creates a new ringbuffer by allocating space for >size< elements in dynamic memory.
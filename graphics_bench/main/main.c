@@ -0,0 +1,349 @@
+/*
+ * Part of the book "Embedded Systems mit RISC-V", dpunkt.verlag
+ * Author: Patrick Ritschel
+ *
+ * see https://ritschel.at/buch-embedded-systems-auf-den-punkt-gebracht/
+ *
+ * The code of this project is in the Public Domain (or CC0 licensed, at your option).
+ * Unless required by applicable law or agreed to in writing, this
+ * software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <time.h>
+#include <sys/param.h>
+
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#if !CONFIG_IDF_TARGET_LINUX
+#include "esp_cpu.h"
+#endif
+#include "graphics.h"
+#include "graphicspanel.h"
+#include "widgets.h"
+#include "sprites.h"
+
+#define DISPLAY_WIDTH		graphics_getDisplayWidth()		// rotated drawing coordinates
+#define DISPLAY_HEIGHT		graphics_getDisplayHeight()
+#define PANEL_RAMWIDTH		MAX(128, CONFIG_GRAPHICS_PIXELWIDTH)
+#define PRIMITIVE_CALLS		10000
+#define BATCH_SIZE			128
+
+#if CONFIG_IDF_TARGET_LINUX
+#define TICK_UNIT			"ns"
+#else
+#define TICK_UNIT			"cycles"
+#endif
+
+struct Primitive_t {
+	const char* name;
+	void (*call)(uint32_t i);
+};
+
+struct Workload_t {
+	const char* name;
+	void (*init)(void);
+	void (*drawFrame)(uint32_t frame);
+	void (*cleanup)(void);
+};
+
+static GraphicsPanel* gPanel = NULL;
+static WidgetScreen* gScreen = NULL;
+static Widget* gChart = NULL;
+static Widget* gPulseValue = NULL;
+static Widget* gOxiBar = NULL;
+static SpriteLayer* gSprites = NULL;
+static Sprite* gSprite = NULL;
+static struct GraphicsPoint_t gPoints[BATCH_SIZE];
+static int16_t gSamples[BATCH_SIZE];
+
+// internal prototypes
+static int64_t getTime_us(void);
+static uint32_t getTicks(void);
+static void runPrimitive(const struct Primitive_t* pPrimitive);
+static void callSetPixel(uint32_t i);
+static void callInvertPixel(uint32_t i);
+static void callSetImageAligned(uint32_t i);
+static void callSetImageUnaligned(uint32_t i);
+static void callDrawLine(uint32_t i);
+static void callSetPixelLoop(uint32_t i);
+static void callSetPixels(uint32_t i);
+static void callSetColumnPixels(uint32_t i);
+static void callClearRegion(uint32_t i);
+static void runWorkload(const struct Workload_t* pWorkload);
+static void initPoxi(void);
+static void drawPoxiFrame(uint32_t frame);
+static void cleanupPoxi(void);
+static void drawStopwatchFrame(uint32_t frame);
+static void drawConsoleFrame(uint32_t frame);
+static void initSprite(void);
+static void drawSpriteFrame(uint32_t frame);
+static void cleanupSprite(void);
+static void checkFullWidth(void);
+static int countPanelPixels(void);
+
+static const uint8_t gImage[16 * 16 / 8] = {
+	0xFF, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0xFF,
+	0xFF, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0xFF
+};
+
+static const struct Primitive_t gPrimitives[] = {
+	{ "setPixel", callSetPixel },
+	{ "invertPixel", callInvertPixel },
+	{ "setImage 16x16 aligned", callSetImageAligned },
+	{ "setImage 16x16 unaligned", callSetImageUnaligned },
+	{ "drawLine", callDrawLine },
+	{ "setPixel x128", callSetPixelLoop },
+	{ "setPixels x128", callSetPixels },
+	{ "setColumnPixels x128", callSetColumnPixels },
+	{ "clearRegion 32x16", callClearRegion }
+};
+
+static const struct Workload_t gWorkloads[] = {
+	{ "poxi", initPoxi, drawPoxiFrame, cleanupPoxi },
+	{ "stopwatch", NULL, drawStopwatchFrame, NULL },
+	{ "console", NULL, drawConsoleFrame, NULL },
+	{ "sprite", initSprite, drawSpriteFrame, cleanupSprite }
+};
+
+// ***** implementation *****
+int64_t getTime_us() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+// cycle counter on the target, nanoseconds on the host
+uint32_t getTicks() {
+	#if CONFIG_IDF_TARGET_LINUX
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint32_t)(now.tv_sec * 1000000000LL + now.tv_nsec);
+	#else
+	return esp_cpu_get_cycle_count();
+	#endif
+}
+
+// drawing only, the framebuffer is transferred once afterwards
+void runPrimitive(const struct Primitive_t* pPrimitive) {
+	graphics_startUpdate();
+	uint32_t start = getTicks();
+	for (uint32_t i = 0; i < PRIMITIVE_CALLS; i += 1) {
+		pPrimitive->call(i);
+	}
+	uint32_t ticks = getTicks() - start;
+	graphics_finishUpdate();
+	printf("%-26s %8.1f " TICK_UNIT "/call\n", pPrimitive->name, ticks / (float)PRIMITIVE_CALLS);
+}
+
+void callSetPixel(uint32_t i) {
+	graphics_setPixel(i % DISPLAY_WIDTH, (i / DISPLAY_WIDTH) % DISPLAY_HEIGHT);
+}
+
+void callInvertPixel(uint32_t i) {
+	graphics_invertPixel(i % DISPLAY_WIDTH, (i / DISPLAY_WIDTH) % DISPLAY_HEIGHT);
+}
+
+void callSetImageAligned(uint32_t i) {
+	graphics_setImage((i * 16) % (DISPLAY_WIDTH - 16), ((i / 8) * 8) % (DISPLAY_HEIGHT - 16), 16, 16, gImage);
+}
+
+void callSetImageUnaligned(uint32_t i) {
+	graphics_setImage((i * 16) % (DISPLAY_WIDTH - 16), (i * 3) % (DISPLAY_HEIGHT - 16) | 1, 16, 16, gImage);
+}
+
+void callDrawLine(uint32_t i) {
+	graphics_drawLine(0, i % DISPLAY_HEIGHT, DISPLAY_WIDTH - 1, DISPLAY_HEIGHT - 1 - i % DISPLAY_HEIGHT, 1);
+}
+
+// chart-like samples, the same pixels for all three variants
+void callSetPixelLoop(uint32_t i) {
+	for (int j = 0; j < BATCH_SIZE; j += 1) {
+		graphics_setPixel(gPoints[j].x, gPoints[j].y);
+	}
+}
+
+void callSetPixels(uint32_t i) {
+	graphics_setPixels(gPoints, BATCH_SIZE, GRAPHICS_RASTEROP_SET);
+}
+
+void callSetColumnPixels(uint32_t i) {
+	graphics_setColumnPixels(0, gSamples, BATCH_SIZE, GRAPHICS_RASTEROP_SET);
+}
+
+void callClearRegion(uint32_t i) {
+	graphics_clearRegion((i * 32) % (DISPLAY_WIDTH - 32), (i * 16) % (DISPLAY_HEIGHT - 16), (i * 32) % (DISPLAY_WIDTH - 32) + 32, (i * 16) % (DISPLAY_HEIGHT - 16) + 16);
+}
+
+void runWorkload(const struct Workload_t* pWorkload) {
+	graphics_startUpdate();
+	graphics_clearScreen();
+	graphics_finishUpdate();
+	if (pWorkload->init != NULL) {
+		pWorkload->init();
+	}
+	graphicspanel_resetVirtualStats(gPanel);
+	#if (CONFIG_GRAPHICS_STATS == 1)
+	graphics_resetStats();
+	#endif
+
+	int64_t start = getTime_us();
+	for (uint32_t frame = 0; frame < CONFIG_GRAPHICS_BENCH_FRAMES; frame += 1) {
+		pWorkload->drawFrame(frame);
+	}
+	int64_t duration = getTime_us() - start;
+
+	struct GraphicsPanelStats_t stats;
+	graphicspanel_getVirtualStats(gPanel, &stats);
+	uint32_t frames = (stats.frames > 0) ? stats.frames : 1;
+	printf("%-10s %5d updates %5" PRIu32 " transfers %8.1f us/update %6.1f transactions/transfer %7.1f bytes/transfer %7.1f wire bytes/transfer (max %" PRIu32 ")\n",
+			pWorkload->name, CONFIG_GRAPHICS_BENCH_FRAMES, stats.frames, duration / (float)CONFIG_GRAPHICS_BENCH_FRAMES,
+			stats.transactions / (float)frames, stats.bytes / (float)frames, stats.wireBytes / (float)frames, stats.maxFrameWireBytes);
+	#if (CONFIG_GRAPHICS_STATS == 1)
+	graphics_logStats();
+	#endif
+
+	#if (CONFIG_GRAPHICS_BENCH_WRITEPBM == 1)
+	char filename[32];
+	snprintf(filename, sizeof(filename), (CONFIG_GRAPHICS_BITSPERPIXEL == 4) ? "%s.pgm" : "%s.pbm", pWorkload->name);
+	FILE* pFile = fopen(filename, "wb");
+	if (pFile != NULL) {
+		graphicspanel_writeVirtualPBM(gPanel, pFile);
+		fclose(pFile);
+	}
+	#endif
+
+	if (pWorkload->cleanup != NULL) {
+		pWorkload->cleanup();
+	}
+}
+
+// chart, pulse and oxygen saturation like poxi
+void initPoxi() {
+	gScreen = widgets_createScreen();
+	configASSERT(gScreen != NULL);
+	gChart = widgets_createChart(4, 0, 97, 32, STRIPCHART_SWEEP, 24);
+	configASSERT(gChart != NULL);
+	widgets_addWidget(gScreen, gChart);
+	gPulseValue = widgets_createValue(10, 40, 99, 56, "%d bpm", -1, "NO FINGER");
+	configASSERT(gPulseValue != NULL);
+	widgets_addWidget(gScreen, gPulseValue);
+	gOxiBar = widgets_createBar(100, 40, 124, 56, 100);
+	configASSERT(gOxiBar != NULL);
+	widgets_addWidget(gScreen, gOxiBar);
+}
+
+void drawPoxiFrame(uint32_t frame) {
+	// triangle wave, period 48 values
+	int phase = frame % 48;
+	widgets_addChartValue(gChart, 4 + ((phase < 24) ? phase : 48 - phase));
+	if (frame % 25 == 0) {
+		widgets_setValue(gPulseValue, 60 + (frame / 25) % 40);
+		widgets_setBarValue(gOxiBar, 90 + (frame / 25) % 10);
+	}
+	widgets_render(gScreen);
+}
+
+void cleanupPoxi() {
+	widgets_destroyScreen(gScreen);
+	gScreen = NULL;
+}
+
+// whole screen redrawn every update like the stopwatch, one frame = 10 ms
+void drawStopwatchFrame(uint32_t frame) {
+	char buf[32];
+	graphics_startUpdate();
+	graphics_clearScreen();
+	graphics_println("RUN");
+	sprintf(buf, "%" PRIu32 ".%" PRIu32, frame / 100, frame % 100 / 10);
+	graphics_println(buf);
+	graphics_finishUpdate();
+}
+
+// one new line per update, scrolling at the bottom
+void drawConsoleFrame(uint32_t frame) {
+	char buf[32];
+	sprintf(buf, "line %" PRIu32, frame);
+	graphics_startUpdate();
+	graphics_println(buf);
+	graphics_finishUpdate();
+}
+
+// 16x16 save-under sprite moving over text
+void initSprite() {
+	graphics_startUpdate();
+	for (int i = 0; i < 4; i += 1) {
+		graphics_println("Background text");
+	}
+	graphics_finishUpdate();
+	gSprites = sprites_createLayer();
+	configASSERT(gSprites != NULL);
+	gSprite = sprites_createSprite(gSprites, 16, 16, SPRITES_SAVEUNDER, 0);
+	configASSERT(gSprite != NULL);
+	sprites_setImage(gSprite, gImage);
+	sprites_setVisible(gSprite, true);
+}
+
+void drawSpriteFrame(uint32_t frame) {
+	// bouncing diagonally
+	int rangeX = 2 * (DISPLAY_WIDTH - 16);
+	int rangeY = 2 * (DISPLAY_HEIGHT - 16);
+	int x = frame % rangeX;
+	int y = frame % rangeY;
+	sprites_moveTo(gSprite, (x < rangeX / 2) ? x : rangeX - x, (y < rangeY / 2) ? y : rangeY - y);
+	sprites_render(gSprites);
+}
+
+void cleanupSprite() {
+	sprites_destroyLayer(gSprites);
+	gSprites = NULL;
+}
+
+void app_main() {
+	gPanel = graphicspanel_createVirtual(PANEL_RAMWIDTH, GRAPHICSPANEL_RAMHEIGHT);
+	configASSERT(gPanel != NULL);
+	ESP_ERROR_CHECK(graphics_initPanel(gPanel, CONFIG_GRAPHICS_PIXELWIDTH, CONFIG_GRAPHICS_PIXELHEIGHT, 0, true));
+
+	for (int i = 0; i < BATCH_SIZE; i += 1) {
+		// triangle wave
+		gSamples[i] = (i % 32 < 16) ? i % 32 : 32 - i % 32;
+		gPoints[i].x = i;
+		gPoints[i].y = gSamples[i];
+	}
+	for (int i = 0; i < sizeof(gPrimitives) / sizeof(gPrimitives[0]); i += 1) {
+		runPrimitive(&gPrimitives[i]);
+	}
+	for (int i = 0; i < sizeof(gWorkloads) / sizeof(gWorkloads[0]); i += 1) {
+		runWorkload(&gWorkloads[i]);
+	}
+	checkFullWidth();
+}
+
+// the rightmost column reaches the panel and a full width clearRegion() clears it, e.g. on a 256 pixel wide panel
+void checkFullWidth() {
+	graphics_startUpdate();
+	graphics_clearScreen();
+	for (int y = 0; y < DISPLAY_HEIGHT; y += 1) {
+		graphics_setPixel(DISPLAY_WIDTH - 1, y);
+	}
+	graphics_finishUpdate();
+	configASSERT(countPanelPixels() == DISPLAY_HEIGHT);
+	graphics_startUpdate();
+	graphics_clearRegion(0, 0, DISPLAY_WIDTH, DISPLAY_HEIGHT);
+	graphics_finishUpdate();
+	configASSERT(countPanelPixels() == 0);
+	printf("%d x %d full width OK\n", DISPLAY_WIDTH, DISPLAY_HEIGHT);
+}
+
+// in panel coordinates, i.e. independent of the rotation
+int countPanelPixels() {
+	int count = 0;
+	for (int y = 0; y < GRAPHICSPANEL_RAMHEIGHT; y += 1) {
+		for (int x = 0; x < PANEL_RAMWIDTH; x += 1) {
+			count += (graphicspanel_getVirtualPixel(gPanel, x, y) != 0) ? 1 : 0;
+		}
+	}
+	return count;
+}
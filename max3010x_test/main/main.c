@@ -0,0 +1,333 @@
+/*
+ * Part of the book "Embedded Systems mit RISC-V", dpunkt.verlag
+ * Author: Patrick Ritschel
+ *
+ * see https://ritschel.at/buch-embedded-systems-auf-den-punkt-gebracht/
+ *
+ * The code of this project is in the Public Domain (or CC0 licensed, at your option).
+ * Unless required by applicable law or agreed to in writing, this
+ * software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+
+#include "sdkconfig.h"
+#include "esp_timer.h"
+#include "max3010x.h"
+#include "fifodecoder.h"
+
+#define BENCH_SAMPLES		MAX3010X_BURST_MAXSAMPLES
+
+// a FIFO_DATA burst as read from the part and the values it holds
+struct DecoderCase_t {
+	const char* name;
+	uint8_t partID;
+	uint8_t slotCount;
+	uint8_t adcBits;
+	int8_t irSlot;
+	int8_t redSlot;
+	uint16_t samples;
+	const uint8_t* data;
+	const uint32_t* frames;		// interleaved by slot
+};
+
+struct BenchFormat_t {
+	const char* name;
+	uint8_t partID;
+	uint8_t slotCount;
+	uint8_t adcBits;
+};
+
+struct InvalidFormat_t {
+	uint8_t partID;
+	uint8_t slotCount;
+	uint8_t adcBits;
+};
+
+/*
+ * FIFO_DATA bursts in the layout of the datasheets: per sample the active slots in order, MSB first,
+ * the value left-justified within 18 (MAX30102, 3 bytes per slot) or 16 bits (MAX30100, 2 bytes).
+ * Lower resolutions leave the low bits 0. Bits 23..18 of the MAX30102 are not part of the value
+ * and set in some of the streams.
+ */
+// MAX30102 HR 18 bit
+static const uint8_t gStream0[] = {
+	0x01, 0xE2, 0xA5,
+	0x01, 0xE2, 0xB1,
+	0x01, 0xE2, 0xC9,
+	0x01, 0xE2, 0xD0,
+};
+static const uint32_t gFrames0[] = {
+	0x1E2A5,
+	0x1E2B1,
+	0x1E2C9,
+	0x1E2D0,
+};
+// MAX30102 SpO2 18 bit
+static const uint8_t gStream1[] = {
+	0x11, 0xE2, 0xA5, 0x92, 0xA3, 0xF1,
+	0x49, 0xE2, 0xB1, 0xEE, 0xA4, 0x0C,
+	0xBD, 0xE2, 0xC9, 0x32, 0xA4, 0x37,
+	0xE9, 0xE2, 0xD0, 0xFE, 0xA4, 0x5B,
+};
+static const uint32_t gFrames1[] = {
+	0x1E2A5, 0x2A3F1,
+	0x1E2B1, 0x2A40C,
+	0x1E2C9, 0x2A437,
+	0x1E2D0, 0x2A45B,
+};
+// MAX30102 SpO2 17 bit
+static const uint8_t gStream2[] = {
+	0x09, 0xE2, 0xA4, 0xDE, 0xA3, 0xF0,
+	0xBD, 0xE2, 0xB0, 0xDE, 0xA4, 0x0C,
+	0xC9, 0xE2, 0xC8, 0x5A, 0xA4, 0x36,
+	0x1D, 0xE2, 0xD0, 0x36, 0xA4, 0x5A,
+};
+static const uint32_t gFrames2[] = {
+	0x0F152, 0x151F8,
+	0x0F158, 0x15206,
+	0x0F164, 0x1521B,
+	0x0F168, 0x1522D,
+};
+// MAX30102 SpO2 16 bit
+static const uint8_t gStream3[] = {
+	0x3D, 0xE2, 0xA4, 0xC2, 0xA3, 0xF0,
+	0x4D, 0xE2, 0xB0, 0x32, 0xA4, 0x0C,
+	0x51, 0xE2, 0xC8, 0xFE, 0xA4, 0x34,
+	0x41, 0xE2, 0xD0, 0xC6, 0xA4, 0x58,
+};
+static const uint32_t gFrames3[] = {
+	0x078A9, 0x0A8FC,
+	0x078AC, 0x0A903,
+	0x078B2, 0x0A90D,
+	0x078B4, 0x0A916,
+};
+// MAX30102 SpO2 15 bit
+static const uint8_t gStream4[] = {
+	0x89, 0xE2, 0xA0, 0x5E, 0xA3, 0xF0,
+	0xC1, 0xE2, 0xB0, 0x22, 0xA4, 0x08,
+	0x19, 0xE2, 0xC8, 0x1E, 0xA4, 0x30,
+	0x5D, 0xE2, 0xD0, 0x1E, 0xA4, 0x58,
+};
+static const uint32_t gFrames4[] = {
+	0x03C54, 0x0547E,
+	0x03C56, 0x05481,
+	0x03C59, 0x05486,
+	0x03C5A, 0x0548B,
+};
+// MAX30102 multi-LED 3 slots
+static const uint8_t gStream5[] = {
+	0x01, 0xE2, 0xA5, 0x00, 0x00, 0x00, 0x02, 0xA3, 0xF1,
+	0x01, 0xE2, 0xB1, 0x00, 0x00, 0x12, 0x02, 0xA4, 0x0C,
+};
+static const uint32_t gFrames5[] = {
+	0x1E2A5, 0x00000, 0x2A3F1,
+	0x1E2B1, 0x00012, 0x2A40C,
+};
+// MAX30102 multi-LED 4 slots
+static const uint8_t gStream6[] = {
+	0x01, 0xE2, 0xA4, 0x02, 0xA3, 0xF0, 0x00, 0x00, 0x00, 0x01, 0xE3, 0x40,
+	0x01, 0xE2, 0xB0, 0x02, 0xA4, 0x0C, 0x00, 0x00, 0x00, 0x01, 0xE3, 0x4E,
+};
+static const uint32_t gFrames6[] = {
+	0x0F152, 0x151F8, 0x00000, 0x0F1A0,
+	0x0F158, 0x15206, 0x00000, 0x0F1A7,
+};
+// MAX30100 SpO2 16 bit
+static const uint8_t gStream7[] = {
+	0x5D, 0x2C, 0x4B, 0x17,
+	0x5D, 0x41, 0x4B, 0x20,
+	0x5D, 0x63, 0x4B, 0x3A,
+};
+static const uint32_t gFrames7[] = {
+	0x5D2C, 0x4B17,
+	0x5D41, 0x4B20,
+	0x5D63, 0x4B3A,
+};
+// MAX30100 SpO2 15 bit
+static const uint8_t gStream8[] = {
+	0x5D, 0x2C, 0x4B, 0x16,
+	0x5D, 0x40, 0x4B, 0x20,
+	0x5D, 0x62, 0x4B, 0x3A,
+};
+static const uint32_t gFrames8[] = {
+	0x2E96, 0x258B,
+	0x2EA0, 0x2590,
+	0x2EB1, 0x259D,
+};
+// MAX30100 SpO2 14 bit
+static const uint8_t gStream9[] = {
+	0x5D, 0x2C, 0x4B, 0x14,
+	0x5D, 0x40, 0x4B, 0x20,
+	0x5D, 0x60, 0x4B, 0x38,
+};
+static const uint32_t gFrames9[] = {
+	0x174B, 0x12C5,
+	0x1750, 0x12C8,
+	0x1758, 0x12CE,
+};
+// MAX30100 SpO2 13 bit
+static const uint8_t gStream10[] = {
+	0x5D, 0x28, 0x4B, 0x10,
+	0x5D, 0x40, 0x4B, 0x20,
+	0x5D, 0x60, 0x4B, 0x38,
+};
+static const uint32_t gFrames10[] = {
+	0x0BA5, 0x0962,
+	0x0BA8, 0x0964,
+	0x0BAC, 0x0967,
+};
+// MAX30100 HR 16 bit
+static const uint8_t gStream11[] = {
+	0x5D, 0x2C, 0x00, 0x00,
+	0x5D, 0x41, 0x00, 0x00,
+};
+static const uint32_t gFrames11[] = {
+	0x5D2C, 0x0000,
+	0x5D41, 0x0000,
+};
+static const struct DecoderCase_t gCases[] = {
+	{ "MAX30102 HR 18 bit", MAX3010X_PARTID_MAX30102, 1, 18, FIFODECODER_NOSLOT, 0, 4, gStream0, gFrames0 },
+	{ "MAX30102 SpO2 18 bit", MAX3010X_PARTID_MAX30102, 2, 18, 1, 0, 4, gStream1, gFrames1 },
+	{ "MAX30102 SpO2 17 bit", MAX3010X_PARTID_MAX30102, 2, 17, 1, 0, 4, gStream2, gFrames2 },
+	{ "MAX30102 SpO2 16 bit", MAX3010X_PARTID_MAX30102, 2, 16, 1, 0, 4, gStream3, gFrames3 },
+	{ "MAX30102 SpO2 15 bit", MAX3010X_PARTID_MAX30102, 2, 15, 1, 0, 4, gStream4, gFrames4 },
+	{ "MAX30102 multi-LED 3 slots", MAX3010X_PARTID_MAX30102, 3, 18, 2, 0, 2, gStream5, gFrames5 },
+	{ "MAX30102 multi-LED 4 slots", MAX3010X_PARTID_MAX30102, 4, 17, 1, 3, 2, gStream6, gFrames6 },
+	{ "MAX30100 SpO2 16 bit", MAX3010X_PARTID_MAX30100, 2, 16, 0, 1, 3, gStream7, gFrames7 },
+	{ "MAX30100 SpO2 15 bit", MAX3010X_PARTID_MAX30100, 2, 15, 0, 1, 3, gStream8, gFrames8 },
+	{ "MAX30100 SpO2 14 bit", MAX3010X_PARTID_MAX30100, 2, 14, 0, 1, 3, gStream9, gFrames9 },
+	{ "MAX30100 SpO2 13 bit", MAX3010X_PARTID_MAX30100, 2, 13, 0, 1, 3, gStream10, gFrames10 },
+	{ "MAX30100 HR 16 bit", MAX3010X_PARTID_MAX30100, 2, 16, 0, 1, 2, gStream11, gFrames11 },
+};
+
+static const struct InvalidFormat_t gInvalidFormats[] = {
+	{ MAX3010X_PARTID_MAX30102, 2, 14 },
+	{ MAX3010X_PARTID_MAX30102, 2, 19 },
+	{ MAX3010X_PARTID_MAX30102, 0, 18 },
+	{ MAX3010X_PARTID_MAX30102, FIFODECODER_MAXSLOTS + 1, 18 },
+	{ MAX3010X_PARTID_MAX30100, 2, 12 },
+	{ MAX3010X_PARTID_MAX30100, 2, 17 },
+	{ MAX3010X_PARTID_MAX30100, 3, 16 },
+	{ 0x00, 2, 16 }
+};
+
+static const struct BenchFormat_t gBenchFormats[] = {
+	{ "MAX30102 HR", MAX3010X_PARTID_MAX30102, 1, 18 },
+	{ "MAX30102 SpO2", MAX3010X_PARTID_MAX30102, 2, 18 },
+	{ "MAX30102 multi-LED 4", MAX3010X_PARTID_MAX30102, 4, 18 },
+	{ "MAX30100 SpO2", MAX3010X_PARTID_MAX30100, 2, 16 }
+};
+
+static uint32_t gFailures = 0;
+
+// internal prototypes
+static void checkCase(const struct DecoderCase_t* pCase);
+static void checkInvalidFormat(const struct InvalidFormat_t* pInvalid);
+static void runBench(const struct BenchFormat_t* pBench);
+
+// ***** implementation *****
+void app_main() {
+	uint32_t cases = sizeof(gCases) / sizeof(gCases[0]) + sizeof(gInvalidFormats) / sizeof(gInvalidFormats[0]);
+	for (int i = 0; i < sizeof(gCases) / sizeof(gCases[0]); i += 1) {
+		checkCase(&gCases[i]);
+	}
+	for (int i = 0; i < sizeof(gInvalidFormats) / sizeof(gInvalidFormats[0]); i += 1) {
+		checkInvalidFormat(&gInvalidFormats[i]);
+	}
+	printf("%" PRIu32 " cases, %" PRIu32 " failed\n", cases, gFailures);
+
+	for (int i = 0; i < sizeof(gBenchFormats) / sizeof(gBenchFormats[0]); i += 1) {
+		runBench(&gBenchFormats[i]);
+	}
+	#if CONFIG_IDF_TARGET_LINUX
+	// exit code for scripts
+	exit((gFailures > 0) ? EXIT_FAILURE : EXIT_SUCCESS);
+	#endif
+}
+
+// decodes the stream as a whole and as IR/red arrays
+void checkCase(const struct DecoderCase_t* pCase) {
+	struct FifoFormat_t format;
+	uint32_t frames[MAX3010X_BURST_MAXSAMPLES * FIFODECODER_MAXSLOTS];
+	uint32_t irValues[MAX3010X_BURST_MAXSAMPLES];
+	uint32_t redValues[MAX3010X_BURST_MAXSAMPLES];
+	bool ok = fifodecoder_initFormat(&format, pCase->partID, pCase->slotCount, pCase->adcBits);
+	if (ok) {
+		format.irSlot = pCase->irSlot;
+		format.redSlot = pCase->redSlot;
+		uint16_t count = fifodecoder_decode(&format, pCase->data, pCase->samples, frames);
+		ok = (count == pCase->samples * pCase->slotCount);
+		for (uint16_t i = 0; ok && (i < count); i += 1) {
+			if (frames[i] != pCase->frames[i]) {
+				printf("%s: sample %d slot %d is 0x%05" PRIX32 ", expected 0x%05" PRIX32 "\n", pCase->name,
+						i / pCase->slotCount, i % pCase->slotCount, frames[i], pCase->frames[i]);
+				ok = false;
+			}
+		}
+		// every sample's own slots, not those of the first one
+		fifodecoder_decodeIRRed(&format, pCase->data, pCase->samples, irValues, redValues);
+		for (uint16_t i = 0; ok && (i < pCase->samples); i += 1) {
+			uint32_t ir = (pCase->irSlot != FIFODECODER_NOSLOT) ? pCase->frames[i * pCase->slotCount + pCase->irSlot] : 0;
+			uint32_t red = (pCase->redSlot != FIFODECODER_NOSLOT) ? pCase->frames[i * pCase->slotCount + pCase->redSlot] : 0;
+			if ((irValues[i] != ir) || (redValues[i] != red)) {
+				printf("%s: sample %d IR/red is 0x%05" PRIX32 "/0x%05" PRIX32 ", expected 0x%05" PRIX32 "/0x%05" PRIX32 "\n", pCase->name,
+						i, irValues[i], redValues[i], ir, red);
+				ok = false;
+			}
+		}
+	}
+	printf("%-28s %s\n", pCase->name, ok ? "ok" : "FAILED");
+	if (!ok) {
+		gFailures += 1;
+	}
+}
+
+void checkInvalidFormat(const struct InvalidFormat_t* pInvalid) {
+	struct FifoFormat_t format;
+	if (fifodecoder_initFormat(&format, pInvalid->partID, pInvalid->slotCount, pInvalid->adcBits)) {
+		printf("part 0x%02X, %d slots, %d bit accepted\n", pInvalid->partID, pInvalid->slotCount, pInvalid->adcBits);
+		gFailures += 1;
+	}
+}
+
+// full bursts of a counting byte pattern
+void runBench(const struct BenchFormat_t* pBench) {
+	static uint8_t data[BENCH_SAMPLES * FIFODECODER_MAXSLOTS * 3];
+	static uint32_t frames[BENCH_SAMPLES * FIFODECODER_MAXSLOTS];
+	static uint32_t irValues[BENCH_SAMPLES];
+	static uint32_t redValues[BENCH_SAMPLES];
+	struct FifoFormat_t format;
+	if (!fifodecoder_initFormat(&format, pBench->partID, pBench->slotCount, pBench->adcBits)) {
+		return;
+	}
+	format.redSlot = 0;
+	format.irSlot = pBench->slotCount - 1;
+	uint32_t burstBytes = BENCH_SAMPLES * fifodecoder_getBytesPerSample(&format);
+	for (uint32_t i = 0; i < burstBytes; i += 1) {
+		data[i] = i;
+	}
+	uint32_t checksum = 0;
+
+	int64_t start = esp_timer_get_time();
+	for (uint32_t i = 0; i < CONFIG_MAX3010X_TEST_BENCH_BURSTS; i += 1) {
+		fifodecoder_decode(&format, data, BENCH_SAMPLES, frames);
+		checksum += frames[i % BENCH_SAMPLES];
+	}
+	int64_t decodeTime = esp_timer_get_time() - start;
+	start = esp_timer_get_time();
+	for (uint32_t i = 0; i < CONFIG_MAX3010X_TEST_BENCH_BURSTS; i += 1) {
+		fifodecoder_decodeIRRed(&format, data, BENCH_SAMPLES, irValues, redValues);
+		checksum += irValues[i % BENCH_SAMPLES];
+	}
+	int64_t irRedTime = esp_timer_get_time() - start;
+
+	// the checksum keeps the compiler from dropping the loops
+	float bytes = (float)burstBytes * CONFIG_MAX3010X_TEST_BENCH_BURSTS;
+	printf("%-22s %4" PRIu32 " bytes/burst  decode %8.1f bytes/us  decodeIRRed %8.1f bytes/us  (%08" PRIX32 ")\n",
+			pBench->name, burstBytes, bytes / (float)((decodeTime > 0) ? decodeTime : 1),
+			bytes / (float)((irRedTime > 0) ? irRedTime : 1), checksum);
+}
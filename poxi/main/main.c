@@ -25,7 +25,10 @@
 #include "led_strip.h"
 #include "esp_timer.h"
 #include "graphics.h"
+#include "widgets.h"
+#include "sprites.h"
 #include "max3010x.h"
+#include "i2carbiter.h"
 #include "pulseoxi.h"
 #include "pushbtn.h"
 #include "filter.h"
@@ -52,9 +55,9 @@
 // internal prototypes
 static esp_err_t initI2C(i2c_port_t i2c_num);
 static void initLED(void);
-static void drawBackground(void);
-static void drawPulseOxi(void);
-static void drawChart(float pressure, float spo2);
+static void initScreen(void);
+static void updatePulseOxi(void);
+static void updateChart(float pressure, float spo2);
 
 // module internal globals
 static const char* TAG = "poxi";
@@ -63,6 +66,12 @@ static led_strip_handle_t gLedStrip;
 static Filter* pPulseFilter = NULL;
 static Filter* pOxiFilter = NULL;
 
+static WidgetScreen* gScreen = NULL;
+static Widget* gPulseValue = NULL;
+static SpriteLayer* gSprites = NULL;
+static Sprite* gHeartSprite = NULL;
+static Widget* gChart = NULL;
+
 // ***** implementation *****
 esp_err_t initI2C(i2c_port_t i2c_num) {
 	ESP_LOGI(TAG, "init I2C");
@@ -97,29 +106,43 @@ void initLED() {
     led_strip_clear(gLedStrip);
 }
 
-void drawBackground() {
+void initScreen() {
+	gScreen = widgets_createScreen();
+	configASSERT(gScreen != NULL);
+	// z-order: first added is drawn first
+	Widget* pLeftBack = widgets_createIcon(0, 0, LEFT_BACK_PNG_WIDTH, LEFT_BACK_PNG_HEIGHT, left_back_png, true);
+	configASSERT(pLeftBack != NULL);
+	widgets_addWidget(gScreen, pLeftBack);
+	Widget* pRightBack = widgets_createIcon(graphics_getDisplayWidth() - RIGHT_BACK_PNG_WIDTH - 1, 0, RIGHT_BACK_PNG_WIDTH, RIGHT_BACK_PNG_HEIGHT, right_back_png, true);
+	configASSERT(pRightBack != NULL);
+	widgets_addWidget(gScreen, pRightBack);
+	gChart = widgets_createChart(4, 0, 97, 32, STRIPCHART_SWEEP, 24);
+	configASSERT(gChart != NULL);
+	widgets_addWidget(gScreen, gChart);
+	gPulseValue = widgets_createValue(10, 40, 99, 56, "%d bpm", PULSEOXI_NOPULSE, "NO FINGER");
+	configASSERT(gPulseValue != NULL);
+	widgets_setLabelAlign(gPulseValue, TEXTLAYOUT_CENTER);
+	widgets_addWidget(gScreen, gPulseValue);
+	// the heart restores the (static) right border beneath it when hidden
+	gSprites = sprites_createLayer();
+	configASSERT(gSprites != NULL);
+	gHeartSprite = sprites_createSprite(gSprites, HEART_PNG_WIDTH, HEART_PNG_HEIGHT, SPRITES_SAVEUNDER, 0);
+	configASSERT(gHeartSprite != NULL);
+	sprites_setImage(gHeartSprite, heart_png);
+	sprites_moveTo(gHeartSprite, 99, 4);
+
 	graphics_startUpdate();
 	graphics_clearScreen();
-	graphics_setImage(0, 0, LEFT_BACK_PNG_WIDTH, LEFT_BACK_PNG_HEIGHT, left_back_png);
-	graphics_setImage(graphics_getDisplayWidth() - RIGHT_BACK_PNG_WIDTH - 1, 0, RIGHT_BACK_PNG_WIDTH, RIGHT_BACK_PNG_HEIGHT, right_back_png);
+	widgets_render(gScreen);
+	sprites_render(gSprites);
 	graphics_finishUpdate();
 }
 
-void drawPulseOxi() {
-	graphics_startUpdate();
-	graphics_setCursor(10, 40);
-	if (pulseoxi_getState()->fastHeartbeatDetectionState.currentPulse_bpm == PULSEOXI_NOPULSE) {
-		graphics_writeString("NO FINGER");
-	} else {
-		char buf[16];
-		sprintf(buf, "%d bpm", pulseoxi_getState()->fastHeartbeatDetectionState.currentPulse_bpm);
-		graphics_writeString(buf);
-	}
-	graphics_finishUpdate();
+void updatePulseOxi() {
+	widgets_setValue(gPulseValue, pulseoxi_getState()->fastHeartbeatDetectionState.currentPulse_bpm);
 }
 
-void drawChart(float pressure, float spo2) {
-	static int x = 4;
+void updateChart(float pressure, float spo2) {
 	static int cnt = 0;
 	(void) spo2; // ignore SPO2 value
 	cnt += 1;
@@ -128,33 +151,24 @@ void drawChart(float pressure, float spo2) {
 		int y = 24 - pressure;
 		if (y < 0) y = 0;
 		if (y > 31) y = 31;
-		graphics_setPixel(x, y);
+		widgets_addChartValue(gChart, y);
 		if (y < 20) {
 			led_strip_set_pixel(gLedStrip, 0, (24-y) / 4, 0, 0);
 		} else {
 			led_strip_set_pixel(gLedStrip, 0, 0, 0, 0);
 		}
-
-		x += 1;
-		if (x > 96) {
-			graphics_clearRegion(4, 0, 97, 64);
-			for (int x = 4; x < 97; x += 4) {
-				graphics_setPixel(x, 24); // horizontal line
-			}
-			x = 4;
-		}
 		cnt = 0;
 
 		static uint8_t showPulse = 0;
 		if (showPulse == 0) {
 			if (pulseoxi_getState()->fastHeartbeatDetectionState.pulseDetected) {
 				showPulse = 10;
-				graphics_setImage(99, 4, HEART_PNG_WIDTH, HEART_PNG_HEIGHT, heart_png);
+				sprites_setVisible(gHeartSprite, true);
 			}
 		} else {
 			if (showPulse == 1) {
 				pulseoxi_resetPulseDetected();
-				graphics_clearRegion(99, 0, 99 + HEART_PNG_WIDTH, 64);
+				sprites_setVisible(gHeartSprite, false);
 			}
 			showPulse -= 1;
 		}
@@ -164,7 +178,7 @@ void drawChart(float pressure, float spo2) {
 void measurementCallback(float pulse, float oxi) {
 	float filteredPulse = filter_filterValue(pPulseFilter, pulse);
 	float filteredOxi = filter_filterValue(pOxiFilter, oxi);
-	drawChart(filteredPulse, filteredOxi);
+	updateChart(filteredPulse, filteredOxi);
 }
 
 void app_main(void) {
@@ -191,14 +205,12 @@ void app_main(void) {
 	char buf[32];
 	struct PulseOxiSettings_t poSettings = {
 			.i2cPort = I2C_INTERFACE,
-			.gpioIRQ = GPIO_NUM_NC, // don't use IRQ
+			.gpioIRQ = CONFIG_MAX3010X_IRQ_GPIO, // -1 (GPIO_NUM_NC): don't use IRQ
 			.modes = (PULSEOXI_MODE_CALLBACKONEVERYSAMPLE | PULSEOXI_MODE_FASTHEARTBEATDETECTION | PULSEOXI_MODE_HEARTBEATSPO2DETECTION | PULSEOXI_MODE_PRECISEFFTHEARTBEATDETECTION),
 			.debugMode = false,
 			.measurementCallback = measurementCallback
 	};
-	pulseoxi_init(&poSettings);
-	const struct Max3010xDevice_t* pMaxDevice = pulseoxi_getMax3010xDevice();
-	if (pMaxDevice == NULL) {
+	if (pulseoxi_init(&poSettings) != ESP_OK) {
 		graphics_startUpdate();
 		graphics_println("MAX3010x not found!");
 		graphics_println("Cannot start!");
@@ -208,6 +220,7 @@ void app_main(void) {
 			usleep(1000000);
 		}
 	}
+	const struct Max3010xDevice_t* pMaxDevice = pulseoxi_getMax3010xDevice();
 	const char* deviceName = max3010x_getDeviceName(pMaxDevice);
 	graphics_startUpdate();
 	graphics_println("Found");
@@ -251,6 +264,9 @@ void app_main(void) {
 	
 	int64_t timePrev = 0; // for use in main loop
 	#endif
+	#if CONFIG_GRAPHICS_STATS || CONFIG_I2CARBITER_STATS
+	int64_t statsPrev = 0;
+	#endif
 
 	usleep(1000000); // 1 s
 
@@ -264,7 +280,7 @@ void app_main(void) {
 	graphics_finishUpdate();
 	usleep(3000000); // 1 s
 
-	drawBackground();
+	initScreen();
 
 	// start pulseoxi task
 	pulseoxi_start();
@@ -293,7 +309,10 @@ void app_main(void) {
     		}
     	}
 
-		drawPulseOxi();
+		// redraws only changed widgets and sprites, nothing if the screen is unchanged
+		updatePulseOxi();
+		widgets_render(gScreen);
+		sprites_render(gSprites);
 		led_strip_refresh(gLedStrip);
 		#ifndef CONFIG_USE_PROVISIONING
 		int64_t timeNow = esp_timer_get_time();
@@ -302,6 +321,18 @@ void app_main(void) {
 			timePrev = timeNow;
 		}
 		#endif
+		#if CONFIG_GRAPHICS_STATS || CONFIG_I2CARBITER_STATS
+		// display load of the last 10 s, compare with the sensor throughput and its wait for the bus
+		if (esp_timer_get_time() - statsPrev >= 10000000) {
+			#if CONFIG_GRAPHICS_STATS
+			graphics_logStats();
+			#endif
+			#if CONFIG_I2CARBITER_STATS
+			i2carbiter_logStats(I2C_INTERFACE);
+			#endif
+			statsPrev = esp_timer_get_time();
+		}
+		#endif
 
 		usleep(10000); // 10 ms
 	}
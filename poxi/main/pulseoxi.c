@@ -19,9 +19,12 @@
 #include <stdio.h>
 #include <math.h>
 #include <string.h>
-#include <unistd.h>
+#include <inttypes.h>
+#include "esp_check.h"
+#include "esp_heap_caps.h"
 #include "esp_dsp.h"
-#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 #include "max3010x.h"
 #include "algorithm.h"
 #include "pulseoxi.h"
@@ -31,8 +34,6 @@
 
 #define TAG								"pulseoxi"
 
-#define LEDRAWBUFFERSIZE				32
-
 #define PULSEOXI_TASK_STACKSIZE			4096
 #define PULSEOXI_TASK_PRIORITY			3
 
@@ -54,17 +55,19 @@ static struct PulseOxiSettings_t gSettings;
 
 static struct PulseOxiState_t gState = { 0 };
 static TaskHandle_t gPulseoxiTaskHandle = NULL;
+static struct Max3010xDevice_t* gMax3010xDevice = NULL;
 
 static void pulseoxiTaskMainFunc(void * pvParameters);
-static void dataAvailableCallback(void);
-static void detectPulse(int pulseValue);
+static void detectPulse(int pulseValue, int64_t time_us);
 
 
 // ***** implementation *****
-void pulseoxi_init(struct PulseOxiSettings_t* pSettings) {
+esp_err_t pulseoxi_init(struct PulseOxiSettings_t* pSettings) {
 	assert(pSettings->measurementCallback != NULL);
 	gSettings = *pSettings;
-	max3010x_init(gSettings.i2cPort, gSettings.gpioIRQ, dataAvailableCallback);
+	// without a sensor gMax3010xDevice stays NULL, pulseoxi_start() must not be called
+	ESP_RETURN_ON_ERROR(max3010x_init(gSettings.i2cPort, gSettings.gpioIRQ, NULL), TAG, "No MAX3010x found on port %d", gSettings.i2cPort);
+	gMax3010xDevice = max3010x_getDevice();
 	// initialize states for the used modes
 	if (gSettings.modes & (PULSEOXI_MODE_CALLBACKONEVERYSAMPLE | PULSEOXI_MODE_FASTHEARTBEATDETECTION))  {
 		gState.singleSampleState.pDCIRFilter = dcfilter_create(DCFILTER_ALPHA);
@@ -91,16 +94,18 @@ void pulseoxi_init(struct PulseOxiSettings_t* pSettings) {
 		assert(gState.preciseFFTState.fftValues != NULL);
 		ESP_ERROR_CHECK(dsps_fft2r_init_fc32(NULL, PULSEOXI_MAX_FFT_SIZE));
 	}
+	return ESP_OK;
 }
 
 void pulseoxi_start() {
+	assert(gMax3010xDevice != NULL);
 	// create task for data fetching and processing
 	xTaskCreate(pulseoxiTaskMainFunc, "PULSEOXI", PULSEOXI_TASK_STACKSIZE, NULL, PULSEOXI_TASK_PRIORITY, &gPulseoxiTaskHandle);
 	configASSERT(gPulseoxiTaskHandle);
 }
 
 const struct Max3010xDevice_t* pulseoxi_getMax3010xDevice() {
-	return max3010x_getDevice();
+	return gMax3010xDevice;
 }
 
 const struct PulseOxiState_t* pulseoxi_getState() {
@@ -112,20 +117,33 @@ void pulseoxi_resetPulseDetected() {
 }
 
 void pulseoxiTaskMainFunc(void * pvParameters) {
-	uint32_t irLEDRawValues[LEDRAWBUFFERSIZE];
-	uint32_t redLEDRawValues[LEDRAWBUFFERSIZE];
+	max3010x_softReset(gMax3010xDevice);
+	// longest pulse width (highest resolution), no averaging
+	struct Max3010xConfig_t config = {
+			.mode = MAX3010X_MODE_SPO2_HR,
+			.samplingRate = PULSEOXI_SAMPLINGRATE_Hz
+	};
+	ESP_ERROR_CHECK(max3010x_setup(gMax3010xDevice, &config));
+	// the FIFO is read by the acquisition task of the driver while the previous burst is processed here
+	ESP_ERROR_CHECK(max3010x_startAcquisition(gMax3010xDevice));
 
-	max3010x_softReset();
-	max3010x_setup(MAX3010X_MODE_SPO2_HR, PULSEOXI_SAMPLINGRATE_Hz);
+	// keep the signal within the ADC range by adapting the LED currents
+	max3010x_enableAGC(gMax3010xDevice, true);
 
 	while (true) {
-		if (gSettings.gpioIRQ != GPIO_NUM_NC) {
-			ulTaskNotifyTake(pdTRUE, portMAX_DELAY); // wait for signaled interrupt
+		const struct Max3010xBurst_t* pBurst = max3010x_receiveBurst(gMax3010xDevice, portMAX_DELAY);
+		if (pBurst->gainChanged) {
+			// re-prime the stages that see the DC level: the filters continue at the new level, the
+			// SpO2 buffer must not contain a step
+			if (gSettings.modes & (PULSEOXI_MODE_CALLBACKONEVERYSAMPLE | PULSEOXI_MODE_FASTHEARTBEATDETECTION)) {
+				dcfilter_prime(gState.singleSampleState.pDCIRFilter, (float)pBurst->irValues[0]);
+				dcfilter_prime(gState.singleSampleState.pDCRedFilter, (float)pBurst->redValues[0]);
+			}
+			gState.heartbeatSpO2DetectionState.bufferOffset = 0;
 		}
-		uint8_t cnt = max3010x_readFIFO(irLEDRawValues, redLEDRawValues, LEDRAWBUFFERSIZE);
-		for (uint8_t i = 0; i < cnt; i += 1) {
-			float irValue = (float)irLEDRawValues[i];
-			float redValue = (float)redLEDRawValues[i];
+		for (uint8_t i = 0; i < pBurst->count; i += 1) {
+			float irValue = (float)pBurst->irValues[i];
+			float redValue = (float)pBurst->redValues[i];
 			float delta = irValue - redValue;
 			//These are special packets for FlexiPlot plotting tool
 			if (gSettings.debugMode) {
@@ -148,7 +166,7 @@ void pulseoxiTaskMainFunc(void * pvParameters) {
 				}
 
 				if (gSettings.modes & PULSEOXI_MODE_FASTHEARTBEATDETECTION) {
-					detectPulse(irValue);
+					detectPulse(irValue, pBurst->timestamps_us[i]);
 				}
 			}
 
@@ -162,7 +180,7 @@ void pulseoxiTaskMainFunc(void * pvParameters) {
 							gState.heartbeatSpO2DetectionState.irBuffer, PULSEOXI_HEARTBEATSPO2DETECTION_BUFFERLENGTH, gState.heartbeatSpO2DetectionState.redBuffer,
 							&(gState.heartbeatSpO2DetectionState.currentSpO2Value), &(gState.heartbeatSpO2DetectionState.spo2Valid),
 							&(gState.heartbeatSpO2DetectionState.currentHeartrate), &(gState.heartbeatSpO2DetectionState.hrValid));
-					printf("SpO2=%ld, valid=%d, heartrate=%ld, valid=%d\n", gState.heartbeatSpO2DetectionState.currentSpO2Value, gState.heartbeatSpO2DetectionState.spo2Valid,
+					printf("SpO2=%" PRId32 ", valid=%d, heartrate=%" PRId32 ", valid=%d\n", gState.heartbeatSpO2DetectionState.currentSpO2Value, gState.heartbeatSpO2DetectionState.spo2Valid,
 							gState.heartbeatSpO2DetectionState.currentHeartrate, gState.heartbeatSpO2DetectionState.hrValid);
 
 					// dumping the first 100 sets of samples in the memory and shift the last 400 sets of samples to the top
@@ -204,18 +222,12 @@ void pulseoxiTaskMainFunc(void * pvParameters) {
 				}
 			}
 		}
-		usleep(10000); // 10ms
-	}
-}
-
-void dataAvailableCallback() {
-	if (gPulseoxiTaskHandle != NULL) {
-		BaseType_t higherPriorityTaskWoken = pdFALSE;
-		vTaskNotifyGiveFromISR(gPulseoxiTaskHandle, &higherPriorityTaskWoken);
+		max3010x_releaseBurst(gMax3010xDevice, pBurst);
 	}
 }
 
-void detectPulse(int pulse) {
+// time_us: when the sample was taken, independent of the burst size and the processing delay
+void detectPulse(int pulse, int64_t time_us) {
 	static int pulseValue = 0;
 	static uint8_t cnt = 0;
 	pulseValue += (int)pulse / 10;
@@ -227,14 +239,14 @@ void detectPulse(int pulse) {
 		static int increases = 0;
 		static int decreases = 0;
 		static int lastBeatMax = 0;
-		static uint32_t lastBeatTick = 0;
-		static uint32_t localMaxTick = 0;
+		static int64_t lastBeatTick = 0;
+		static int64_t localMaxTick = 0;
 
 		if ((pulseValue > localMax) && (pulseValue > lastBeatMax)) {
 			localMax = pulseValue;
 			increases += 1;
 			decreases = 0;
-			localMaxTick = esp_timer_get_time();
+			localMaxTick = time_us;
 		} else if ((pulseValue < localMax) || (pulseValue <= 0)) {
 			decreases += 1;
 			if (decreases == 2) {
@@ -245,6 +257,7 @@ void detectPulse(int pulse) {
 					increases = 0;
 					decreases = 0;
 					uint32_t delta = localMaxTick - lastBeatTick;
+					gState.fastHeartbeatDetectionState.rrInterval_ms = delta / 1000;
 					gState.fastHeartbeatDetectionState.currentPulse_bpm = 60000 / (delta / 1000);
 					lastBeatTick = localMaxTick;
 				}
@@ -18,8 +18,8 @@
 
 #include <stdbool.h>
 #include "filter.h"
-#include "driver/i2c.h"
-#include "driver/gpio.h"
+// i2c_port_t and gpio_num_t, also on the linux target (poxi_sim)
+#include "max3010x.h"
 
 #define PULSEOXI_SAMPLINGRATE_Hz						100
 
@@ -62,6 +62,8 @@ struct PulseOxiFastHeartbeatDetectionState_t {
 	// algorithm state
 	bool pulseDetected;
 	int16_t currentPulse_bpm;
+	// interval between the last two beats, from the sample timestamps
+	uint32_t rrInterval_ms;
 };
 
 struct PulseOxiHeartbeatSpO2DetectionState_t {
@@ -87,7 +89,8 @@ struct PulseOxiState_t {
 };
 
 
-void pulseoxi_init(struct PulseOxiSettings_t* pSettings);
+// initializes the sensor (an error if none is found) and the states of the modes
+esp_err_t pulseoxi_init(struct PulseOxiSettings_t* pSettings);
 void pulseoxi_start();
 const struct Max3010xDevice_t* pulseoxi_getMax3010xDevice();
 const struct PulseOxiState_t* pulseoxi_getState();
@@ -0,0 +1,99 @@
+/*
+ * Part of the book "Embedded Systems mit RISC-V", dpunkt.verlag
+ * Author: Patrick Ritschel
+ *
+ * see https://ritschel.at/buch-embedded-systems-auf-den-punkt-gebracht/
+ *
+ * The code of this project is in the Public Domain (or CC0 licensed, at your option).
+ * Unless required by applicable law or agreed to in writing, this
+ * software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+
+#include "sdkconfig.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "max3010x.h"
+#include "max3010xsim.h"
+#include "pulseoxi.h"
+
+#define TAG					"poxisim"
+#define REPORT_PERIOD_s		10		// in the time of the sensor
+
+static volatile uint32_t gSamples = 0;
+
+static void measurementCallback(float pulse, float oxi);
+static bool checkResults(void);
+
+
+// ***** implementation *****
+void app_main() {
+	if (CONFIG_POXI_SIM_TRACE[0] != '\0') {
+		ESP_ERROR_CHECK(max3010xsim_loadTrace(CONFIG_POXI_SIM_TRACE, CONFIG_POXI_SIM_TRACE_RATE));
+	}
+	// all modes of the pulse oximeter, but no display: the results are checked at the end
+	struct PulseOxiSettings_t settings = {
+			.i2cPort = 0,
+			.gpioIRQ = GPIO_NUM_NC,
+			.modes = (PULSEOXI_MODE_CALLBACKONEVERYSAMPLE | PULSEOXI_MODE_FASTHEARTBEATDETECTION | PULSEOXI_MODE_HEARTBEATSPO2DETECTION | PULSEOXI_MODE_PRECISEFFTHEARTBEATDETECTION),
+			.debugMode = false,
+			.measurementCallback = measurementCallback
+	};
+	ESP_ERROR_CHECK(pulseoxi_init(&settings));
+	int64_t start_us = max3010x_getTime();
+	pulseoxi_start();
+
+	const struct PulseOxiState_t* pState = pulseoxi_getState();
+	int64_t nextReport_us = start_us + REPORT_PERIOD_s * 1000000LL;
+	int64_t end_us = start_us + CONFIG_POXI_SIM_SECONDS * 1000000LL;
+	while (max3010x_getTime() < end_us) {
+		vTaskDelay(pdMS_TO_TICKS(100));
+		if (max3010x_getTime() >= nextReport_us) {
+			nextReport_us += REPORT_PERIOD_s * 1000000LL;
+			ESP_LOGI(TAG, "%" PRId32 " s: pulse %d bpm, SpO2 %" PRId32 " %%, %" PRIu32 " samples, %" PRIu32 " lost", (int32_t)((max3010x_getTime() - start_us) / 1000000),
+					pState->fastHeartbeatDetectionState.currentPulse_bpm, pState->heartbeatSpO2DetectionState.currentSpO2Value, gSamples, max3010xsim_getLostSamples());
+		}
+	}
+	bool passed = checkResults();
+	printf("%s\n", passed ? "PASSED" : "FAILED");
+	#if CONFIG_IDF_TARGET_LINUX
+	// exit code for scripts
+	exit(passed ? EXIT_SUCCESS : EXIT_FAILURE);
+	#endif
+}
+
+// called for every filtered sample
+void measurementCallback(float pulse, float oxi) {
+	gSamples += 1;
+}
+
+// no samples lost, all processed (up to the bursts in flight) and the pulse of the trace found
+bool checkResults() {
+	bool passed = true;
+	uint32_t lost = max3010xsim_getLostSamples();
+	if (lost > 0) {
+		printf("%" PRIu32 " samples lost by FIFO overflows\n", lost);
+		passed = false;
+	}
+	uint32_t expected = CONFIG_POXI_SIM_SECONDS * PULSEOXI_SAMPLINGRATE_Hz;
+	uint32_t missing = (gSamples < expected) ? expected - gSamples : 0;
+	if (missing > MAX3010X_BURSTCOUNT * MAX3010X_BURST_MAXSAMPLES) {
+		printf("%" PRIu32 " of %" PRIu32 " samples processed\n", gSamples, expected);
+		passed = false;
+	}
+	const struct PulseOxiState_t* pState = pulseoxi_getState();
+	int16_t pulse = pState->fastHeartbeatDetectionState.currentPulse_bpm;
+	if ((CONFIG_POXI_SIM_PULSE_bpm > 0) && (abs(pulse - CONFIG_POXI_SIM_PULSE_bpm) > CONFIG_POXI_SIM_PULSE_TOLERANCE_bpm)) {
+		printf("pulse %d bpm, expected %d\n", pulse, CONFIG_POXI_SIM_PULSE_bpm);
+		passed = false;
+	}
+	printf("pulse %d bpm (Maxim: %" PRId32 ", valid %d), SpO2 %" PRId32 " %% (valid %d), %" PRIu32 " samples\n", pulse,
+			pState->heartbeatSpO2DetectionState.currentHeartrate, pState->heartbeatSpO2DetectionState.hrValid,
+			pState->heartbeatSpO2DetectionState.currentSpO2Value, pState->heartbeatSpO2DetectionState.spo2Valid, gSamples);
+	return passed;
+}